@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Synthetic program generator for compile-throughput benchmarks. Each option
+ * scales one axis of the program independently, so a growth curve measured
+ * along it isolates the compiler's cost for that shape of input:
+ *
+ *   --functions N    function definitions, plus a main that calls them
+ *   --globals N      global scalars, each read from the function bodies
+ *   --locals N       locals declared in every function
+ *   --depth N        operators in each generated expression, nested
+ *   --statements N   assignment statements in every function
+ *   --nesting N      depth of nested if/while blocks in every function
+ *   --initializer N  elements in a brace-initialized global array
+ *
+ * The output is written to stdout and is always a valid Donkey program.
+ */
+
+struct shape {
+    int functions;
+    int globals;
+    int locals;
+    int depth;
+    int statements;
+    int nesting;
+    int initializer;
+};
+
+static const char *const operators[] = { "+", "-", "*", "^", "|", "&" };
+
+/* Capped so that deep nesting does not make the source itself grow quadratically. */
+static void indent(int level)
+{
+    for (int i = 0; i < level && i < 8; i++) {
+        fputs("    ", stdout);
+    }
+}
+
+/* Cycles operands through the locals, the globals and small literals. */
+static void operand(const struct shape *shape, int seed)
+{
+    switch (seed % 3) {
+        case 0:
+            printf("l%d", seed % shape->locals);
+            break;
+        case 1:
+            if (shape->globals > 0) {
+                printf("g%d", seed % shape->globals);
+            } else {
+                printf("a");
+            }
+            break;
+        default:
+            printf("%d", seed % 97);
+            break;
+    }
+}
+
+/* Emits a right-nested expression with `depth` binary operators. */
+static void expression(const struct shape *shape, int seed, int depth)
+{
+    int opened = 0;
+
+    for (int i = 0; i < depth; i++) {
+        operand(shape, seed + i);
+        printf(" %s (", operators[(seed + i) % 6]);
+        opened++;
+    }
+    operand(shape, seed + depth);
+    for (int i = 0; i < opened; i++) {
+        putchar(')');
+    }
+}
+
+static void function(const struct shape *shape, int index)
+{
+    printf("int f%d(int a, int b)\n{\n", index);
+    for (int i = 0; i < shape->locals; i++) {
+        printf("    int l%d = a + %d;\n", i, i);
+    }
+    for (int i = 0; i < shape->statements; i++) {
+        printf("    l%d = ", (index + i) % shape->locals);
+        expression(shape, index * 31 + i * 7, shape->depth);
+        printf(";\n");
+    }
+    for (int level = 0; level < shape->nesting; level++) {
+        indent(level + 1);
+        if (level % 2 == 0) {
+            printf("if (b > %d) {\n", level);
+        } else {
+            printf("while (b < %d) {\n", level + 10);
+            indent(level + 2);
+            printf("b = b + 1;\n");
+        }
+        indent(level + 2);
+        printf("l0 = l0 + %d;\n", level);
+    }
+    for (int level = shape->nesting; level > 0; level--) {
+        indent(level);
+        printf("}\n");
+    }
+    printf("    return l0 + b;\n}\n");
+}
+
+static int parse_count(const char *text, const char *name)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    if (*end != '\0' || value < 0 || value > 100000000) {
+        fprintf(stderr, "Invalid value for %s: %s\n", name, text);
+        exit(EXIT_FAILURE);
+    }
+    return (int)value;
+}
+
+int main(int argc, char *argv[])
+{
+    struct shape shape = { 1, 0, 1, 1, 1, 0, 0 };
+
+    for (int i = 1; i < argc; i++) {
+        int *field = NULL;
+
+        if (strcmp(argv[i], "--functions") == 0) field = &shape.functions;
+        else if (strcmp(argv[i], "--globals") == 0) field = &shape.globals;
+        else if (strcmp(argv[i], "--locals") == 0) field = &shape.locals;
+        else if (strcmp(argv[i], "--depth") == 0) field = &shape.depth;
+        else if (strcmp(argv[i], "--statements") == 0) field = &shape.statements;
+        else if (strcmp(argv[i], "--nesting") == 0) field = &shape.nesting;
+        else if (strcmp(argv[i], "--initializer") == 0) field = &shape.initializer;
+
+        if (!field || i + 1 >= argc) {
+            fprintf(stderr, "Usage: %s [--functions N] [--globals N] [--locals N] [--depth N]\n"
+                "       [--statements N] [--nesting N] [--initializer N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        *field = parse_count(argv[i + 1], argv[i]);
+        i++;
+    }
+    if (shape.functions < 1) shape.functions = 1;
+    if (shape.locals < 1) shape.locals = 1;
+
+    for (int i = 0; i < shape.globals; i++) {
+        printf("int g%d = %d;\n", i, i % 97);
+    }
+    if (shape.initializer > 0) {
+        printf("int table[%d] = {", shape.initializer);
+        for (int i = 0; i < shape.initializer; i++) {
+            printf(i % 16 == 0 ? "\n    %d," : " %d,", i % 97);
+        }
+        printf("\n};\n");
+    }
+    for (int i = 0; i < shape.functions; i++) {
+        function(&shape, i);
+    }
+
+    printf("int main()\n{\n    int total = 0;\n");
+    for (int i = 0; i < shape.functions && i < 64; i++) {
+        printf("    total = total + f%d(%d, %d);\n", i, i, i + 1);
+    }
+    printf("    return total & 127;\n}\n");
+    return EXIT_SUCCESS;
+}
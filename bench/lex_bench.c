@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Micro-benchmark for lex(): builds synthetic sources of increasing size in
+ * memory and reports the best of several runs for each size, so growth in
+ * per-token cost shows up directly.
+ */
+
+static const char function_template[] =
+    "int func%d(int a, int b)\n"
+    "{\n"
+    "    int total = a * %d + b; /* mix of tokens */\n"
+    "    while (total > 10 && b != 3) {\n"
+    "        total -= (total >> 1) + sizeof(short);\n"
+    "    }\n"
+    "    return total <<= 2; // trailing comment\n"
+    "}\n";
+
+static char *build_source(int function_count, size_t *length)
+{
+    size_t capacity = (size_t)function_count * (sizeof(function_template) + 32) + 1;
+    char *source = malloc(capacity);
+    size_t used = 0;
+
+    if (!source) {
+        perror("Error allocating benchmark source");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < function_count; i++) {
+        used += (size_t)snprintf(source + used, capacity - used, function_template, i, i);
+    }
+    *length = used;
+    return source;
+}
+
+static double elapsed_ms(struct timespec start, struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) * 1000.0 +
+        (double)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_functions = argc > 1 ? atoi(argv[1]) : 65536;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+    printf("%10s %12s %12s %10s %10s\n", "functions", "bytes", "tokens", "best ms", "ns/token");
+    for (int functions = 1024; functions <= max_functions; functions *= 2) {
+        size_t length;
+        char *source = build_source(functions, &length);
+        double best = -1.0;
+        int token_count = 0;
+
+        for (int run = 0; run < runs; run++) {
+            struct compilation unit;
+            struct timespec start;
+            struct timespec end;
+            double ms;
+
+            compilation_init(&unit, "bench.c");
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            lex(&unit, source, length);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            token_count = unit.token_count;
+            compilation_release(&unit);
+            emitter_release(&unit.diagnostics);
+
+            ms = elapsed_ms(start, end);
+            if (best < 0.0 || ms < best) {
+                best = ms;
+            }
+        }
+
+        printf("%10d %12zu %12d %10.2f %10.1f\n", functions, length, token_count, best,
+            best * 1000000.0 / token_count);
+        free(source);
+    }
+    return EXIT_SUCCESS;
+}
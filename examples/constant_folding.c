@@ -0,0 +1,18 @@
+int g = 3;
+
+int main()
+{
+    int r = 0;
+    unsigned int u = 0 - 7;
+    char c = 300;
+    unsigned char uc = 0 - 1;
+    short s = 70000;
+    int k = 5;
+
+    r = r + (u / 3 == 1431655763) + u % 5 + (u > 10) + (0 - 7 < 10);
+    r = r + c + uc + s + (int)(char)(k * 60);
+    r = r + (0 && 1 / 0) + (1 || g++) + (k ? 4 : 9) + (k, 2) + (3, g);
+    r = r + (u >> 28) + ((0 - 16) >> 2) + (k << 3) + sizeof(short) * k;
+    r = r + ~k + -k + !k + !0;
+    return r & 255;
+}
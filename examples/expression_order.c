@@ -0,0 +1,22 @@
+int weights[4] = {2, 3, 5, 7};
+
+int products(int a, int b, int c, int d)
+{
+    return a * b + c * d;
+}
+
+int nested(int a, int b, int c, int d)
+{
+    return (a * b - c) * (d - (a - b) * c) - (b * c - a) / (d - c);
+}
+
+int main()
+{
+    int i = 1;
+    int total = products(2, 3, 4, 5);
+
+    total = total + nested(3, 5, 7, 11) % 50;
+    weights[i + 1] = weights[i] * weights[i + 2] - (weights[0] << i);
+    total = total + weights[2] + (i - total < weights[3] - i);
+    return total;
+}
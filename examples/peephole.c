@@ -0,0 +1,30 @@
+int clamp(int value, int limit)
+{
+    if (value > limit) {
+        return limit;
+    }
+    return value;
+}
+
+int count_down(int n)
+{
+    int steps = 0;
+
+    while (n > 0) {
+        n = n - 3;
+        steps = steps + 1;
+    }
+    return steps;
+}
+
+int main()
+{
+    int total = 0;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        total = total + clamp(i * 5, 12);
+    }
+    total = total + count_down(10);
+    return total;
+}
@@ -0,0 +1,27 @@
+int squares[8] = {0, 1, 4, 9, 16, 25, 36, 49};
+
+int lookup(int *table, int i)
+{
+    return table[i] + *(table + i + 1);
+}
+
+int gap(int i)
+{
+    return squares[i + 1] - squares[i - 1];
+}
+
+int main()
+{
+    int counts[8];
+    int i;
+    int total = 0;
+
+    for (i = 0; i < 8; i++) {
+        counts[i] = squares[i] - i;
+    }
+    counts[7] = counts[2] + squares[3];
+    for (i = 0; i < 7; i++) {
+        total = total + lookup(counts, i) + squares[counts[i] & 7];
+    }
+    return total + gap(2);
+}
@@ -1,54 +1,157 @@
 #ifndef DONKEY_DECL_H
 #define DONKEY_DECL_H
 
-void lex(FILE *infile, const char *source_path, struct token **tokens, int *token_count);
-void add_token(struct token **tokens, int *token_count, TokenType type, const char *value);
-void free_tokens(struct token *tokens, int token_count);
-
-struct ast_node* create_ast_node(ASTNodeType type, char *value, struct ast_node *left, struct ast_node *right);
-struct ast_node* create_ast_node_at(ASTNodeType type, char *value, struct ast_node *left, struct ast_node *right, SourceLocation location);
-void free_ast_node(struct ast_node *node);
-
-struct ast_node* parse_program(struct token *tokens, int *token_index, const char *source_path);
-struct ast_node* parse_function_list(struct token *tokens, int *token_index);
-struct ast_node* parse_external_declaration(struct token *tokens, int *token_index);
-struct ast_node* parse_function(struct token *tokens, int *token_index);
-struct ast_node* parse_global_declaration(struct token *tokens, int *token_index);
-struct ast_node* parse_param_list(struct token *tokens, int *token_index);
-struct ast_node* parse_block(struct token *tokens, int *token_index);
-struct ast_node* parse_statement_list(struct token *tokens, int *token_index);
-struct ast_node* parse_statement(struct token *tokens, int *token_index);
-struct ast_node* parse_declaration(struct token *tokens, int *token_index);
-struct ast_node* parse_if_statement(struct token *tokens, int *token_index);
-struct ast_node* parse_while_statement(struct token *tokens, int *token_index);
-struct ast_node* parse_for_statement(struct token *tokens, int *token_index);
-struct ast_node* parse_for_init(struct token *tokens, int *token_index);
-struct ast_node* parse_optional_exp(struct token *tokens, int *token_index);
-struct ast_node* parse_exp(struct token *tokens, int *token_index);
-struct ast_node* parse_comma(struct token *tokens, int *token_index);
-struct ast_node* parse_assignment(struct token *tokens, int *token_index);
-struct ast_node* parse_conditional(struct token *tokens, int *token_index);
-struct ast_node* parse_logical_or(struct token *tokens, int *token_index);
-struct ast_node* parse_logical_and(struct token *tokens, int *token_index);
-struct ast_node* parse_bitwise_or(struct token *tokens, int *token_index);
-struct ast_node* parse_bitwise_xor(struct token *tokens, int *token_index);
-struct ast_node* parse_bitwise_and(struct token *tokens, int *token_index);
-struct ast_node* parse_equality(struct token *tokens, int *token_index);
-struct ast_node* parse_relational(struct token *tokens, int *token_index);
-struct ast_node* parse_shift(struct token *tokens, int *token_index);
-struct ast_node* parse_additive(struct token *tokens, int *token_index);
-struct ast_node* parse_term(struct token *tokens, int *token_index);
-struct ast_node* parse_factor(struct token *tokens, int *token_index);
-struct ast_node* parse_arg_list(struct token *tokens, int *token_index);
-
-int semantic_analyze(struct ast_node *ast, const char *source_path);
-
-char* generate(struct ast_node *ast);
-void generate_function(struct ast_node *node, FILE *output);
-void generate_program(struct ast_node *node, FILE *output);
-void generate_statement(struct ast_node *node, FILE *output);
-void generate_exp(struct ast_node *node, FILE *output);
-int generate_call_args(struct ast_node *node, FILE *output);
-void write_assembly_to_file(const char *filename, struct ast_node *ast);
+int load_source_file(const char *path, struct source_file *source);
+void release_source_file(struct source_file *source);
+
+void lex(struct compilation *unit, const char *source, size_t length);
+void lex_declaration(struct compilation *unit, const char *source, size_t length, struct lex_cursor *position);
+void free_tokens(struct token *tokens);
+
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+struct arena_mark arena_mark(struct arena *arena);
+void arena_release(struct arena *arena, struct arena_mark mark);
+void arena_free(struct arena *arena);
+
+const char *intern_string(struct intern_table *table, const char *text, size_t length);
+void reset_intern_table(struct intern_table *table);
+void free_intern_table(struct intern_table *table);
+
+int symbol_map_get(const struct symbol_map *map, const char *name);
+void symbol_map_put(struct symbol_map *map, const char *name, int value);
+void symbol_map_remove(struct symbol_map *map, const char *name);
+void symbol_map_free(struct symbol_map *map);
+
+uint64_t cache_hash_bytes(uint64_t hash, const void *data, size_t length);
+uint64_t cache_hash_int(uint64_t hash, int value);
+uint64_t cache_hash_text(uint64_t hash, const char *text);
+int cache_prepare(const char *dir);
+void function_cache_open(struct function_cache *cache, const char *dir, const char *source_path);
+const char *function_cache_find(struct function_cache *cache, uint64_t key, size_t *length);
+void function_cache_add(struct function_cache *cache, uint64_t key, const char *text, size_t length, int reused);
+void function_cache_close(struct function_cache *cache, int save);
+
+void stats_phase_begin(struct compilation *unit);
+void stats_phase_end(struct compilation *unit, CompilePhase phase);
+void stats_time_report(struct emitter *out, const char *input, const struct compile_stats *stats);
+void stats_mem_report(struct emitter *out, const char *input, const struct compile_stats *stats);
+void stats_peephole_report(struct emitter *out, const char *input, const struct compile_stats *stats);
+int stats_write_json(const char *path, const char **inputs, const int *ok,
+    const struct compile_stats *stats, int count);
+
+void compilation_init(struct compilation *unit, const char *source_path);
+void compilation_release(struct compilation *unit);
+void compilation_reset(struct compilation *unit, const char *source_path);
+void compilation_diagnostic(struct compilation *unit, const char *format, ...);
+void compilation_vdiagnostic(struct compilation *unit, const char *format, va_list args);
+void compilation_fail(struct compilation *unit);
+int parse_codegen_option(struct compile_options *options, const char *argument);
+void format_codegen_options(struct emitter *out, const struct compile_options *options);
+
+int compile_unit(struct compilation *unit, const char *output_path);
+int compile_stream(struct compilation *unit, const char *output_path);
+int compile_parallel(struct compilation *unit, const char *output_path);
+int compile_batch(const char **inputs, int input_count, const char *output_dir, int jobs,
+    const struct compile_options *options);
+int serve(const char *socket_path);
+int compile_remote(const char *socket_path, const char *input, const char *output_file,
+    const struct compile_options *options);
+
+struct ast_node* create_ast_node(struct compilation *unit, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right);
+struct ast_node* create_ast_node_at(struct compilation *unit, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right, SourceLocation location);
+struct ast_node* arena_ast_node(struct arena *arena, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right, SourceLocation location);
+
+struct ast_node* parse_program(struct compilation *unit);
+struct ast_node* parse_function_list(struct parser *parser);
+struct ast_node* parse_external_declaration(struct parser *parser);
+struct ast_node* parse_top_level(struct compilation *unit, int signatures);
+struct ast_node* parse_function(struct parser *parser);
+struct ast_node* parse_function_signature(struct parser *parser);
+struct ast_node* parse_global_declaration(struct parser *parser);
+struct ast_node* parse_param_list(struct parser *parser);
+struct ast_node* parse_block(struct parser *parser);
+struct ast_node* parse_statement_list(struct parser *parser);
+struct ast_node* parse_statement(struct parser *parser);
+struct ast_node* parse_declaration(struct parser *parser);
+struct ast_node* parse_if_statement(struct parser *parser);
+struct ast_node* parse_while_statement(struct parser *parser);
+struct ast_node* parse_for_statement(struct parser *parser);
+struct ast_node* parse_for_init(struct parser *parser);
+struct ast_node* parse_optional_exp(struct parser *parser);
+struct ast_node* parse_exp(struct parser *parser);
+struct ast_node* parse_comma(struct parser *parser);
+struct ast_node* parse_assignment(struct parser *parser);
+struct ast_node* parse_conditional(struct parser *parser);
+struct ast_node* parse_binary(struct parser *parser, int min_precedence);
+struct ast_node* parse_factor(struct parser *parser);
+struct ast_node* parse_arg_list(struct parser *parser);
+
+int semantic_analyze(struct compilation *unit, struct ast_node *ast);
+struct semantic *semantic_create(struct compilation *unit);
+void semantic_declare(struct semantic *sema, struct ast_node *declaration);
+int semantic_check(struct semantic *sema, struct ast_node *declaration);
+int semantic_finish(struct semantic *sema);
+struct semantic *semantic_fork(struct semantic *sema, struct arena *arena);
+void semantic_check_into(struct semantic *fork, struct ast_node *declaration,
+    struct check_result *result);
+void semantic_merge(struct semantic *sema, struct check_result *result);
+void semantic_destroy(struct semantic *sema);
+
+void emitter_init(struct emitter *out, FILE *file);
+void emitter_flush(struct emitter *out);
+void emitter_release(struct emitter *out);
+char *emitter_take(struct emitter *out);
+const char *emitter_text(struct emitter *out);
+void emitter_append(struct emitter *out, const struct emitter *text);
+void emitter_record(struct emitter *out);
+void emitter_reset(struct emitter *out);
+void emit_bytes(struct emitter *out, const char *text, size_t length);
+void emit_text(struct emitter *out, const char *text);
+void emit_vformat(struct emitter *out, const char *format, va_list args);
+void emit_format(struct emitter *out, const char *format, ...);
+void emit_int(struct emitter *out, int value);
+void emit_insn0(struct emitter *out, const char *mnemonic);
+void emit_insn1(struct emitter *out, const char *mnemonic, struct operand operand);
+void emit_insn2(struct emitter *out, const char *mnemonic, struct operand source,
+    struct operand destination);
+void emit_label(struct emitter *out, const char *function, int label);
+void emit_global_symbol(struct emitter *out, const char *name);
+void emit_long(struct emitter *out, int value);
+struct operand operand_register(const char *name);
+struct operand operand_immediate(int value);
+struct operand operand_immediate_text(const char *text);
+struct operand operand_frame(int offset);
+struct operand operand_indirect(const char *name);
+struct operand operand_symbol(const char *name);
+struct operand operand_symbol_address(const char *name);
+struct operand operand_memory(const char *symbol, int displacement, const char *base,
+    const char *index, int scale);
+struct operand operand_label(const char *function, int label);
+
+void fold_function(struct ast_node *function, struct arena *arena);
+int evaluate_constant(struct ast_node *node, int *value);
+int type_size(const char *type);
+int cast_constant(int value, const char *type);
+
+void peephole_optimize(struct emitter *function, int rules_off, int *hits);
+int peephole_rule_index(const char *name);
+const char *peephole_rule_name(int rule);
+
+int allocate_registers(struct ast_node *function);
+const char *register_name(int reg);
+
+char* generate(struct compilation *unit, struct ast_node *ast);
+int generate_program(struct compilation *unit, struct ast_node *node, struct emitter *output);
+struct codegen *codegen_create(struct compilation *unit, struct emitter *output);
+void codegen_add_global(struct codegen *gen, struct ast_node *declaration);
+void codegen_emit_globals(struct codegen *gen);
+void codegen_emit_function(struct codegen *gen, struct ast_node *function);
+struct codegen *codegen_fork(struct codegen *gen);
+void codegen_function_into(struct codegen *fork, struct ast_node *function,
+    struct function_result *result);
+void codegen_merge(struct codegen *gen, struct function_result *result);
+int codegen_destroy(struct codegen *gen, int keep);
+int write_assembly_to_file(struct compilation *unit, const char *filename, struct ast_node *ast);
 
 #endif
@@ -1,6 +1,9 @@
 #ifndef DONKEY_DEFS_H
 #define DONKEY_DEFS_H
 
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 
 typedef enum {
@@ -143,6 +146,39 @@ typedef struct {
     int column;
 } SourceLocation;
 
+typedef enum {
+    SYMBOL_LOCAL,
+    SYMBOL_GLOBAL,
+    SYMBOL_FUNCTION
+} SymbolKind;
+
+/*
+ * What a name refers to. Semantic analysis creates one record per
+ * declaration and points every use at it, so code generation never looks a
+ * name up. Locals and parameters live at offset from %ebp; a function's
+ * frame_size is the bytes its locals need. Under -O the code generator may
+ * keep a local in a register instead: reg is its number for register_name(),
+ * or 0 while it lives in its slot.
+ */
+#define ALLOCATABLE_REGISTERS 3
+
+struct symbol {
+    SymbolKind kind;
+    const char *name;
+    CType type;
+    int pointer_depth;
+    int array_length;
+    int offset;
+    int frame_size;
+    int reg;
+};
+
+/*
+ * List nodes (the *_LIST types) keep their elements in source order in
+ * children; every other node uses left and right. Identifiers, calls,
+ * declarations, parameters and functions carry their symbol once checked.
+ * label is scratch space for the code generator's expression labelling.
+ */
 struct ast_node {
     ASTNodeType type;
     CType data_type;
@@ -151,13 +187,246 @@ struct ast_node {
     SourceLocation location;
     struct ast_node *left;
     struct ast_node *right;
-    char *value;
+    const char *value;
+    struct ast_node **children;
+    int child_count;
+    int label;
+    struct symbol *symbol;
+};
+
+struct arena_block;
+
+struct arena {
+    struct arena_block *blocks;
+    size_t allocation_count;
+    size_t allocated_bytes;
+    int block_count;
+};
+
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+struct intern_entry;
+
+struct intern_table {
+    struct intern_entry *entries;
+    size_t capacity;
+    size_t count;
+    struct arena arena;
+};
+
+struct symbol_map {
+    const char **keys;
+    int *values;
+    size_t capacity;
+    size_t count;
+};
+
+struct source_file {
+    char *data;
+    size_t length;
+    int mapped;
 };
 
 struct token {
     TokenType type;
     SourceLocation location;
-    char *value;
+    int offset;
+    int length;
+    const char *value;
+};
+
+/* Where the next lex_declaration() call resumes in the source. */
+struct lex_cursor {
+    size_t offset;
+    size_t line_start;
+    int line;
+};
+
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_IMMEDIATE,
+    OPERAND_IMMEDIATE_TEXT,
+    OPERAND_FRAME,
+    OPERAND_INDIRECT,
+    OPERAND_SYMBOL,
+    OPERAND_SYMBOL_ADDRESS,
+    OPERAND_MEMORY,
+    OPERAND_LABEL
+} OperandKind;
+
+/* Memory operands also use base, index and scale; text is their symbol. */
+struct operand {
+    OperandKind kind;
+    int value;
+    const char *text;
+    const char *base;
+    const char *index;
+    int scale;
+};
+
+typedef enum {
+    INSN_INSTRUCTION,
+    INSN_LABEL,
+    INSN_GLOBAL,
+    INSN_DELETED
+} InsnKind;
+
+/*
+ * One line of a function's assembly, kept as a record so the peephole pass
+ * can match operands instead of text. A label keeps its operand_label() in
+ * operands[0]; a global symbol keeps its name in mnemonic.
+ */
+struct insn {
+    InsnKind kind;
+    const char *mnemonic;
+    int operand_count;
+    struct operand operands[2];
+};
+
+/*
+ * An emitter set to record by emitter_record() keeps instructions, labels
+ * and global symbols as struct insn records rather than text; appending it
+ * to another emitter replays them.
+ */
+struct emitter {
+    char *data;
+    size_t length;
+    size_t capacity;
+    size_t flushed;
+    FILE *file;
+    struct insn *insns;
+    int insn_count;
+    int insn_capacity;
+    int recording;
+};
+
+struct cache_entry;
+
+struct function_cache {
+    char *path;
+    char *data;
+    size_t length;
+    struct cache_entry *entries;
+    size_t capacity;
+    size_t count;
+    size_t used;
+    struct emitter pack;
+    int dirty;
+};
+
+/*
+ * Rules of the peephole pass, which runs on every function unless switched
+ * off. peephole_off holds the rules switched off as (1 << rule), so a rule
+ * can be bisected on its own; PEEPHOLE_ALL switches the pass off entirely.
+ */
+typedef enum {
+    PEEPHOLE_PUSH_POP,
+    PEEPHOLE_JUMP_TO_NEXT,
+    PEEPHOLE_UNREACHABLE,
+    PEEPHOLE_SELF_MOVE,
+    PEEPHOLE_MOVE_BACK,
+    PEEPHOLE_DEAD_MOVE,
+    PEEPHOLE_ZERO_REGISTER,
+    PEEPHOLE_RULE_COUNT
+} PeepholeRule;
+
+#define PEEPHOLE_ALL ((1 << PEEPHOLE_RULE_COUNT) - 1)
+
+/* Settings shared by every unit of one compiler invocation. */
+struct compile_options {
+    const char *cache_dir;
+    const char *stats_json;
+    int time_report;
+    int mem_report;
+    int stream;
+    int function_jobs;
+    int optimize;
+    int peephole_off;
+    int peephole_report;
+};
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_SEMANTIC_COLLECT,
+    PHASE_SEMANTIC_CHECK,
+    PHASE_CODEGEN,
+    PHASE_COUNT
+} CompilePhase;
+
+struct phase_stats {
+    double seconds;
+    size_t allocations;
+    size_t arena_bytes;
+    long peak_rss_kb;
+    int ran;
+};
+
+struct compile_stats {
+    struct phase_stats phases[PHASE_COUNT];
+    double phase_start;
+    size_t allocations_start;
+    size_t bytes_start;
+    int token_count;
+    size_t ast_nodes;
+    int conversion_casts;
+    size_t bytes_emitted;
+    int peephole_hits[PEEPHOLE_RULE_COUNT];
+};
+
+/*
+ * Everything one translation unit owns while it is being compiled. Units do
+ * not share state, so several can be compiled at once on different threads.
+ * Diagnostics are collected in the unit rather than printed, and fatal lex
+ * or parse errors unwind to whoever set up `fatal`: compile_unit() for the
+ * command line, donkey_compile() for the library.
+ */
+struct compilation {
+    const char *source_path;
+    struct compile_options options;
+    struct source_file source;
+    struct token *tokens;
+    int token_count;
+    int token_capacity;
+    struct ast_node **list_items;
+    int list_item_count;
+    int list_item_capacity;
+    struct ast_node *ast;
+    struct arena ast_arena;
+    struct intern_table strings;
+    struct emitter diagnostics;
+    struct compile_stats stats;
+    jmp_buf fatal;
+};
+
+struct semantic;
+struct codegen;
+
+/* What checking one declaration on a semantic_fork() reported. */
+struct check_result {
+    struct emitter errors;
+    struct emitter type_errors;
+    int error_count;
+    int type_error_count;
+};
+
+/* One function emitted on a codegen_fork(), waiting for codegen_merge(). */
+struct function_result {
+    struct emitter output;
+    struct emitter errors;
+    int error_count;
+    uint64_t key;
+    int reused;
+    int peephole_hits[PEEPHOLE_RULE_COUNT];
+};
+
+struct parser {
+    struct compilation *unit;
+    struct token *tokens;
+    int index;
 };
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef DONKEY_H
+#define DONKEY_H
+
+#include <stddef.h>
+
+/*
+ * In-process compiler interface, built as build/libdonkey.a and
+ * build/libdonkey.so. A context compiles one source buffer at a time and
+ * keeps its token buffer, string table, AST arena and output buffers between
+ * calls. Contexts share no state, so each thread can use its own. Compile
+ * errors are returned as a status; only running out of memory still ends
+ * the process, as it does in the command-line compiler.
+ */
+
+typedef enum {
+    DONKEY_OK = 0,
+    DONKEY_ERROR_ARGUMENT,
+    DONKEY_ERROR_SYNTAX,
+    DONKEY_ERROR_SEMANTIC,
+    DONKEY_ERROR_CODEGEN
+} donkey_status;
+
+struct donkey_context;
+
+/*
+ * Settings that change the generated code; all zero matches a plain
+ * command-line compile. peephole_off holds the peephole rules switched off,
+ * as (1 << donkey_peephole_rule(name)) each, or -1 for -fno-peephole.
+ */
+struct donkey_options {
+    int optimize;
+    int peephole_off;
+};
+
+/* Returns NULL if the context cannot be allocated. */
+struct donkey_context *donkey_create(void);
+void donkey_destroy(struct donkey_context *context);
+
+/*
+ * Compiles `length` bytes of `source`; `name` is only used in diagnostics.
+ * On DONKEY_OK, *assembly points at NUL-terminated assembly text owned by
+ * the context and valid until the next call. Either output may be NULL.
+ */
+donkey_status donkey_compile(struct donkey_context *context, const char *name, const char *source,
+    size_t length, const char **assembly, size_t *assembly_length);
+
+/* donkey_compile() as with -O or -fno-peephole; options may be NULL for the defaults. */
+donkey_status donkey_compile_with_options(struct donkey_context *context, const char *name,
+    const char *source, size_t length, const struct donkey_options *options, const char **assembly,
+    size_t *assembly_length);
+
+/* The number of the peephole rule -fno-peephole=name would switch off, or -1. */
+int donkey_peephole_rule(const char *name);
+
+/* Diagnostics from the last donkey_compile() call, or "" if there were none. */
+const char *donkey_diagnostics(struct donkey_context *context);
+
+const char *donkey_status_string(donkey_status status);
+
+#endif
@@ -0,0 +1,130 @@
+#!/usr/bin/env sh
+set -eu
+
+# Compile-throughput benchmark. For each axis of bench/gen.c, compiles
+# programs at four doubling sizes, fits the growth exponent of compile time
+# and of peak memory (the slope of log(cost) against log(size)), and compares
+# it with bench/baseline.txt. An exponent above 1.2 is flagged as
+# super-linear, and one more than 0.2 above its baseline as a regression.
+#
+# Usage: scripts/bench.sh [--update-baseline]
+
+cc="${CC:-gcc}"
+build_dir="${BUILD_DIR:-build}"
+compiler="${build_dir}/donkey"
+generator="${build_dir}/bench_gen"
+work_dir="${build_dir}/bench"
+baseline="bench/baseline.txt"
+runs="${BENCH_RUNS:-3}"
+update=0
+
+if [ "${1:-}" = "--update-baseline" ]; then
+    update=1
+fi
+
+mkdir -p "$work_dir"
+"$cc" -O2 -Wall -Wextra -o "$generator" bench/gen.c
+
+# Best total compile seconds and highest peak RSS (KiB) over $runs runs.
+measure() {
+    source="$1"
+    best_seconds=""
+    peak_kb=0
+    run=0
+    while [ "$run" -lt "$runs" ]; do
+        "$compiler" --stats-json "$work_dir/stats.json" "$source" "$work_dir/out.asm" >/dev/null
+        seconds=$(sed -n 's/.*"seconds": \([0-9.]*\), "phases".*/\1/p' "$work_dir/stats.json")
+        kb=$(grep -o '"peak_rss_kb": [0-9]*' "$work_dir/stats.json" | awk '{ if ($2 > max) max = $2 } END { print max + 0 }')
+        best_seconds=$(awk -v a="$best_seconds" -v b="$seconds" 'BEGIN { print (a == "" || b < a) ? b : a }')
+        if [ "$kb" -gt "$peak_kb" ]; then
+            peak_kb="$kb"
+        fi
+        run=$((run + 1))
+    done
+    echo "$best_seconds $peak_kb"
+}
+
+"$generator" >"$work_dir/empty.c"
+empty_kb=$(measure "$work_dir/empty.c" | awk '{ print $2 }')
+
+# axis option sizes... -- fixed options for the other axes
+axes="
+functions --functions 1000 2000 4000 8000 -- --locals 4 --statements 4 --depth 3 --globals 16 --nesting 2
+globals --globals 4000 8000 16000 32000 -- --functions 200 --locals 4 --statements 4 --depth 3
+locals --locals 100 200 400 800 -- --functions 50 --statements 4 --depth 3 --globals 16
+depth --depth 50 100 200 400 -- --functions 50 --locals 8 --statements 4 --globals 16
+statements --statements 100 200 400 800 -- --functions 50 --locals 8 --depth 3 --globals 16
+nesting --nesting 100 200 400 800 -- --functions 50 --locals 4 --statements 2 --depth 2
+initializer --initializer 20000 40000 80000 160000 -- --functions 4
+"
+
+results="$work_dir/results.txt"
+: >"$results"
+printf "%-12s %10s %12s %12s\n" "axis" "size" "seconds" "memory KiB"
+echo "$axes" | while read -r axis option sizes; do
+    [ -n "$axis" ] || continue
+    fixed="${sizes#*-- }"
+    sizes="${sizes%% --*}"
+    for size in $sizes; do
+        # shellcheck disable=SC2086
+        "$generator" $fixed "$option" "$size" >"$work_dir/$axis.c"
+        set -- $(measure "$work_dir/$axis.c")
+        memory=$(( $2 > empty_kb ? $2 - empty_kb : 1 ))
+        printf "%-12s %10d %12.6f %12d\n" "$axis" "$size" "$1" "$memory"
+        echo "$axis $size $1 $memory" >>"$results"
+    done
+done
+
+echo
+awk -v baseline_file="$baseline" -v update="$update" '
+    BEGIN {
+        while ((getline line < baseline_file) > 0) {
+            if (line ~ /^#/ || split(line, field, " ") < 3) continue
+            base_time[field[1]] = field[2]
+            base_memory[field[1]] = field[3]
+        }
+    }
+    function slope(axis, column,    n, sx, sy, sxx, sxy, x, y, i) {
+        n = count[axis]
+        for (i = 1; i <= n; i++) {
+            x = log(size[axis, i])
+            y = log(value[axis, i, column] > 0 ? value[axis, i, column] : 1e-9)
+            sx += x; sy += y; sxx += x * x; sxy += x * y
+        }
+        return (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }
+    function verdict(measured, expected) {
+        if (measured > 1.2) return "SUPER-LINEAR"
+        if (expected != "" && measured > expected + 0.2) return "REGRESSED"
+        return "ok"
+    }
+    {
+        if (!($1 in count)) order[++axes] = $1
+        count[$1]++
+        size[$1, count[$1]] = $2
+        value[$1, count[$1], 1] = $3
+        value[$1, count[$1], 2] = $4
+    }
+    END {
+        printf("%-12s %10s %10s %8s   %10s %10s %8s\n", "axis", "time exp", "baseline", "", "mem exp", "baseline", "")
+        for (i = 1; i <= axes; i++) {
+            axis = order[i]
+            t = slope(axis, 1)
+            m = slope(axis, 2)
+            tv = verdict(t, base_time[axis])
+            mv = verdict(m, base_memory[axis])
+            printf("%-12s %10.2f %10s %8s   %10.2f %10s %8s\n", axis, t, base_time[axis], tv, m, base_memory[axis], mv)
+            if (tv != "ok" || mv != "ok") flagged++
+            updated = updated sprintf("%s %.2f %.2f\n", axis, t, m)
+        }
+        if (update) {
+            printf("# axis time_exponent memory_exponent\n%s", updated) > baseline_file
+            print "\nBaseline written to " baseline_file
+            exit 0
+        }
+        if (flagged) {
+            printf("\n%d axis(es) flagged\n", flagged)
+            exit 1
+        }
+    }
+' "$results"
@@ -9,7 +9,7 @@ rm -rf "$build_dir"
 mkdir -p "$build_dir"
 
 "$cc" -Iinclude -Wall -Wextra -g -o "$compiler" \
-    src/main.c src/lexer.c src/parser.c src/semantic.c src/codegen.c
+    src/main.c src/driver.c src/stream.c src/parallel.c src/server.c src/library.c src/compilation.c src/stats.c src/cache.c src/arena.c src/source.c src/lexer.c src/intern.c src/symtab.c src/parser.c src/semantic.c src/fold.c src/regalloc.c src/codegen.c src/peephole.c src/emit.c -pthread
 
 "$compiler" examples/sample.c "$build_dir/sample.asm"
 "$compiler" examples/unary.c "$build_dir/unary.asm"
@@ -27,8 +27,197 @@ mkdir -p "$build_dir"
 "$compiler" examples/pointers_arrays.c "$build_dir/pointers_arrays.asm"
 "$compiler" examples/pointer_arithmetic.c "$build_dir/pointer_arithmetic.asm"
 "$compiler" examples/global_arrays.c "$build_dir/global_arrays.asm"
+"$compiler" examples/expression_order.c "$build_dir/expression_order.asm"
+"$compiler" examples/constant_folding.c "$build_dir/constant_folding.asm"
+"$compiler" examples/table_lookup.c "$build_dir/table_lookup.asm"
+"$compiler" examples/peephole.c "$build_dir/peephole.asm"
+"$compiler" -fno-peephole examples/peephole.c "$build_dir/peephole_off.asm"
 "$compiler" tests/semantic/valid_forward_call.c "$build_dir/valid_forward_call.asm"
 
+# More symbols than the old fixed-size tables could hold.
+awk 'BEGIN {
+    for (i = 0; i < 300; i++) printf("int g%d = %d;\n", i, i % 7);
+    printf("int main() {\n");
+    for (i = 0; i < 300; i++) printf("    int l%d = g%d;\n", i, i);
+    printf("    return l299 + g298;\n}\n");
+}' >"$build_dir/many_symbols.c"
+"$compiler" "$build_dir/many_symbols.c" "$build_dir/many_symbols.asm"
+
+# Lists long enough to overflow the stack if any pass recursed once per element.
+awk 'BEGIN {
+    printf("int table[100000] = {");
+    for (i = 0; i < 100000; i++) printf("%d, ", i % 7);
+    printf("};\nint main() {\n    int x = 0;\n");
+    for (i = 0; i < 100000; i++) printf("    x = x + table[%d];\n", i % 100);
+    printf("    return x;\n}\n");
+}' >"$build_dir/long_lists.c"
+"$compiler" "$build_dir/long_lists.c" "$build_dir/long_lists.asm"
+
+# Cached builds must match uncached ones, before and after one function changes.
+cp examples/multiple_functions.c "$build_dir/cached.c"
+"$compiler" --cache "$build_dir/cache" "$build_dir/cached.c" "$build_dir/cached_cold.asm"
+"$compiler" --cache "$build_dir/cache" "$build_dir/cached.c" "$build_dir/cached_warm.asm"
+cp "$build_dir"/cache/*.pack "$build_dir/cached_warm.pack"
+sed 's/return 99;/return 98;/' examples/multiple_functions.c >"$build_dir/cached.c"
+"$compiler" --cache "$build_dir/cache" "$build_dir/cached.c" "$build_dir/cached_edit.asm"
+"$compiler" "$build_dir/cached.c" "$build_dir/uncached_edit.asm"
+if ! cmp -s "$build_dir/multiple_functions.asm" "$build_dir/cached_cold.asm" ||
+    ! cmp -s "$build_dir/multiple_functions.asm" "$build_dir/cached_warm.asm" ||
+    ! cmp -s "$build_dir/uncached_edit.asm" "$build_dir/cached_edit.asm"; then
+    echo "Cached output differs from uncached output" >&2
+    exit 1
+fi
+# The edit must replace the pack, after which a rerun reuses every function and
+# leaves it alone; reused functions still count their peephole rewrites.
+cp "$build_dir"/cache/*.pack "$build_dir/cached_edit.pack"
+if cmp -s "$build_dir/cached_warm.pack" "$build_dir/cached_edit.pack"; then
+    echo "Compiling an edited function did not replace the cache pack" >&2
+    exit 1
+fi
+"$compiler" -fpeephole-report --cache "$build_dir/cache" "$build_dir/cached.c" "$build_dir/cached_rewarm.asm" \
+    2>"$build_dir/cached_rewarm.txt"
+"$compiler" -fpeephole-report "$build_dir/cached.c" "$build_dir/uncached_rewarm.asm" 2>"$build_dir/uncached_rewarm.txt"
+if ! cmp -s "$build_dir/uncached_edit.asm" "$build_dir/cached_rewarm.asm" ||
+    ! cmp -s "$build_dir/cached_edit.pack" "$build_dir"/cache/*.pack; then
+    echo "Recompiling after an edit missed the rewritten cache pack" >&2
+    exit 1
+fi
+if ! cmp -s "$build_dir/uncached_rewarm.txt" "$build_dir/cached_rewarm.txt"; then
+    echo "Peephole report for cached functions differs from an uncached compile" >&2
+    exit 1
+fi
+
+# Streaming compiles must match whole-file ones and still reject bad input.
+"$compiler" --stream examples/globals.c "$build_dir/stream_globals.asm"
+"$compiler" --stream examples/types.c "$build_dir/stream_types.asm"
+"$compiler" --stream examples/multiple_functions.c "$build_dir/stream_multiple_functions.asm"
+"$compiler" --stream tests/semantic/valid_forward_call.c "$build_dir/stream_valid_forward_call.asm"
+"$compiler" --stream "$build_dir/long_lists.c" "$build_dir/stream_long_lists.asm"
+for name in globals types multiple_functions valid_forward_call long_lists; do
+    if ! cmp -s "$build_dir/$name.asm" "$build_dir/stream_$name.asm"; then
+        echo "Streaming output for $name differs from whole-file output" >&2
+        exit 1
+    fi
+done
+if "$compiler" --stream tests/semantic/undeclared_variable.c "$build_dir/stream_invalid.asm" 2>/dev/null; then
+    echo "Streaming compile accepted an invalid program" >&2
+    exit 1
+fi
+
+# Function-parallel compiles must match serial ones, diagnostics included.
+for name in globals types multiple_functions long_lists; do
+    case "$name" in
+        long_lists) source="$build_dir/long_lists.c" ;;
+        *) source="examples/$name.c" ;;
+    esac
+    "$compiler" --function-jobs 4 "$source" "$build_dir/parallel_$name.asm"
+    if ! cmp -s "$build_dir/$name.asm" "$build_dir/parallel_$name.asm"; then
+        echo "Function-parallel output for $name differs from serial output" >&2
+        exit 1
+    fi
+done
+for name in invalid_pointer_assignment wrong_argument_count; do
+    "$compiler" "tests/semantic/$name.c" "$build_dir/serial_invalid.asm" 2>"$build_dir/serial_errors.txt" || true
+    if "$compiler" --function-jobs 4 "tests/semantic/$name.c" "$build_dir/parallel_invalid.asm" \
+        2>"$build_dir/parallel_errors.txt" ||
+        ! cmp -s "$build_dir/serial_errors.txt" "$build_dir/parallel_errors.txt"; then
+        echo "Function-parallel diagnostics for $name differ from serial ones" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$build_dir/batch"
+"$compiler" -j 3 -o "$build_dir/batch" examples/sample.c examples/locals.c examples/globals.c examples/types.c
+for name in sample locals globals types; do
+    if ! cmp -s "$build_dir/$name.asm" "$build_dir/batch/$name.asm"; then
+        echo "Batch output for $name differs from single-file output" >&2
+        exit 1
+    fi
+done
+# Two inputs with the same basename would race to write one output file.
+mkdir -p "$build_dir/collide"
+cp examples/sample.c "$build_dir/collide/sample.c"
+if "$compiler" -j 2 -o "$build_dir/collide" examples/sample.c "$build_dir/collide/sample.c" \
+    >"$build_dir/collide.out" 2>"$build_dir/collide.txt" ||
+    ! grep -F "Inputs examples/sample.c and $build_dir/collide/sample.c would both be written to $build_dir/collide/sample.asm" \
+        "$build_dir/collide.txt" >/dev/null ||
+    [ -e "$build_dir/collide/sample.asm" ]; then
+    echo "Batch compile did not reject inputs sharing an output file" >&2
+    cat "$build_dir/collide.txt" >&2
+    exit 1
+fi
+# Each failed write names its own output file.
+if "$compiler" -j 2 -o "$build_dir/missing" examples/sample.c examples/locals.c \
+    >"$build_dir/missing.out" 2>"$build_dir/missing.txt" ||
+    ! grep -F "Failed to open $build_dir/missing/sample.asm for writing" "$build_dir/missing.txt" >/dev/null ||
+    ! grep -F "Failed to open $build_dir/missing/locals.asm for writing" "$build_dir/missing.txt" >/dev/null; then
+    echo "Batch write failures do not name their output files" >&2
+    cat "$build_dir/missing.txt" >&2
+    exit 1
+fi
+
+# The library must match the command-line compiler and survive failed compiles.
+"$cc" -Iinclude -Wall -Wextra -g -o "$build_dir/library_test" tests/library/library_test.c \
+    src/library.c src/compilation.c src/stats.c src/cache.c src/arena.c src/source.c src/lexer.c src/intern.c src/symtab.c src/parser.c src/semantic.c src/fold.c src/regalloc.c src/codegen.c src/peephole.c src/emit.c
+"$compiler" -O -fno-peephole=dead-move examples/types.c "$build_dir/types_O_no_dead_move.asm"
+"$build_dir/library_test" examples/sample.c "$build_dir/sample.asm"
+"$build_dir/library_test" examples/types.c "$build_dir/types.asm" "$build_dir/types_O_no_dead_move.asm"
+
+# Compile server round trip; Unix domain sockets are not available on the Windows CI.
+case "$(uname -s)" in
+    MINGW* | MSYS* | CYGWIN*) ;;
+    *)
+        socket="$build_dir/donkey.sock"
+        "$compiler" --serve "$socket" >"$build_dir/server.log" &
+        server_pid=$!
+        tries=0
+        while [ ! -S "$socket" ] && [ "$tries" -lt 50 ]; do
+            sleep 0.1
+            tries=$((tries + 1))
+        done
+        "$compiler" --client "$socket" examples/sample.c "$build_dir/client_sample.asm"
+        "$compiler" --client "$socket" examples/types.c "$build_dir/client_types.asm"
+        "$compiler" -O -fno-peephole=dead-move --client "$socket" examples/types.c "$build_dir/client_types_O.asm"
+        if "$compiler" -fpeephole-report --client "$socket" examples/types.c "$build_dir/client_report.asm" \
+            2>"$build_dir/client-option.txt" ||
+            ! grep -F "Option -fpeephole-report cannot be used with --client" "$build_dir/client-option.txt" >/dev/null; then
+            echo "Expected --client to reject -fpeephole-report" >&2
+            kill "$server_pid"
+            exit 1
+        fi
+        if "$compiler" --client "$socket" tests/syntax/missing_semicolon.c "$build_dir/invalid.asm" 2>"$build_dir/client-errors.txt" ||
+            ! grep -F "expected ';', found '}'" "$build_dir/client-errors.txt" >/dev/null; then
+            echo "Expected the compile server to reject tests/syntax/missing_semicolon.c" >&2
+            kill "$server_pid"
+            exit 1
+        fi
+        kill "$server_pid"
+        wait "$server_pid" || true
+        if ! cmp -s "$build_dir/sample.asm" "$build_dir/client_sample.asm" ||
+            ! cmp -s "$build_dir/types.asm" "$build_dir/client_types.asm" ||
+            ! cmp -s "$build_dir/types_O_no_dead_move.asm" "$build_dir/client_types_O.asm"; then
+            echo "Compile server output differs from single-file output" >&2
+            exit 1
+        fi
+        ;;
+esac
+
+# Phase reports go to stderr with the diagnostics; JSON goes to its own file.
+"$compiler" -ftime-report -fmem-report --stats-json "$build_dir/stats.json" examples/types.c "$build_dir/stats.asm" 2>"$build_dir/stats.txt"
+for expected in "Time report for examples/types.c:" "semantic check" "Memory report for examples/types.c:" "arena allocs" "conversion casts"; do
+    if ! grep -F "$expected" "$build_dir/stats.txt" >/dev/null; then
+        echo "Expected '$expected' in the phase reports" >&2
+        cat "$build_dir/stats.txt" >&2
+        exit 1
+    fi
+done
+if ! grep -F '"file": "examples/types.c", "ok": true' "$build_dir/stats.json" >/dev/null ||
+    ! grep -F '"codegen": {"seconds": ' "$build_dir/stats.json" >/dev/null; then
+    echo "Unexpected --stats-json output" >&2
+    cat "$build_dir/stats.json" >&2
+    exit 1
+fi
+
 expect_semantic_error() {
     input="$1"
     expected="$2"
@@ -63,6 +252,9 @@ expect_compile_error() {
 
 expect_compile_error tests/syntax/missing_semicolon.c "Parse error at tests/syntax/missing_semicolon.c:4:1: expected ';', found '}'"
 expect_compile_error tests/syntax/invalid_character.c "Lex error at tests/syntax/invalid_character.c:3:12: invalid character '@'"
+# Unprintable characters are escaped so they cannot cut the diagnostic short.
+printf 'int main() { return 0; }\0\n' >"$build_dir/nul_character.c"
+expect_compile_error "$build_dir/nul_character.c" "Lex error at $build_dir/nul_character.c:1:25: invalid character '\\x00'"
 expect_semantic_error tests/semantic/undeclared_variable.c "Semantic error at tests/semantic/undeclared_variable.c:3:12 in function 'main': use of undeclared variable 'missing'"
 expect_semantic_error tests/semantic/wrong_argument_count.c "expects 2 argument(s), but 1 provided"
 expect_semantic_error tests/semantic/duplicate_declaration.c "duplicate declaration of 'value'"
@@ -73,6 +265,8 @@ expect_semantic_error tests/semantic/invalid_pointer_assignment.c "cannot assign
 expect_semantic_error tests/semantic/invalid_dereference.c "cannot dereference non-pointer expression"
 expect_semantic_error tests/semantic/invalid_pointer_addition.c "invalid operands to pointer arithmetic"
 expect_semantic_error tests/semantic/too_many_array_initializers.c "too many initializers for array 'values'"
+expect_semantic_error tests/semantic/global_division_by_zero.c "Semantic error at tests/semantic/global_division_by_zero.c:1:13: initializer for global 'ratio' divides by zero or overflows"
+expect_semantic_error tests/semantic/global_division_by_zero.c "initializer for global 'table' divides by zero or overflows"
 
 awk '
     NR == FNR {
@@ -112,6 +306,59 @@ awk '
 "$cc" -x assembler "$build_dir/pointer_arithmetic.asm" -o "$build_dir/pointer_arithmetic.exe"
 "$cc" -x assembler "$build_dir/global_arrays.asm" -o "$build_dir/global_arrays.exe"
 "$cc" -x assembler "$build_dir/valid_forward_call.asm" -o "$build_dir/valid_forward_call.exe"
+"$cc" -x assembler "$build_dir/many_symbols.asm" -o "$build_dir/many_symbols.exe"
+"$cc" -x assembler "$build_dir/expression_order.asm" -o "$build_dir/expression_order.exe"
+"$cc" -x assembler "$build_dir/constant_folding.asm" -o "$build_dir/constant_folding.exe"
+"$cc" -x assembler "$build_dir/table_lookup.asm" -o "$build_dir/table_lookup.exe"
+"$cc" -x assembler "$build_dir/peephole.asm" -o "$build_dir/peephole.exe"
+"$cc" -x assembler "$build_dir/peephole_off.asm" -o "$build_dir/peephole_off.exe"
+
+# Expressions that fit in the scratch registers must not spill to the stack.
+if awk '/^_products:/ { inside = 1 } /^\.globl/ { inside = 0 } inside' "$build_dir/expression_order.asm" |
+    grep -E 'push +%eax|pop ' >/dev/null; then
+    echo "a*b + c*d spilled a temporary to the stack" >&2
+    exit 1
+fi
+
+# Arithmetic on constants and constant locals is done at compile time.
+if grep -E 'imull|divl|sall|sarl|shrl|sete|setl|setb|seta' "$build_dir/constant_folding.asm" >/dev/null; then
+    echo "constant_folding.c still computes constants at run time" >&2
+    exit 1
+fi
+
+# Subscripts scale their index in the addressing mode rather than multiplying.
+if grep -E 'imull' "$build_dir/table_lookup.asm" >/dev/null; then
+    echo "table_lookup.c scales an index with imull" >&2
+    exit 1
+fi
+# The constant term of an index like i + 1 joins the displacement.
+if ! grep -F '_squares+4(,%eax,4)' "$build_dir/table_lookup.asm" >/dev/null ||
+    ! grep -F '_squares-4(,%eax,4)' "$build_dir/table_lookup.asm" >/dev/null; then
+    echo "table_lookup.c adds an index's constant term at run time" >&2
+    exit 1
+fi
+
+# The peephole pass leaves no code after a jmp, nor a jmp to the label right after it.
+if awk 'target != "" && ($0 !~ /:$/ || $0 == target ":") { found = 1 } { target = ($1 == "jmp") ? $2 : "" }
+    END { exit !found }' "$build_dir/peephole.asm"; then
+    echo "peephole.c still has dead code or a jump to the next label" >&2
+    exit 1
+fi
+if [ "$(wc -l <"$build_dir/peephole.asm")" -ge "$(wc -l <"$build_dir/peephole_off.asm")" ]; then
+    echo "The peephole pass did not shorten peephole.c" >&2
+    exit 1
+fi
+
+# -O keeps variables and temporaries in registers; the programs must not change.
+for name in locals control_flow missing_ops types pointers_arrays multiple_functions expression_order table_lookup peephole; do
+    "$compiler" -O "examples/$name.c" "$build_dir/${name}_O.asm"
+    "$cc" -x assembler "$build_dir/${name}_O.asm" -o "$build_dir/${name}_O.exe"
+done
+"$compiler" -O --function-jobs 3 examples/types.c "$build_dir/types_O_parallel.asm"
+if ! cmp -s "$build_dir/types_O.asm" "$build_dir/types_O_parallel.asm"; then
+    echo "Function-parallel -O output differs from serial -O output" >&2
+    exit 1
+fi
 
 run_and_expect() {
     exe="$1"
@@ -145,5 +392,27 @@ run_and_expect "$build_dir/pointers_arrays.exe" 19
 run_and_expect "$build_dir/pointer_arithmetic.exe" 14
 run_and_expect "$build_dir/global_arrays.exe" 20
 run_and_expect "$build_dir/valid_forward_call.exe" 5
+run_and_expect "$build_dir/many_symbols.exe" 9
+run_and_expect "$build_dir/expression_order.exe" 86
+run_and_expect "$build_dir/constant_folding.exe" 11
+run_and_expect "$build_dir/table_lookup.exe" 11
+run_and_expect "$build_dir/peephole.exe" 55
+run_and_expect "$build_dir/peephole_off.exe" 55
+run_and_expect "$build_dir/locals_O.exe" 14
+run_and_expect "$build_dir/control_flow_O.exe" 16
+run_and_expect "$build_dir/missing_ops_O.exe" 52
+run_and_expect "$build_dir/types_O.exe" 162
+run_and_expect "$build_dir/pointers_arrays_O.exe" 19
+run_and_expect "$build_dir/multiple_functions_O.exe" 16
+run_and_expect "$build_dir/expression_order_O.exe" 86
+run_and_expect "$build_dir/table_lookup_O.exe" 11
+run_and_expect "$build_dir/peephole_O.exe" 55
+
+# Each peephole rule can be switched off on its own to bisect a miscompile.
+for rule in push-pop jump-to-next unreachable self-move move-back dead-move zero-register; do
+    "$compiler" -O "-fno-peephole=$rule" examples/peephole.c "$build_dir/peephole_no_$rule.asm"
+    "$cc" -x assembler "$build_dir/peephole_no_$rule.asm" -o "$build_dir/peephole_no_$rule.exe"
+    run_and_expect "$build_dir/peephole_no_$rule.exe" 55
+done
 
 echo "All compiler checks passed."
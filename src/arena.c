@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Bump allocator for objects that share one lifetime, such as the AST of a
+ * compilation. Allocation is a pointer increment inside the current block;
+ * nothing is freed individually, and arena_reset() drops everything at once
+ * while keeping the newest block around for the next user. arena_release()
+ * rolls back to an earlier arena_mark() in the same way.
+ */
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_ALIGNMENT 8
+
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+};
+
+#define ARENA_HEADER_SIZE \
+    ((sizeof(struct arena_block) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static struct arena_block *arena_new_block(struct arena *arena, size_t size)
+{
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    struct arena_block *block = malloc(ARENA_HEADER_SIZE + block_size);
+
+    if (!block) {
+        perror("Error allocating arena block");
+        exit(EXIT_FAILURE);
+    }
+
+    block->next = arena->blocks;
+    block->used = 0;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->block_count++;
+    return block;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_block *block = arena->blocks;
+    void *memory;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (!block || block->size - block->used < size) {
+        block = arena_new_block(arena, size);
+    }
+
+    memory = (char *)block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    arena->allocation_count++;
+    arena->allocated_bytes += size;
+    return memory;
+}
+
+void arena_reset(struct arena *arena)
+{
+    struct arena_block *block = arena->blocks;
+
+    if (!block) {
+        return;
+    }
+
+    while (block->next) {
+        struct arena_block *next = block->next->next;
+        free(block->next);
+        block->next = next;
+        arena->block_count--;
+    }
+    block->used = 0;
+}
+
+struct arena_mark arena_mark(struct arena *arena)
+{
+    struct arena_mark mark = { arena->blocks, arena->blocks ? arena->blocks->used : 0 };
+
+    return mark;
+}
+
+/*
+ * Frees everything allocated since mark. One emptied block is kept so that a
+ * caller releasing after every item does not go back to malloc each time.
+ */
+void arena_release(struct arena *arena, struct arena_mark mark)
+{
+    while (arena->blocks != mark.block) {
+        struct arena_block *block = arena->blocks;
+
+        if (block->next == mark.block && block->size == ARENA_BLOCK_SIZE) {
+            block->used = 0;
+            break;
+        }
+        arena->blocks = block->next;
+        free(block);
+        arena->block_count--;
+    }
+    if (mark.block) {
+        mark.block->used = mark.used;
+    }
+}
+
+void arena_free(struct arena *arena)
+{
+    while (arena->blocks) {
+        struct arena_block *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->block_count = 0;
+}
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <windows.h>
+#define make_directory(path) _mkdir(path)
+#define process_id() _getpid()
+/* MSVCRT's rename refuses to replace an existing file, which every pack rewrite does. */
+#define replace_file(from, to) (MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_directory(path) mkdir(path, 0777)
+#define process_id() getpid()
+#define replace_file(from, to) rename(from, to)
+#endif
+
+/*
+ * On-disk cache of generated function bodies. Each source path gets one pack
+ * file in the cache directory holding a record per function: a 64-bit key
+ * that codegen derives from everything the function's assembly depends on,
+ * followed by that assembly. A compile reads the pack once, reuses the
+ * bodies whose keys still match, and writes back a pack with exactly the
+ * functions it just emitted, so stale bodies never pile up. Packs are written
+ * to a temporary name and moved over the old pack, so concurrent compilers only
+ * ever see complete files.
+ */
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+#define PACK_MAGIC "DKCACHE1"
+#define PACK_MAGIC_LENGTH 8
+#define RECORD_HEADER_LENGTH (sizeof(uint64_t) + sizeof(uint32_t))
+
+struct cache_entry {
+    uint64_t key;
+    const char *text;
+    size_t length;
+};
+
+/* Folds data into hash; pass 0 to start a new hash. */
+uint64_t cache_hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+
+    if (hash == 0) {
+        hash = FNV_OFFSET_BASIS;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Word-at-a-time step for the many small fields of an AST node. */
+uint64_t cache_hash_int(uint64_t hash, int value)
+{
+    if (hash == 0) {
+        hash = FNV_OFFSET_BASIS;
+    }
+    hash = (hash ^ (uint32_t)value) * FNV_PRIME;
+    return hash ^ (hash >> 32);
+}
+
+/* Hashes the length first so adjacent strings cannot run together. */
+uint64_t cache_hash_text(uint64_t hash, const char *text)
+{
+    size_t length;
+
+    if (!text) {
+        return cache_hash_int(hash, -1);
+    }
+    length = strlen(text);
+    hash = cache_hash_int(hash, (int)length);
+    return cache_hash_bytes(hash, text, length);
+}
+
+int cache_prepare(const char *dir)
+{
+    if (make_directory(dir) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error creating cache directory %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+static char *pack_path(const char *dir, const char *source_path)
+{
+    size_t length = strlen(dir) + 32;
+    char *path = malloc(length);
+
+    if (!path) {
+        perror("Error allocating cache path");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, length, "%s/%016llx.pack", dir, (unsigned long long)cache_hash_text(0, source_path));
+    return path;
+}
+
+static void add_entry(struct function_cache *cache, uint64_t key, const char *text, size_t length)
+{
+    size_t slot;
+
+    if ((cache->count + 1) * 2 > cache->capacity) {
+        struct cache_entry *old_entries = cache->entries;
+        size_t old_capacity = cache->capacity;
+
+        cache->capacity = old_capacity ? old_capacity * 2 : 256;
+        cache->entries = calloc(cache->capacity, sizeof(struct cache_entry));
+        if (!cache->entries) {
+            perror("Error allocating function cache");
+            exit(EXIT_FAILURE);
+        }
+        cache->count = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_entries[i].text) {
+                add_entry(cache, old_entries[i].key, old_entries[i].text, old_entries[i].length);
+            }
+        }
+        free(old_entries);
+    }
+
+    slot = (size_t)(key >> 7) & (cache->capacity - 1);
+    while (cache->entries[slot].text && cache->entries[slot].key != key) {
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+    if (!cache->entries[slot].text) {
+        cache->count++;
+    }
+    cache->entries[slot].key = key;
+    cache->entries[slot].text = text;
+    cache->entries[slot].length = length;
+}
+
+static void read_pack(struct function_cache *cache)
+{
+    FILE *file = fopen(cache->path, "rb");
+    size_t offset = PACK_MAGIC_LENGTH;
+    long size;
+
+    if (!file) {
+        return;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < PACK_MAGIC_LENGTH ||
+        fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return;
+    }
+    cache->data = malloc((size_t)size);
+    if (!cache->data) {
+        perror("Error allocating function cache");
+        exit(EXIT_FAILURE);
+    }
+    cache->length = fread(cache->data, 1, (size_t)size, file);
+    fclose(file);
+    if (cache->length != (size_t)size || memcmp(cache->data, PACK_MAGIC, PACK_MAGIC_LENGTH) != 0) {
+        return;
+    }
+
+    /* A truncated or foreign record ends the scan; whatever came before is still usable. */
+    while (cache->length - offset >= RECORD_HEADER_LENGTH) {
+        uint64_t key;
+        uint32_t length;
+
+        memcpy(&key, cache->data + offset, sizeof(key));
+        memcpy(&length, cache->data + offset + sizeof(key), sizeof(length));
+        offset += RECORD_HEADER_LENGTH;
+        if (length == 0 || cache->length - offset < length) {
+            break;
+        }
+        add_entry(cache, key, cache->data + offset, length);
+        offset += length;
+    }
+}
+
+void function_cache_open(struct function_cache *cache, const char *dir, const char *source_path)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->path = pack_path(dir, source_path);
+    emitter_init(&cache->pack, NULL);
+    emit_bytes(&cache->pack, PACK_MAGIC, PACK_MAGIC_LENGTH);
+    read_pack(cache);
+}
+
+/* Returns the cached body for key, or NULL on a miss. */
+const char *function_cache_find(struct function_cache *cache, uint64_t key, size_t *length)
+{
+    size_t slot;
+
+    if (cache->count == 0) {
+        return NULL;
+    }
+    slot = (size_t)(key >> 7) & (cache->capacity - 1);
+    while (cache->entries[slot].text) {
+        if (cache->entries[slot].key == key) {
+            *length = cache->entries[slot].length;
+            return cache->entries[slot].text;
+        }
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+    return NULL;
+}
+
+/* Records one emitted function body for the pack written by function_cache_close(). */
+void function_cache_add(struct function_cache *cache, uint64_t key, const char *text, size_t length, int reused)
+{
+    uint32_t record_length = (uint32_t)length;
+
+    if (length == 0 || length > UINT32_MAX) {
+        cache->dirty = 1;
+        return;
+    }
+    emit_bytes(&cache->pack, (const char *)&key, sizeof(key));
+    emit_bytes(&cache->pack, (const char *)&record_length, sizeof(record_length));
+    emit_bytes(&cache->pack, text, length);
+    cache->dirty |= !reused;
+    cache->used++;
+}
+
+static void write_pack(struct function_cache *cache)
+{
+    size_t length = strlen(cache->path) + 48;
+    char *temporary = malloc(length);
+    FILE *file;
+    int ok;
+
+    if (!temporary) {
+        perror("Error allocating cache path");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(temporary, length, "%s.%d.%lx.tmp", cache->path, (int)process_id(), (unsigned long)(uintptr_t)cache);
+    file = fopen(temporary, "wb");
+    if (!file) {
+        free(temporary);
+        return;
+    }
+    ok = fwrite(cache->pack.data, 1, cache->pack.length, file) == cache->pack.length;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || replace_file(temporary, cache->path) != 0) {
+        remove(temporary);
+    }
+    free(temporary);
+}
+
+/*
+ * Writes the new pack when save is set and it differs from the old one; a
+ * cache that cannot be written only costs misses next time.
+ */
+void function_cache_close(struct function_cache *cache, int save)
+{
+    if (save && (cache->dirty || cache->used != cache->count)) {
+        write_pack(cache);
+    }
+    emitter_release(&cache->pack);
+    free(cache->entries);
+    free(cache->data);
+    free(cache->path);
+}
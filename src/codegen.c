@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -5,316 +7,668 @@
 #include "defs.h"
 #include "decl.h"
 
-static struct {
-    char *name;
-    int offset;
-    int array_length;
-} symbols[256];
-static struct {
-    char *name;
+struct global_slot {
+    const char *name;
     int array_length;
-    int values[256];
-} globals[256];
-static int symbol_count = 0;
-static int global_count = 0;
-static int local_stack_count = 0;
-static int label_count = 0;
-static int current_function_end_label = 0;
-static int loop_break_labels[128];
-static int loop_continue_labels[128];
-static int loop_depth = 0;
-
-static int find_local(const char *name)
-{
-    for (int i = 0; i < symbol_count; i++) {
-        if (strcmp(symbols[i].name, name) == 0) {
-            return i;
-        }
-    }
+    struct ast_node *node;
+};
+
+/*
+ * Code generator state for one generate_program() call. Names were resolved
+ * by semantic analysis; every variable access emits from the struct symbol
+ * on its node. Labels are numbered per function and prefixed with its name,
+ * so forks made by codegen_fork() can emit different functions at once.
+ */
+struct codegen {
+    struct compilation *unit;
+    struct codegen *parent;
+    struct emitter *output;
+    struct emitter *diagnostics;
+    struct global_slot *globals;
+    int global_count;
+    int global_capacity;
+    const char *function_name;
+    int label_count;
+    int current_function_end_label;
+    int *loop_break_labels;
+    int *loop_continue_labels;
+    int loop_depth;
+    int loop_capacity;
+    int error_count;
+    int hold_pool;
+    int held;
+    int saved_temps;
+    struct function_cache *cache;
+    struct emitter function_output;
+    struct emitter body_output;
+    struct emitter insn_output;
+    struct emitter cache_record;
+    int *peephole_hits;
+};
+
+/* Bump whenever a change to this file alters the code emitted for a function. */
+#define CODEGEN_CACHE_VERSION "donkey-codegen-8"
+
+/*
+ * Registers that can hold an intermediate value, as bits: the scratch pair
+ * always, and under -O any callee-saved register no variable was given.
+ */
+#define HOLD_REGISTERS 5
+#define HOLD_ECX 0x1
+#define HOLD_EDX 0x2
+#define HOLD_SCRATCH (HOLD_ECX | HOLD_EDX)
+#define HOLD_CALLEE_SAVED(reg) (1 << ((reg) + 1))
+
+/* An expression's label packs its temporary count, clobbers and effects. */
+#define LABEL_NEED 0xff
+#define LABEL_CLOBBER_SHIFT 8
+#define LABEL_SIDE_EFFECTS 0x400
+#define LABEL_DONE 0x800
+
+
+/*
+ * The front end rejects anything codegen cannot handle, so these are internal
+ * errors. They are recorded and generation carries on, leaving the caller to
+ * discard the output.
+ */
+static void codegen_error(struct codegen *gen, const char *format, ...)
+{
+    va_list args;
 
-    return -1;
+    va_start(args, format);
+    emit_vformat(gen->diagnostics, format, args);
+    va_end(args);
+    gen->error_count++;
 }
 
-static int local_offset(const char *name)
+static void generate_statement(struct codegen *gen, struct ast_node *node);
+static void generate_exp(struct codegen *gen, struct ast_node *node);
+static int generate_call_args(struct codegen *gen, struct ast_node *node);
+static int expression_label(struct ast_node *node);
+static int address_label(struct ast_node *node);
+
+static void *grow_table(void *table, int *capacity, size_t entry_size)
 {
-    int index = find_local(name);
-    if (index < 0) {
-        fprintf(stderr, "Use of undeclared identifier '%s'\n", name);
+    int grown = *capacity ? *capacity * 2 : 64;
+
+    table = realloc(table, (size_t)grown * entry_size);
+    if (!table) {
+        perror("Error allocating code generator tables");
         exit(1);
     }
-
-    return symbols[index].offset;
+    *capacity = grown;
+    return table;
 }
 
-static int find_global(const char *name)
+/* Where a local lives: its register under -O, otherwise its frame slot. */
+static struct operand local_operand(struct symbol *symbol, int offset)
 {
-    for (int i = 0; i < global_count; i++) {
-        if (strcmp(globals[i].name, name) == 0) {
-            return i;
-        }
+    if (symbol->reg) {
+        return operand_register(register_name(symbol->reg));
     }
+    return operand_frame(offset);
+}
 
-    return -1;
+/*
+ * Expressions are generated Sethi-Ullman style. Every expression is labelled
+ * once, bottom up, with the number of temporaries it needs beyond %eax, the
+ * scratch registers its code overwrites, and whether it has side effects.
+ * A binary operator whose operands are both free of side effects evaluates
+ * the one that needs more temporaries first; otherwise the left goes first,
+ * as it always has. The first value is held in a register that the second
+ * operand's code leaves alone, and only when none is free does it go on
+ * the stack. Right operands that are constants or scalar variables are used
+ * in place and need no temporary at all.
+ */
+static const char *const hold_names[HOLD_REGISTERS] = { "ecx", "edx", "ebx", "esi", "edi" };
+
+static int is_pure(struct ast_node *node)
+{
+    return !(expression_label(node) & LABEL_SIDE_EFFECTS);
 }
 
-static void add_symbol(const char *name, int offset)
+static int clobbers(int label)
 {
-    if (!name) {
-        return;
+    return (label >> LABEL_CLOBBER_SHIFT) & HOLD_SCRATCH;
+}
+
+static int merge_labels(int first, int second)
+{
+    int need = first & LABEL_NEED;
+
+    if ((second & LABEL_NEED) > need) {
+        need = second & LABEL_NEED;
     }
+    return ((first | second) & ~LABEL_NEED) | need;
+}
 
-    if (find_local(name) >= 0) {
-        fprintf(stderr, "Redeclaration of local variable '%s'\n", name);
-        exit(1);
+/* The label of evaluating first, holding it, and then evaluating second. */
+static int hold_labels(int first, int second)
+{
+    int need = (second & LABEL_NEED) + 1;
+
+    if ((first & LABEL_NEED) > need) {
+        need = first & LABEL_NEED;
+    }
+    if (need > LABEL_NEED) {
+        need = LABEL_NEED;
+    }
+    return ((first | second) & ~LABEL_NEED) | (HOLD_EDX << LABEL_CLOBBER_SHIFT) | need;
+}
+
+static int is_array_variable(struct ast_node *node);
+static int is_register_variable(struct ast_node *node);
+static struct operand element_operand(struct ast_node *base, struct ast_node *index, const char *index_register);
+
+/*
+ * Constants, scalar variables, and elements of array variables at a constant
+ * index or one kept in a register: what instructions can take as operands.
+ */
+static int is_direct_operand(struct ast_node *node)
+{
+    if (node->type == AST_INTLIT || node->type == AST_SIZEOF) {
+        return 1;
+    }
+    if (node->type == AST_ARRAY_SUBSCRIPT) {
+        return is_array_variable(node->left) &&
+            (node->right->type == AST_INTLIT || is_register_variable(node->right));
     }
+    return node->type == AST_IDENTIFIER && node->symbol &&
+        node->symbol->kind != SYMBOL_FUNCTION && node->symbol->array_length == 0;
+}
 
-    if (symbol_count >= 256) {
-        fprintf(stderr, "Too many local variables or parameters\n");
-        exit(1);
+static struct operand direct_operand(struct ast_node *node)
+{
+    if (node->type == AST_INTLIT) {
+        return operand_immediate_text(node->value);
+    }
+    if (node->type == AST_SIZEOF) {
+        return operand_immediate(type_size(node->value));
     }
+    if (node->type == AST_ARRAY_SUBSCRIPT) {
+        return element_operand(node->left, node->right, NULL);
+    }
+    if (node->symbol->kind == SYMBOL_LOCAL) {
+        return local_operand(node->symbol, node->symbol->offset);
+    }
+    return operand_symbol(node->symbol->name);
+}
 
-    symbols[symbol_count].name = strdup(name);
-    symbols[symbol_count].offset = offset;
-    symbols[symbol_count].array_length = 0;
-    symbol_count++;
+static int is_pointer_value(struct ast_node *node)
+{
+    return node->pointer_depth > 0 || node->array_length > 0;
 }
 
-static int eval_const_exp(struct ast_node *node);
+static int is_pointer_arithmetic(struct ast_node *node)
+{
+    return (node->type == AST_ADD || node->type == AST_SUB) &&
+        (is_pointer_value(node->left) || is_pointer_value(node->right));
+}
 
-static struct ast_node *initializer_items(struct ast_node *node)
+/* pointer + integer, which addresses an element just as pointer[integer] does. */
+static int is_element_sum(struct ast_node *node)
 {
-    if (!node || node->type != AST_INITIALIZER_LIST) {
+    return node->type == AST_ADD && is_pointer_value(node->left) && !is_pointer_value(node->right);
+}
+
+/* Arrays whose address is a frame offset or a symbol, which takes no code. */
+static int is_array_variable(struct ast_node *node)
+{
+    return node->type == AST_IDENTIFIER && node->symbol &&
+        node->symbol->kind != SYMBOL_FUNCTION && node->symbol->array_length > 0;
+}
+
+/* Scalars kept in a register under -O, which can index an element as they are. */
+static int is_register_variable(struct ast_node *node)
+{
+    return node->type == AST_IDENTIFIER && node->symbol && node->symbol->kind == SYMBOL_LOCAL &&
+        node->symbol->array_length == 0 && node->symbol->reg;
+}
+
+static int is_commutative(ASTNodeType type)
+{
+    return type == AST_ADD || type == AST_MUL || type == AST_BITWISE_AND ||
+        type == AST_BITWISE_OR || type == AST_BITWISE_XOR;
+}
+
+/* A direct left operand may be read after the right one has been evaluated. */
+static int can_read_left_last(struct ast_node *node)
+{
+    return is_direct_operand(node->left) &&
+        (node->left->type == AST_INTLIT || node->left->type == AST_SIZEOF || is_pure(node->right));
+}
+
+/*
+ * For an integer index x + c, c + x or x - c, returns x and sets *offset to
+ * the signed constant, which can move into the displacement; NULL otherwise.
+ */
+static struct ast_node *offset_index(struct ast_node *index, int *offset)
+{
+    if ((index->type != AST_ADD && index->type != AST_SUB) || is_pointer_value(index) ||
+        is_pointer_value(index->left) || is_pointer_value(index->right)) {
         return NULL;
     }
-    if (!node->left || node->left->type == AST_INITIALIZER_LIST) {
-        return node->left;
+    if (index->right->type == AST_INTLIT) {
+        *offset = atoi(index->right->value);
+        if (index->type == AST_SUB) {
+            *offset = (int)(0u - (uint32_t)*offset);
+        }
+        return index->left;
+    }
+    if (index->type == AST_ADD && index->left->type == AST_INTLIT) {
+        *offset = atoi(index->left->value);
+        return index->right;
     }
-    return node;
+    return NULL;
 }
 
-static void add_global_node(struct ast_node *node)
+/* The label of addressing element index of base, as generate_element() does. */
+static int element_label(struct ast_node *base, struct ast_node *index)
 {
-    int i;
-    struct ast_node *item;
+    struct ast_node *variable;
+    int offset;
+    int label;
 
-    if (!node->value) {
-        return;
+    if ((variable = offset_index(index, &offset))) {
+        return element_label(base, variable);
     }
-
-    if (find_global(node->value) >= 0) {
-        fprintf(stderr, "Redeclaration of global variable '%s'\n", node->value);
-        exit(1);
+    if (is_array_variable(base)) {
+        return index->type == AST_INTLIT || is_register_variable(index) ? 0 : expression_label(index);
+    }
+    label = base->array_length > 0 ? address_label(base) : expression_label(base);
+    if (index->type == AST_INTLIT || is_register_variable(index)) {
+        return label;
     }
+    if (is_direct_operand(index)) {
+        return label | (HOLD_EDX << LABEL_CLOBBER_SHIFT);
+    }
+    return hold_labels(label, expression_label(index));
+}
 
-    if (global_count >= 256) {
-        fprintf(stderr, "Too many global variables\n");
-        exit(1);
+static int address_label(struct ast_node *node)
+{
+    switch (node->type) {
+        case AST_DEREFERENCE:
+            if (is_element_sum(node->left)) {
+                return element_label(node->left->left, node->left->right);
+            }
+            return expression_label(node->left);
+        case AST_ARRAY_SUBSCRIPT:
+            return element_label(node->left, node->right);
+        default:
+            return 0;
     }
+}
 
-    globals[global_count].name = strdup(node->value);
-    globals[global_count].array_length = node->array_length;
-    for (i = 0; i < 256; i++) {
-        globals[global_count].values[i] = 0;
+static int binary_label(struct ast_node *node)
+{
+    int left = expression_label(node->left);
+    int right = expression_label(node->right);
+    int label;
+
+    if (is_element_sum(node)) {
+        return element_label(node->left, node->right);
     }
-    if (node->array_length > 0) {
-        i = 0;
-        for (item = initializer_items(node->left); item && i < node->array_length; item = item->right) {
-            globals[global_count].values[i++] = eval_const_exp(item->left);
-        }
+    if (node->type == AST_SUB && is_pointer_value(node->left) && node->right->type == AST_INTLIT) {
+        return left;
+    }
+    if (!is_pointer_arithmetic(node) && is_direct_operand(node->right)) {
+        label = left | (HOLD_EDX << LABEL_CLOBBER_SHIFT);
+    } else if (!is_pointer_arithmetic(node) && can_read_left_last(node)) {
+        label = right | (HOLD_EDX << LABEL_CLOBBER_SHIFT);
+    } else if (!((left | right) & LABEL_SIDE_EFFECTS) && (left & LABEL_NEED) == (right & LABEL_NEED)) {
+        label = hold_labels(left, right);
+    } else if (!((left | right) & LABEL_SIDE_EFFECTS)) {
+        label = merge_labels(left, right) | (HOLD_EDX << LABEL_CLOBBER_SHIFT);
     } else {
-        globals[global_count].values[0] = eval_const_exp(node->left);
+        label = hold_labels(left, right);
+    }
+    if (node->type == AST_DIV || node->type == AST_MOD ||
+        node->type == AST_SHIFT_LEFT || node->type == AST_SHIFT_RIGHT) {
+        label |= HOLD_SCRATCH << LABEL_CLOBBER_SHIFT;
     }
-    global_count++;
+    return label;
 }
 
-static void add_param(const char *name, int index)
+static int compute_label(struct ast_node *node)
 {
-    add_symbol(name, 8 + (index * 4));
+    int label;
+
+    switch (node->type) {
+        case AST_INTLIT:
+        case AST_SIZEOF:
+        case AST_IDENTIFIER:
+        case AST_PRE_INCREMENT:
+        case AST_PRE_DECREMENT:
+            return node->type == AST_PRE_INCREMENT || node->type == AST_PRE_DECREMENT ? LABEL_SIDE_EFFECTS : 0;
+        case AST_POST_INCREMENT:
+        case AST_POST_DECREMENT:
+            return LABEL_SIDE_EFFECTS | (HOLD_EDX << LABEL_CLOBBER_SHIFT);
+        case AST_CALL:
+            label = LABEL_SIDE_EFFECTS | (HOLD_SCRATCH << LABEL_CLOBBER_SHIFT);
+            for (int i = 0; i < node->left->child_count; i++) {
+                label = merge_labels(label, expression_label(node->left->children[i]));
+            }
+            return label;
+        case AST_ASSIGN:
+            label = expression_label(node->right);
+            if (node->left->type != AST_IDENTIFIER) {
+                label = hold_labels(label, address_label(node->left));
+            }
+            return label | LABEL_SIDE_EFFECTS;
+        case AST_ADDRESS_OF:
+            return address_label(node->left);
+        case AST_ARRAY_SUBSCRIPT:
+            return address_label(node);
+        case AST_DEREFERENCE:
+            return address_label(node);
+        case AST_CAST:
+        case AST_NEGATION:
+        case AST_BITWISE_COMPLEMENT:
+        case AST_LOGICAL_NEGATION:
+            return expression_label(node->left);
+        case AST_CONDITIONAL:
+            label = merge_labels(expression_label(node->left), expression_label(node->right->left));
+            return merge_labels(label, expression_label(node->right->right));
+        case AST_LOGICAL_AND:
+        case AST_LOGICAL_OR:
+        case AST_COMMA:
+            return merge_labels(expression_label(node->left), expression_label(node->right));
+        default:
+            return binary_label(node);
+    }
 }
 
-static void add_local_node(struct ast_node *node)
+static int expression_label(struct ast_node *node)
 {
-    int slots = node->array_length > 0 ? node->array_length : 1;
+    if (!(node->label & LABEL_DONE)) {
+        node->label = compute_label(node) | LABEL_DONE;
+    }
+    return node->label;
+}
 
-    local_stack_count += slots;
-    add_symbol(node->value, -4 * local_stack_count);
-    symbols[symbol_count - 1].array_length = node->array_length;
+/*
+ * Moves %eax out of the way of code that overwrites the scratch registers in
+ * clobbered. Returns the register it went to, or -1 if it was pushed.
+ */
+static int hold_eax(struct codegen *gen, int clobbered)
+{
+    for (int i = 0; i < HOLD_REGISTERS; i++) {
+        int bit = 1 << i;
+
+        if ((gen->hold_pool & bit) && !(gen->held & bit) && !(clobbered & bit)) {
+            gen->held |= bit;
+            gen->saved_temps |= bit & ~HOLD_SCRATCH;
+            emit_insn2(gen->output, "movl", operand_register("eax"), operand_register(hold_names[i]));
+            return i;
+        }
+    }
+    emit_insn1(gen->output, "push", operand_register("eax"));
+    return -1;
 }
 
-static int collect_params(struct ast_node *node, int index)
+/*
+ * Returns the register holding a value saved by hold_eax(). A pushed value
+ * is popped into %edx, which no enclosing expression holds anything in,
+ * because every expression that holds a value is labelled as clobbering it.
+ */
+static const char *release_hold(struct codegen *gen, int hold)
 {
-    if (!node) {
-        return index;
+    if (hold < 0) {
+        emit_insn1(gen->output, "pop", operand_register("edx"));
+        return "edx";
     }
+    gen->held &= ~(1 << hold);
+    return hold_names[hold];
+}
 
-    if (node->type != AST_PARAM_LIST) {
-        fprintf(stderr, "Unsupported parameter node type: %d\n", node->type);
-        exit(1);
+/* The resolved symbol of an identifier or declaration; NULL only after an internal error. */
+static struct symbol *node_symbol(struct codegen *gen, struct ast_node *node)
+{
+    if (!node->symbol) {
+        codegen_error(gen, "Use of undeclared identifier '%s'\n", node->value);
     }
+    return node->symbol;
+}
 
-    add_param(node->left->value, index);
-    return collect_params(node->right, index + 1);
+static int eval_const_exp(struct codegen *gen, struct ast_node *node);
+
+/* Returns element index of a brace initializer, or NULL past its end. */
+static struct ast_node *initializer_item(struct ast_node *node, int index)
+{
+    if (!node || node->type != AST_INITIALIZER_LIST || index >= node->child_count) {
+        return NULL;
+    }
+    return node->children[index];
 }
 
-static void collect_locals(struct ast_node *node)
+static void add_global_node(struct codegen *gen, struct ast_node *node)
 {
-    if (!node) {
+    if (!node->value) {
         return;
     }
 
-    if (node->type == AST_DECL) {
-        add_local_node(node);
+    if (gen->global_count == gen->global_capacity) {
+        gen->globals = grow_table(gen->globals, &gen->global_capacity, sizeof(struct global_slot));
     }
 
-    collect_locals(node->left);
-    collect_locals(node->right);
+    gen->globals[gen->global_count].name = node->value;
+    gen->globals[gen->global_count].array_length = node->array_length;
+    gen->globals[gen->global_count].node = node;
+    gen->global_count++;
 }
 
-static void free_locals(void)
+static void generate_epilogue(struct codegen *gen)
 {
-    for (int i = 0; i < symbol_count; i++) {
-        free(symbols[i].name);
-        symbols[i].name = NULL;
-        symbols[i].offset = 0;
-        symbols[i].array_length = 0;
-    }
-    symbol_count = 0;
-    local_stack_count = 0;
+    emit_insn0(gen->output, "leave");
+    emit_insn0(gen->output, "ret");
 }
 
-static void generate_epilogue(FILE *output)
+static void generate_identifier_load(struct codegen *gen, struct ast_node *node)
 {
-    fprintf(output, "    leave\n");
-    fprintf(output, "    ret\n");
-}
+    struct symbol *symbol = node_symbol(gen, node);
 
-static void generate_identifier_load(const char *name, FILE *output)
-{
-    int local_index = find_local(name);
-    if (local_index >= 0) {
-        if (symbols[local_index].array_length > 0) {
-            fprintf(output, "    leal    %d(%%ebp), %%eax\n", symbols[local_index].offset);
-            return;
-        }
-        fprintf(output, "    movl    %d(%%ebp), %%eax\n", symbols[local_index].offset);
+    if (!symbol) {
         return;
     }
-
-    if (find_global(name) >= 0) {
-        int global_index = find_global(name);
-        if (globals[global_index].array_length > 0) {
-            fprintf(output, "    movl    $_%s, %%eax\n", name);
+    if (symbol->kind == SYMBOL_LOCAL) {
+        if (symbol->array_length > 0) {
+            emit_insn2(gen->output, "leal", operand_frame(symbol->offset), operand_register("eax"));
             return;
         }
-        fprintf(output, "    movl    _%s, %%eax\n", name);
+        emit_insn2(gen->output, "movl", local_operand(symbol, symbol->offset), operand_register("eax"));
         return;
     }
 
-    fprintf(stderr, "Use of undeclared identifier '%s'\n", name);
-    exit(1);
+    if (symbol->array_length > 0) {
+        emit_insn2(gen->output, "movl", operand_symbol_address(symbol->name), operand_register("eax"));
+        return;
+    }
+    emit_insn2(gen->output, "movl", operand_symbol(symbol->name), operand_register("eax"));
 }
 
-static void generate_identifier_store(const char *name, FILE *output)
+static void generate_identifier_store(struct codegen *gen, struct ast_node *node)
 {
-    int local_index = find_local(name);
-    if (local_index >= 0) {
-        fprintf(output, "    movl    %%eax, %d(%%ebp)\n", symbols[local_index].offset);
+    struct symbol *symbol = node_symbol(gen, node);
+
+    if (!symbol) {
         return;
     }
-
-    if (find_global(name) >= 0) {
-        fprintf(output, "    movl    %%eax, _%s\n", name);
+    if (symbol->kind == SYMBOL_LOCAL) {
+        emit_insn2(gen->output, "movl", operand_register("eax"), local_operand(symbol, symbol->offset));
         return;
     }
-
-    fprintf(stderr, "Use of undeclared identifier '%s'\n", name);
-    exit(1);
+    emit_insn2(gen->output, "movl", operand_register("eax"), operand_symbol(symbol->name));
 }
 
-static void generate_lvalue_address(struct ast_node *node, FILE *output)
+static void generate_lvalue_address(struct codegen *gen, struct ast_node *node);
+
+/*
+ * Evaluates what it takes to address element index of base, an array or a
+ * pointer, and returns the memory operand. Constant indices, and the constant
+ * term of an index like i + 1, become part of the displacement and variable
+ * ones are scaled by the addressing mode. The registers the operand names
+ * must be used before anything else is emitted.
+ */
+static struct operand generate_element(struct codegen *gen, struct ast_node *base, struct ast_node *index)
 {
-    int local_index;
+    const char *base_register = NULL;
+    const char *index_register = NULL;
+    int displacement = 0;
+    struct ast_node *variable;
+    struct operand element;
+    int offset;
+    int hold;
 
-    switch (node->type) {
-        case AST_IDENTIFIER:
-            local_index = find_local(node->value);
-            if (local_index >= 0) {
-                fprintf(output, "    leal    %d(%%ebp), %%eax\n", symbols[local_index].offset);
-                return;
-            }
-            if (find_global(node->value) >= 0) {
-                fprintf(output, "    movl    $_%s, %%eax\n", node->value);
-                return;
-            }
-            fprintf(stderr, "Use of undeclared identifier '%s'\n", node->value);
-            exit(1);
-        case AST_DEREFERENCE:
-            generate_exp(node->left, output);
-            return;
-        case AST_ARRAY_SUBSCRIPT:
-            if (node->left->array_length > 0) {
-                generate_lvalue_address(node->left, output);
-            } else {
-                generate_exp(node->left, output);
-            }
-            fprintf(output, "    push    %%eax\n");
-            generate_exp(node->right, output);
-            fprintf(output, "    imull   $4, %%eax\n");
-            fprintf(output, "    pop     %%edx\n");
-            fprintf(output, "    addl    %%edx, %%eax\n");
-            return;
-        default:
-            fprintf(stderr, "Expression is not assignable\n");
-            exit(1);
+    if ((variable = offset_index(index, &offset))) {
+        element = generate_element(gen, base, variable);
+        element.value = (int)((uint32_t)element.value + 4u * (uint32_t)offset);
+        return element;
+    }
+    if (index->type == AST_INTLIT && is_element_sum(base)) {
+        element = generate_element(gen, base->left, base->right);
+        element.value += 4 * atoi(index->value);
+        return element;
+    }
+    if (is_array_variable(base)) {
+        if (index->type != AST_INTLIT && !is_register_variable(index)) {
+            generate_exp(gen, index);
+            index_register = "eax";
+        }
+        return element_operand(base, index, index_register);
+    }
+
+    if (index->type == AST_INTLIT) {
+        displacement = 4 * atoi(index->value);
+    } else if (is_register_variable(index)) {
+        index_register = register_name(index->symbol->reg);
+    }
+
+    if (base->array_length > 0) {
+        generate_lvalue_address(gen, base);
+    } else {
+        generate_exp(gen, base);
+    }
+    base_register = "eax";
+    if (index->type != AST_INTLIT && !index_register) {
+        if (is_direct_operand(index)) {
+            emit_insn2(gen->output, "movl", direct_operand(index), operand_register("edx"));
+            index_register = "edx";
+        } else {
+            hold = hold_eax(gen, clobbers(expression_label(index)));
+            generate_exp(gen, index);
+            base_register = release_hold(gen, hold);
+            index_register = "eax";
+        }
     }
+    return operand_memory(NULL, displacement, base_register, index_register, 4);
 }
 
-static void push_loop(int break_label, int continue_label)
+/*
+ * An element of an array variable, at a constant index, one kept in a
+ * register, or one already computed into index_register.
+ */
+static struct operand element_operand(struct ast_node *base, struct ast_node *index, const char *index_register)
 {
-    if (loop_depth >= 128) {
-        fprintf(stderr, "Too many nested loops\n");
-        exit(1);
+    const char *symbol = NULL;
+    const char *base_register = NULL;
+    int displacement = 0;
+
+    if (index->type == AST_INTLIT) {
+        displacement = 4 * atoi(index->value);
+    } else if (!index_register) {
+        index_register = register_name(index->symbol->reg);
+    }
+    if (base->symbol->kind == SYMBOL_LOCAL) {
+        displacement += base->symbol->offset;
+        base_register = "ebp";
+    } else {
+        symbol = base->symbol->name;
     }
+    return operand_memory(symbol, displacement, base_register, index_register, 4);
+}
 
-    loop_break_labels[loop_depth] = break_label;
-    loop_continue_labels[loop_depth] = continue_label;
-    loop_depth++;
+/* The memory operand named by an assignable expression other than a variable. */
+static struct operand generate_target(struct codegen *gen, struct ast_node *node)
+{
+    if (node->type == AST_ARRAY_SUBSCRIPT) {
+        return generate_element(gen, node->left, node->right);
+    }
+    if (node->type == AST_DEREFERENCE && is_element_sum(node->left)) {
+        return generate_element(gen, node->left->left, node->left->right);
+    }
+    if (node->type == AST_DEREFERENCE) {
+        generate_exp(gen, node->left);
+    } else {
+        codegen_error(gen, "Expression is not assignable\n");
+    }
+    return operand_indirect("eax");
 }
 
-static void pop_loop(void)
+/* Leaves the address a memory operand names in %eax. */
+static void generate_address(struct codegen *gen, struct operand address)
 {
-    if (loop_depth > 0) {
-        loop_depth--;
+    if (address.kind == OPERAND_INDIRECT ||
+        (address.kind == OPERAND_MEMORY && address.base && strcmp(address.base, "eax") == 0 &&
+        !address.index && address.value == 0)) {
+        return;
     }
+    emit_insn2(gen->output, "leal", address, operand_register("eax"));
 }
 
-static int type_size(const char *type)
+static void generate_lvalue_address(struct codegen *gen, struct ast_node *node)
 {
-    if (!type) {
-        return 4;
+    struct symbol *symbol;
+
+    if (node->type != AST_IDENTIFIER) {
+        generate_address(gen, generate_target(gen, node));
+        return;
     }
-    if (strcmp(type, "char") == 0 || strcmp(type, "uchar") == 0) {
-        return 1;
+    symbol = node_symbol(gen, node);
+    if (!symbol) {
+        return;
     }
-    if (strcmp(type, "short") == 0 || strcmp(type, "ushort") == 0) {
-        return 2;
+    if (symbol->kind == SYMBOL_LOCAL) {
+        emit_insn2(gen->output, "leal", operand_frame(symbol->offset), operand_register("eax"));
+        return;
     }
-    return 4;
+    emit_insn2(gen->output, "movl", operand_symbol_address(symbol->name), operand_register("eax"));
+}
+
+static void push_loop(struct codegen *gen, int break_label, int continue_label)
+{
+    if (gen->loop_depth == gen->loop_capacity) {
+        int capacity = gen->loop_capacity;
+
+        gen->loop_break_labels = grow_table(gen->loop_break_labels, &capacity, sizeof(int));
+        gen->loop_continue_labels = grow_table(gen->loop_continue_labels, &gen->loop_capacity, sizeof(int));
+    }
+
+    gen->loop_break_labels[gen->loop_depth] = break_label;
+    gen->loop_continue_labels[gen->loop_depth] = continue_label;
+    gen->loop_depth++;
 }
 
-static void generate_cast(const char *type, FILE *output)
+static void pop_loop(struct codegen *gen)
+{
+    if (gen->loop_depth > 0) {
+        gen->loop_depth--;
+    }
+}
+
+static void generate_cast(struct codegen *gen, const char *type)
 {
     if (!type) {
         return;
     }
     if (strcmp(type, "char") == 0) {
-        fprintf(output, "    movsbl  %%al, %%eax\n");
+        emit_insn2(gen->output, "movsbl", operand_register("al"), operand_register("eax"));
     } else if (strcmp(type, "uchar") == 0) {
-        fprintf(output, "    movzbl  %%al, %%eax\n");
+        emit_insn2(gen->output, "movzbl", operand_register("al"), operand_register("eax"));
     } else if (strcmp(type, "short") == 0) {
-        fprintf(output, "    movswl  %%ax, %%eax\n");
+        emit_insn2(gen->output, "movswl", operand_register("ax"), operand_register("eax"));
     } else if (strcmp(type, "ushort") == 0) {
-        fprintf(output, "    movzwl  %%ax, %%eax\n");
+        emit_insn2(gen->output, "movzwl", operand_register("ax"), operand_register("eax"));
     }
 }
 
@@ -338,17 +692,10 @@ static int is_unsigned_type(CType type)
         type == TYPE_UINT || type == TYPE_ULONG;
 }
 
-static int cast_constant(int value, const char *type)
+static int eval_const_exp(struct codegen *gen, struct ast_node *node)
 {
-    if (strcmp(type, "char") == 0) return (int)(int8_t)value;
-    if (strcmp(type, "uchar") == 0) return (int)(uint8_t)value;
-    if (strcmp(type, "short") == 0) return (int)(int16_t)value;
-    if (strcmp(type, "ushort") == 0) return (int)(uint16_t)value;
-    return value;
-}
+    int divisor;
 
-static int eval_const_exp(struct ast_node *node)
-{
     if (!node) {
         return 0;
     }
@@ -357,130 +704,329 @@ static int eval_const_exp(struct ast_node *node)
         case AST_INTLIT:
             return atoi(node->value);
         case AST_NEGATION:
-            return -eval_const_exp(node->left);
+            return -eval_const_exp(gen, node->left);
         case AST_BITWISE_COMPLEMENT:
-            return ~eval_const_exp(node->left);
+            return ~eval_const_exp(gen, node->left);
         case AST_LOGICAL_NEGATION:
-            return !eval_const_exp(node->left);
+            return !eval_const_exp(gen, node->left);
         case AST_ADD:
-            return eval_const_exp(node->left) + eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) + eval_const_exp(gen, node->right);
         case AST_SUB:
-            return eval_const_exp(node->left) - eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) - eval_const_exp(gen, node->right);
         case AST_MUL:
-            return eval_const_exp(node->left) * eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) * eval_const_exp(gen, node->right);
         case AST_DIV:
-            if (is_unsigned_type(node->left->data_type))
-                return (int)((uint32_t)eval_const_exp(node->left) /
-                    (uint32_t)eval_const_exp(node->right));
-            return eval_const_exp(node->left) / eval_const_exp(node->right);
         case AST_MOD:
-            if (is_unsigned_type(node->left->data_type))
-                return (int)((uint32_t)eval_const_exp(node->left) %
-                    (uint32_t)eval_const_exp(node->right));
-            return eval_const_exp(node->left) % eval_const_exp(node->right);
+            /* Semantic analysis rejects the divisions that trap; never let one reach the host. */
+            divisor = eval_const_exp(gen, node->right);
+            if (divisor == 0) {
+                return 0;
+            }
+            if (is_unsigned_type(node->left->data_type)) {
+                uint32_t dividend = (uint32_t)eval_const_exp(gen, node->left);
+
+                return (int)(node->type == AST_DIV ? dividend / (uint32_t)divisor : dividend % (uint32_t)divisor);
+            }
+            if (divisor == -1) {
+                return node->type == AST_DIV ? (int)(0u - (uint32_t)eval_const_exp(gen, node->left)) : 0;
+            }
+            return node->type == AST_DIV ? eval_const_exp(gen, node->left) / divisor :
+                eval_const_exp(gen, node->left) % divisor;
         case AST_SHIFT_LEFT:
-            return eval_const_exp(node->left) << eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) << eval_const_exp(gen, node->right);
         case AST_SHIFT_RIGHT:
             if (is_unsigned_type(node->left->data_type))
-                return (int)((uint32_t)eval_const_exp(node->left) >> eval_const_exp(node->right));
-            return eval_const_exp(node->left) >> eval_const_exp(node->right);
+                return (int)((uint32_t)eval_const_exp(gen, node->left) >> eval_const_exp(gen, node->right));
+            return eval_const_exp(gen, node->left) >> eval_const_exp(gen, node->right);
         case AST_BITWISE_AND:
-            return eval_const_exp(node->left) & eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) & eval_const_exp(gen, node->right);
         case AST_BITWISE_OR:
-            return eval_const_exp(node->left) | eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) | eval_const_exp(gen, node->right);
         case AST_BITWISE_XOR:
-            return eval_const_exp(node->left) ^ eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) ^ eval_const_exp(gen, node->right);
         case AST_LOGICAL_AND:
-            return eval_const_exp(node->left) && eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) && eval_const_exp(gen, node->right);
         case AST_LOGICAL_OR:
-            return eval_const_exp(node->left) || eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) || eval_const_exp(gen, node->right);
         case AST_EQUAL:
-            return eval_const_exp(node->left) == eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) == eval_const_exp(gen, node->right);
         case AST_NOT_EQUAL:
-            return eval_const_exp(node->left) != eval_const_exp(node->right);
+            return eval_const_exp(gen, node->left) != eval_const_exp(gen, node->right);
         case AST_LESS:
             if (is_unsigned_type(node->left->data_type))
-                return (uint32_t)eval_const_exp(node->left) < (uint32_t)eval_const_exp(node->right);
-            return eval_const_exp(node->left) < eval_const_exp(node->right);
+                return (uint32_t)eval_const_exp(gen, node->left) < (uint32_t)eval_const_exp(gen, node->right);
+            return eval_const_exp(gen, node->left) < eval_const_exp(gen, node->right);
         case AST_LESS_EQUAL:
             if (is_unsigned_type(node->left->data_type))
-                return (uint32_t)eval_const_exp(node->left) <= (uint32_t)eval_const_exp(node->right);
-            return eval_const_exp(node->left) <= eval_const_exp(node->right);
+                return (uint32_t)eval_const_exp(gen, node->left) <= (uint32_t)eval_const_exp(gen, node->right);
+            return eval_const_exp(gen, node->left) <= eval_const_exp(gen, node->right);
         case AST_GREATER:
             if (is_unsigned_type(node->left->data_type))
-                return (uint32_t)eval_const_exp(node->left) > (uint32_t)eval_const_exp(node->right);
-            return eval_const_exp(node->left) > eval_const_exp(node->right);
+                return (uint32_t)eval_const_exp(gen, node->left) > (uint32_t)eval_const_exp(gen, node->right);
+            return eval_const_exp(gen, node->left) > eval_const_exp(gen, node->right);
         case AST_GREATER_EQUAL:
             if (is_unsigned_type(node->left->data_type))
-                return (uint32_t)eval_const_exp(node->left) >= (uint32_t)eval_const_exp(node->right);
-            return eval_const_exp(node->left) >= eval_const_exp(node->right);
+                return (uint32_t)eval_const_exp(gen, node->left) >= (uint32_t)eval_const_exp(gen, node->right);
+            return eval_const_exp(gen, node->left) >= eval_const_exp(gen, node->right);
         case AST_CONDITIONAL:
-            return eval_const_exp(node->left) ? eval_const_exp(node->right->left) : eval_const_exp(node->right->right);
+            return eval_const_exp(gen, node->left) ? eval_const_exp(gen, node->right->left) : eval_const_exp(gen, node->right->right);
         case AST_COMMA:
-            return eval_const_exp(node->right);
+            return eval_const_exp(gen, node->right);
         case AST_SIZEOF:
             return type_size(node->value);
         case AST_CAST:
-            return cast_constant(eval_const_exp(node->left), node->value);
+            return cast_constant(eval_const_exp(gen, node->left), node->value);
         default:
-            fprintf(stderr, "Global initializer must be a constant expression\n");
-            exit(1);
+            codegen_error(gen, "Global initializer must be a constant expression\n");
+            return 0;
     }
 }
 
-static void collect_globals(struct ast_node *node)
+static void collect_globals(struct codegen *gen, struct ast_node *node)
 {
-    if (!node) {
+    for (int i = 0; i < node->child_count; i++) {
+        if (node->children[i]->type == AST_GLOBAL_DECL) {
+            add_global_node(gen, node->children[i]);
+        }
+    }
+}
+
+static void generate_globals(struct codegen *gen)
+{
+    if (gen->global_count == 0) {
         return;
     }
 
-    if (node->type == AST_FUNCTION_LIST) {
-        collect_globals(node->left);
-        collect_globals(node->right);
-    } else if (node->type == AST_GLOBAL_DECL) {
-        add_global_node(node);
+    emit_text(gen->output, ".data\n");
+    for (int i = 0; i < gen->global_count; i++) {
+        emit_global_symbol(gen->output, gen->globals[i].name);
+        if (gen->globals[i].array_length > 0) {
+            for (int j = 0; j < gen->globals[i].array_length; j++) {
+                struct ast_node *item = initializer_item(gen->globals[i].node->left, j);
+                emit_long(gen->output, item ? eval_const_exp(gen, item) : 0);
+            }
+        } else {
+            emit_long(gen->output, eval_const_exp(gen, gen->globals[i].node->left));
+        }
     }
+    emit_text(gen->output, ".text\n");
 }
 
-static void generate_globals(FILE *output)
+/*
+ * With -O, variables and temporaries are given registers first. The body is
+ * generated into a buffer of its own so that the prologue, which saves the
+ * callee-saved registers it ended up using, can be written ahead of it.
+ */
+static void generate_optimized_body(struct codegen *gen, struct ast_node *node)
 {
-    if (global_count == 0) {
+    struct emitter *output = gen->output;
+    int used = allocate_registers(node);
+    int saved = 0;
+
+    gen->hold_pool = HOLD_SCRATCH;
+    gen->held = 0;
+    gen->saved_temps = 0;
+    for (int reg = 1; reg <= ALLOCATABLE_REGISTERS; reg++) {
+        if (!(used & (1 << reg))) {
+            gen->hold_pool |= HOLD_CALLEE_SAVED(reg);
+        }
+    }
+    emitter_reset(&gen->body_output);
+    gen->output = &gen->body_output;
+    generate_statement(gen, node->right);
+    emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+    gen->output = output;
+    for (int reg = 1; reg <= ALLOCATABLE_REGISTERS; reg++) {
+        if (gen->saved_temps & HOLD_CALLEE_SAVED(reg)) {
+            used |= 1 << reg;
+        }
+    }
+
+    emit_global_symbol(output, node->value);
+    emit_insn1(output, "push", operand_register("ebp"));
+    emit_insn2(output, "movl", operand_register("esp"), operand_register("ebp"));
+    if (node->symbol->frame_size > 0) {
+        emit_insn2(output, "subl", operand_immediate(node->symbol->frame_size), operand_register("esp"));
+    }
+    for (int reg = 1; reg <= ALLOCATABLE_REGISTERS; reg++) {
+        if (used & (1 << reg)) {
+            emit_insn1(output, "push", operand_register(register_name(reg)));
+        }
+    }
+    for (int i = 0; i < node->left->child_count; i++) {
+        struct symbol *parameter = node->left->children[i]->symbol;
+
+        if (parameter && parameter->reg) {
+            emit_insn2(output, "movl", operand_frame(parameter->offset),
+                operand_register(register_name(parameter->reg)));
+        }
+    }
+    emitter_append(output, &gen->body_output);
+    emit_label(output, gen->function_name, gen->current_function_end_label);
+    for (int reg = 1; reg <= ALLOCATABLE_REGISTERS; reg++) {
+        if (used & (1 << reg)) {
+            saved++;
+            emit_insn2(output, "movl", operand_frame(-node->symbol->frame_size - 4 * saved),
+                operand_register(register_name(reg)));
+        }
+    }
+    generate_epilogue(gen);
+    gen->hold_pool = HOLD_SCRATCH;
+}
+
+static void generate_function_code(struct codegen *gen, struct ast_node *node)
+{
+    if (gen->unit->options.optimize) {
+        generate_optimized_body(gen, node);
+        return;
+    }
+    emit_global_symbol(gen->output, node->value);
+    emit_insn1(gen->output, "push", operand_register("ebp"));
+    emit_insn2(gen->output, "movl", operand_register("esp"), operand_register("ebp"));
+    if (node->symbol->frame_size > 0) {
+        emit_insn2(gen->output, "subl", operand_immediate(node->symbol->frame_size), operand_register("esp"));
+    }
+    generate_statement(gen, node->right);
+    emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+    emit_label(gen->output, gen->function_name, gen->current_function_end_label);
+    generate_epilogue(gen);
+}
+
+/* Generates a function as records and runs the peephole pass over them, unless it is off. */
+static void generate_function_body(struct codegen *gen, struct ast_node *node)
+{
+    struct emitter *output = gen->output;
+    int rules_off = gen->unit->options.peephole_off;
+
+    if ((rules_off & PEEPHOLE_ALL) == PEEPHOLE_ALL) {
+        generate_function_code(gen, node);
         return;
     }
+    emitter_reset(&gen->insn_output);
+    gen->output = &gen->insn_output;
+    generate_function_code(gen, node);
+    gen->output = output;
+    peephole_optimize(&gen->insn_output, rules_off, gen->peephole_hits);
+    emitter_append(output, &gen->insn_output);
+}
 
-    fprintf(output, ".data\n");
-    for (int i = 0; i < global_count; i++) {
-        fprintf(output, ".globl _%s\n", globals[i].name);
-        fprintf(output, "_%s:\n", globals[i].name);
-        int count = globals[i].array_length > 0 ? globals[i].array_length : 1;
-        for (int j = 0; j < count; j++) {
-            fprintf(output, "    .long   %d\n", globals[i].values[j]);
+/*
+ * A function's code depends only on its annotated subtree: the semantic pass
+ * has already folded callee parameter types into it as casts, and the symbol
+ * records say where each name lives. Source locations are left out, so
+ * moving a function does not invalidate it.
+ */
+static uint64_t hash_function_tree(uint64_t hash, struct ast_node *node)
+{
+    if (!node) {
+        return cache_hash_int(hash, -1);
+    }
+
+    hash = cache_hash_int(hash, node->type);
+    hash = cache_hash_int(hash, node->data_type);
+    hash = cache_hash_int(hash, node->pointer_depth);
+    hash = cache_hash_int(hash, node->array_length);
+    hash = cache_hash_text(hash, node->value);
+    if (node->symbol) {
+        hash = cache_hash_int(hash, node->symbol->kind);
+        hash = cache_hash_int(hash, node->symbol->array_length);
+        hash = cache_hash_int(hash, node->symbol->offset);
+        hash = cache_hash_int(hash, node->symbol->frame_size);
+    }
+    hash = cache_hash_int(hash, node->child_count);
+    for (int i = 0; i < node->child_count; i++) {
+        hash = hash_function_tree(hash, node->children[i]);
+    }
+    hash = hash_function_tree(hash, node->left);
+    return hash_function_tree(hash, node->right);
+}
+
+/* Functions are cached per set of code generation options. */
+static uint64_t function_key(struct codegen *gen, struct ast_node *node)
+{
+    uint64_t hash = cache_hash_text(0, CODEGEN_CACHE_VERSION);
+
+    hash = cache_hash_int(hash, gen->unit->options.optimize);
+    hash = cache_hash_int(hash, gen->unit->options.peephole_off & PEEPHOLE_ALL);
+    return hash_function_tree(hash, node);
+}
+
+/*
+ * A cached record is the function's per-rule peephole hit counts followed by
+ * its text, so a warm compile reports the same rewrites as a cold one. Finds
+ * the record for key, adds its counts to the generator's and returns the text.
+ */
+static const char *find_cached_function(struct codegen *gen, uint64_t key, int *hits, size_t *length)
+{
+    const char *cached = function_cache_find(gen->cache, key, length);
+
+    if (!cached || *length < sizeof(int) * PEEPHOLE_RULE_COUNT) {
+        return NULL;
+    }
+    memcpy(hits, cached, sizeof(int) * PEEPHOLE_RULE_COUNT);
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+        gen->peephole_hits[rule] += hits[rule];
+    }
+    *length -= sizeof(int) * PEEPHOLE_RULE_COUNT;
+    return cached + sizeof(int) * PEEPHOLE_RULE_COUNT;
+}
+
+static void cache_function(struct codegen *gen, uint64_t key, const int *hits, const char *text,
+    size_t length, int reused)
+{
+    gen->cache_record.length = 0;
+    emit_bytes(&gen->cache_record, (const char *)hits, sizeof(int) * PEEPHOLE_RULE_COUNT);
+    emit_bytes(&gen->cache_record, text, length);
+    function_cache_add(gen->cache, key, gen->cache_record.data, gen->cache_record.length, reused);
+}
+
+static void generate_cached_function(struct codegen *gen, struct ast_node *node)
+{
+    uint64_t key = function_key(gen, node);
+    struct emitter *output = gen->output;
+    int error_count = gen->error_count;
+    int hits[PEEPHOLE_RULE_COUNT];
+    size_t length;
+    const char *cached = find_cached_function(gen, key, hits, &length);
+
+    if (cached) {
+        emit_bytes(output, cached, length);
+        cache_function(gen, key, hits, cached, length, 1);
+        return;
+    }
+
+    memcpy(hits, gen->peephole_hits, sizeof(hits));
+    gen->function_output.length = 0;
+    gen->output = &gen->function_output;
+    generate_function_body(gen, node);
+    gen->output = output;
+    if (gen->error_count == error_count) {
+        for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+            hits[rule] = gen->peephole_hits[rule] - hits[rule];
         }
+        cache_function(gen, key, hits, gen->function_output.data, gen->function_output.length, 0);
     }
-    fprintf(output, ".text\n");
+    emit_bytes(output, gen->function_output.data, gen->function_output.length);
 }
 
-void generate_function(struct ast_node *node, FILE *output)
+static void generate_function(struct codegen *gen, struct ast_node *node)
 {
-    collect_params(node->left, 0);
-    collect_locals(node->right);
-    current_function_end_label = label_count++;
+    if (!node->symbol) {
+        codegen_error(gen, "Function '%s' was not checked\n", node->value);
+        return;
+    }
+    gen->function_name = node->value;
+    gen->label_count = 0;
+    gen->current_function_end_label = gen->label_count++;
 
-    fprintf(output, ".globl _%s\n", node->value);
-    fprintf(output, "_%s:\n", node->value);
-    fprintf(output, "    push    %%ebp\n");
-    fprintf(output, "    movl    %%esp, %%ebp\n");
-    if (local_stack_count > 0) {
-        fprintf(output, "    subl    $%d, %%esp\n", local_stack_count * 4);
+    if (gen->cache) {
+        generate_cached_function(gen, node);
+    } else {
+        generate_function_body(gen, node);
     }
-    generate_statement(node->right, output);
-    fprintf(output, "    movl    $0, %%eax\n");
-    fprintf(output, ".L%d:\n", current_function_end_label);
-    generate_epilogue(output);
-    free_locals();
 }
 
-void generate_program(struct ast_node *node, FILE *output)
+static void generate_top_level(struct codegen *gen, struct ast_node *node)
 {
     if (!node) {
         return;
@@ -488,26 +1034,26 @@ void generate_program(struct ast_node *node, FILE *output)
 
     switch (node->type) {
         case AST_PROGRAM:
-            collect_globals(node->left);
-            generate_globals(output);
-            generate_program(node->left, output);
+            collect_globals(gen, node->left);
+            generate_globals(gen);
+            generate_top_level(gen, node->left);
             break;
         case AST_FUNCTION_LIST:
-            generate_program(node->left, output);
-            generate_program(node->right, output);
+            for (int i = 0; i < node->child_count; i++) {
+                generate_top_level(gen, node->children[i]);
+            }
             break;
         case AST_FUNCTION:
-            generate_function(node, output);
+            generate_function(gen, node);
             break;
         case AST_GLOBAL_DECL:
             break;
         default:
-            fprintf(stderr, "Unsupported program node type: %d\n", node->type);
-            exit(1);
+            codegen_error(gen, "Unsupported program node type: %d\n", node->type);
     }
 }
 
-void generate_statement(struct ast_node *node, FILE *output)
+static void generate_statement(struct codegen *gen, struct ast_node *node)
 {
     if (!node) {
         return;
@@ -515,266 +1061,328 @@ void generate_statement(struct ast_node *node, FILE *output)
 
     switch (node->type) {
         case AST_BLOCK:
-            generate_statement(node->left, output);
+            generate_statement(gen, node->left);
             break;
         case AST_STATEMENT_LIST:
-            generate_statement(node->left, output);
-            generate_statement(node->right, output);
+            for (int i = 0; i < node->child_count; i++) {
+                generate_statement(gen, node->children[i]);
+            }
             break;
         case AST_DECL:
+            if (!node_symbol(gen, node)) {
+                break;
+            }
             if (node->array_length > 0) {
-                int offset = local_offset(node->value);
+                int offset = node->symbol->offset;
                 int index = 0;
                 struct ast_node *item;
 
-                for (item = initializer_items(node->left); item; item = item->right) {
-                    generate_exp(item->left, output);
-                    fprintf(output, "    movl    %%eax, %d(%%ebp)\n", offset + (index * 4));
+                while ((item = initializer_item(node->left, index)) != NULL) {
+                    generate_exp(gen, item);
+                    emit_insn2(gen->output, "movl", operand_register("eax"), operand_frame(offset + (index * 4)));
                     index++;
                 }
                 while (index < node->array_length) {
-                    fprintf(output, "    movl    $0, %d(%%ebp)\n", offset + (index * 4));
+                    emit_insn2(gen->output, "movl", operand_immediate(0), operand_frame(offset + (index * 4)));
                     index++;
                 }
+            } else if (node->left && node->left->type == AST_INTLIT) {
+                emit_insn2(gen->output, "movl", operand_immediate_text(node->left->value),
+                    local_operand(node->symbol, node->symbol->offset));
             } else if (node->left) {
-                generate_exp(node->left, output);
-                fprintf(output, "    movl    %%eax, %d(%%ebp)\n", local_offset(node->value));
+                generate_exp(gen, node->left);
+                emit_insn2(gen->output, "movl", operand_register("eax"), local_operand(node->symbol, node->symbol->offset));
             } else {
-                fprintf(output, "    movl    $0, %d(%%ebp)\n", local_offset(node->value));
+                emit_insn2(gen->output, "movl", operand_immediate(0), local_operand(node->symbol, node->symbol->offset));
             }
             break;
         case AST_EXPR_STMT:
-            generate_exp(node->left, output);
+            generate_exp(gen, node->left);
             break;
         case AST_RETURN:
-            generate_exp(node->left, output);
-            fprintf(output, "    jmp     .L%d\n", current_function_end_label);
+            generate_exp(gen, node->left);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, gen->current_function_end_label));
             break;
         case AST_IF: {
-            int else_label = label_count++;
-            int end_label = label_count++;
-
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    je      .L%d\n", else_label);
-            generate_statement(node->right->left, output);
-            fprintf(output, "    jmp     .L%d\n", end_label);
-            fprintf(output, ".L%d:\n", else_label);
+            int else_label = gen->label_count++;
+            int end_label = gen->label_count++;
+
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "je", operand_label(gen->function_name, else_label));
+            generate_statement(gen, node->right->left);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, end_label));
+            emit_label(gen->output, gen->function_name, else_label);
             if (node->right->right) {
-                generate_statement(node->right->right, output);
+                generate_statement(gen, node->right->right);
             }
-            fprintf(output, ".L%d:\n", end_label);
+            emit_label(gen->output, gen->function_name, end_label);
             break;
         }
         case AST_WHILE: {
-            int start_label = label_count++;
-            int end_label = label_count++;
-
-            push_loop(end_label, start_label);
-            fprintf(output, ".L%d:\n", start_label);
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    je      .L%d\n", end_label);
-            generate_statement(node->right, output);
-            fprintf(output, "    jmp     .L%d\n", start_label);
-            fprintf(output, ".L%d:\n", end_label);
-            pop_loop();
+            int start_label = gen->label_count++;
+            int end_label = gen->label_count++;
+
+            push_loop(gen, end_label, start_label);
+            emit_label(gen->output, gen->function_name, start_label);
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "je", operand_label(gen->function_name, end_label));
+            generate_statement(gen, node->right);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, start_label));
+            emit_label(gen->output, gen->function_name, end_label);
+            pop_loop(gen);
             break;
         }
         case AST_FOR: {
             struct ast_node *init = node->left->left;
             struct ast_node *cond = node->left->right->left;
             struct ast_node *post = node->left->right->right;
-            int start_label = label_count++;
-            int post_label = label_count++;
-            int end_label = label_count++;
+            int start_label = gen->label_count++;
+            int post_label = gen->label_count++;
+            int end_label = gen->label_count++;
 
             if (init) {
                 if (init->type == AST_DECL) {
-                    generate_statement(init, output);
+                    generate_statement(gen, init);
                 } else {
-                    generate_exp(init, output);
+                    generate_exp(gen, init);
                 }
             }
 
-            push_loop(end_label, post_label);
-            fprintf(output, ".L%d:\n", start_label);
+            push_loop(gen, end_label, post_label);
+            emit_label(gen->output, gen->function_name, start_label);
             if (cond) {
-                generate_exp(cond, output);
-                fprintf(output, "    cmpl    $0, %%eax\n");
-                fprintf(output, "    je      .L%d\n", end_label);
+                generate_exp(gen, cond);
+                emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+                emit_insn1(gen->output, "je", operand_label(gen->function_name, end_label));
             }
-            generate_statement(node->right, output);
-            fprintf(output, ".L%d:\n", post_label);
+            generate_statement(gen, node->right);
+            emit_label(gen->output, gen->function_name, post_label);
             if (post) {
-                generate_exp(post, output);
+                generate_exp(gen, post);
             }
-            fprintf(output, "    jmp     .L%d\n", start_label);
-            fprintf(output, ".L%d:\n", end_label);
-            pop_loop();
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, start_label));
+            emit_label(gen->output, gen->function_name, end_label);
+            pop_loop(gen);
             break;
         }
         case AST_BREAK:
-            if (loop_depth == 0) {
-                fprintf(stderr, "break used outside of loop\n");
-                exit(1);
+            if (gen->loop_depth == 0) {
+                codegen_error(gen, "break used outside of loop\n");
+                break;
             }
-            fprintf(output, "    jmp     .L%d\n", loop_break_labels[loop_depth - 1]);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, gen->loop_break_labels[gen->loop_depth - 1]));
             break;
         case AST_CONTINUE:
-            if (loop_depth == 0) {
-                fprintf(stderr, "continue used outside of loop\n");
-                exit(1);
+            if (gen->loop_depth == 0) {
+                codegen_error(gen, "continue used outside of loop\n");
+                break;
             }
-            fprintf(output, "    jmp     .L%d\n", loop_continue_labels[loop_depth - 1]);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, gen->loop_continue_labels[gen->loop_depth - 1]));
             break;
         default:
-            fprintf(stderr, "Unsupported statement node type: %d\n", node->type);
-            exit(1);
+            codegen_error(gen, "Unsupported statement node type: %d\n", node->type);
     }
 }
 
-void generate_binop(struct ast_node *node, FILE *output)
+/*
+ * Scales the integer operand of pointer arithmetic. One operand is in %eax
+ * and the other in register other; left_in_eax says which is the left.
+ */
+static void generate_pointer_arithmetic(struct codegen *gen, struct ast_node *node,
+    const char *other, int left_in_eax)
 {
-    int is_unsigned = is_unsigned_type(node->left->data_type);
-    int left_is_pointer = node->left->pointer_depth > 0 || node->left->array_length > 0;
-    int right_is_pointer = node->right->pointer_depth > 0 || node->right->array_length > 0;
-
-    if ((node->type == AST_ADD || node->type == AST_SUB) &&
-        (left_is_pointer || right_is_pointer)) {
-        generate_exp(node->left, output);
-        fprintf(output, "    push    %%eax\n");
-        generate_exp(node->right, output);
-        fprintf(output, "    pop     %%edx\n");
-
-        if (left_is_pointer && !right_is_pointer) {
-            fprintf(output, "    imull   $4, %%eax\n");
-            if (node->type == AST_ADD) {
-                fprintf(output, "    addl    %%edx, %%eax\n");
-            } else {
-                fprintf(output, "    subl    %%eax, %%edx\n");
-                fprintf(output, "    movl    %%edx, %%eax\n");
-            }
-            return;
-        }
-        if (right_is_pointer && !left_is_pointer && node->type == AST_ADD) {
-            fprintf(output, "    imull   $4, %%edx\n");
-            fprintf(output, "    addl    %%edx, %%eax\n");
-            return;
-        }
+    const char *integer = is_pointer_value(node->left) == left_in_eax ? other : "eax";
+    const char *pointer = integer == other ? "eax" : other;
+
+    if (node->type == AST_ADD) {
+        emit_insn2(gen->output, "leal", operand_memory(NULL, 0, pointer, integer, 4), operand_register("eax"));
+        return;
+    }
+    emit_insn2(gen->output, "imull", operand_immediate(4), operand_register(integer));
+    if (left_in_eax) {
+        emit_insn2(gen->output, "subl", operand_register(other), operand_register("eax"));
+    } else {
+        emit_insn2(gen->output, "subl", operand_register("eax"), operand_register(other));
+        emit_insn2(gen->output, "movl", operand_register(other), operand_register("eax"));
     }
+}
 
-    generate_exp(node->left, output);
-    fprintf(output, "    push    %%eax\n");
+static const char *comparison_set(ASTNodeType type, int is_unsigned)
+{
+    switch (type) {
+        case AST_EQUAL: return "sete";
+        case AST_NOT_EQUAL: return "setne";
+        case AST_LESS: return is_unsigned ? "setb" : "setl";
+        case AST_LESS_EQUAL: return is_unsigned ? "setbe" : "setle";
+        case AST_GREATER: return is_unsigned ? "seta" : "setg";
+        default: return is_unsigned ? "setae" : "setge";
+    }
+}
 
-    generate_exp(node->right, output);
-    fprintf(output, "    pop     %%edx\n");
+/*
+ * Applies a binary operator to %eax and other, leaving the result in %eax.
+ * If left_in_eax is set, %eax holds the left operand and other the right;
+ * otherwise other is a register holding the left operand.
+ */
+static void generate_combination(struct codegen *gen, struct ast_node *node,
+    struct operand other, int left_in_eax)
+{
+    int is_unsigned = is_unsigned_type(node->left->data_type);
 
     switch (node->type) {
         case AST_ADD:
-            fprintf(output, "    addl    %%edx, %%eax\n");
-            break;
-        case AST_SUB:
-            fprintf(output, "    subl    %%eax, %%edx\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            break;
+            emit_insn2(gen->output, "addl", other, operand_register("eax"));
+            return;
         case AST_MUL:
-            fprintf(output, "    imull   %%edx, %%eax\n");
-            break;
-        case AST_DIV:
-            fprintf(output, "    push    %%eax\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            fprintf(output, "    pop     %%ecx\n");
-            if (is_unsigned) {
-                fprintf(output, "    xorl    %%edx, %%edx\n");
-                fprintf(output, "    divl    %%ecx\n");
-            } else {
-                fprintf(output, "    cdq\n");
-                fprintf(output, "    idivl   %%ecx\n");
-            }
-            break;
-        case AST_MOD:
-            fprintf(output, "    push    %%eax\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            fprintf(output, "    pop     %%ecx\n");
-            if (is_unsigned) {
-                fprintf(output, "    xorl    %%edx, %%edx\n");
-                fprintf(output, "    divl    %%ecx\n");
-            } else {
-                fprintf(output, "    cdq\n");
-                fprintf(output, "    idivl   %%ecx\n");
-            }
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            break;
-        case AST_SHIFT_LEFT:
-            fprintf(output, "    movl    %%eax, %%ecx\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            fprintf(output, "    sall    %%cl, %%eax\n");
-            break;
-        case AST_SHIFT_RIGHT:
-            fprintf(output, "    movl    %%eax, %%ecx\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
-            fprintf(output, is_unsigned ? "    shrl    %%cl, %%eax\n" : "    sarl    %%cl, %%eax\n");
-            break;
+            emit_insn2(gen->output, "imull", other, operand_register("eax"));
+            return;
         case AST_BITWISE_AND:
-            fprintf(output, "    andl    %%edx, %%eax\n");
-            break;
+            emit_insn2(gen->output, "andl", other, operand_register("eax"));
+            return;
         case AST_BITWISE_OR:
-            fprintf(output, "    orl     %%edx, %%eax\n");
-            break;
+            emit_insn2(gen->output, "orl", other, operand_register("eax"));
+            return;
         case AST_BITWISE_XOR:
-            fprintf(output, "    xorl    %%edx, %%eax\n");
-            break;
+            emit_insn2(gen->output, "xorl", other, operand_register("eax"));
+            return;
+        case AST_SUB:
+            if (left_in_eax) {
+                emit_insn2(gen->output, "subl", other, operand_register("eax"));
+            } else {
+                emit_insn2(gen->output, "subl", operand_register("eax"), other);
+                emit_insn2(gen->output, "movl", other, operand_register("eax"));
+            }
+            return;
         case AST_EQUAL:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, "    sete    %%al\n");
-            break;
         case AST_NOT_EQUAL:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, "    setne   %%al\n");
-            break;
         case AST_LESS:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, is_unsigned ? "    setb    %%al\n" : "    setl    %%al\n");
-            break;
         case AST_LESS_EQUAL:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, is_unsigned ? "    setbe   %%al\n" : "    setle   %%al\n");
-            break;
         case AST_GREATER:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, is_unsigned ? "    seta    %%al\n" : "    setg    %%al\n");
-            break;
         case AST_GREATER_EQUAL:
-            fprintf(output, "    cmpl    %%eax, %%edx\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, is_unsigned ? "    setae   %%al\n" : "    setge   %%al\n");
+            if (left_in_eax) {
+                emit_insn2(gen->output, "cmpl", other, operand_register("eax"));
+            } else {
+                emit_insn2(gen->output, "cmpl", operand_register("eax"), other);
+            }
+            emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, comparison_set(node->type, is_unsigned), operand_register("al"));
+            return;
+        case AST_DIV:
+        case AST_MOD:
+        case AST_SHIFT_LEFT:
+        case AST_SHIFT_RIGHT:
             break;
         default:
-            fprintf(stderr, "Unsupported operation in AST\n");
-            exit(1);
+            codegen_error(gen, "Unsupported operation in AST\n");
+            return;
+    }
+
+    /* The rest want the left operand in %eax and the right one in %ecx. */
+    if (!left_in_eax) {
+        if (strcmp(other.text, "ecx") == 0) {
+            emit_insn2(gen->output, "xchgl", operand_register("ecx"), operand_register("eax"));
+        } else {
+            emit_insn2(gen->output, "movl", operand_register("eax"), operand_register("ecx"));
+            emit_insn2(gen->output, "movl", other, operand_register("eax"));
+        }
+    } else if (other.kind != OPERAND_REGISTER || strcmp(other.text, "ecx") != 0) {
+        emit_insn2(gen->output, "movl", other, operand_register("ecx"));
+    }
+
+    switch (node->type) {
+        case AST_DIV:
+        case AST_MOD:
+            if (is_unsigned) {
+                emit_insn2(gen->output, "xorl", operand_register("edx"), operand_register("edx"));
+                emit_insn1(gen->output, "divl", operand_register("ecx"));
+            } else {
+                emit_insn0(gen->output, "cdq");
+                emit_insn1(gen->output, "idivl", operand_register("ecx"));
+            }
+            if (node->type == AST_MOD) {
+                emit_insn2(gen->output, "movl", operand_register("edx"), operand_register("eax"));
+            }
+            break;
+        case AST_SHIFT_LEFT:
+            emit_insn2(gen->output, "sall", operand_register("cl"), operand_register("eax"));
+            break;
+        default:
+            emit_insn2(gen->output, is_unsigned ? "shrl" : "sarl", operand_register("cl"), operand_register("eax"));
+            break;
     }
 }
 
-void generate_exp(struct ast_node *node, FILE *output)
+static void generate_binop(struct codegen *gen, struct ast_node *node)
+{
+    int pointer_arithmetic = is_pointer_arithmetic(node);
+    int left_in_eax = 0;
+    const char *other;
+    int hold;
+
+    if (is_element_sum(node)) {
+        generate_address(gen, generate_element(gen, node->left, node->right));
+        return;
+    }
+    if (node->type == AST_SUB && is_pointer_value(node->left) && node->right->type == AST_INTLIT) {
+        generate_exp(gen, node->left);
+        if (atoi(node->right->value) != 0) {
+            emit_insn2(gen->output, "subl", operand_immediate(4 * atoi(node->right->value)), operand_register("eax"));
+        }
+        return;
+    }
+    if (!pointer_arithmetic && is_direct_operand(node->right)) {
+        generate_exp(gen, node->left);
+        generate_combination(gen, node, direct_operand(node->right), 1);
+        return;
+    }
+    if (!pointer_arithmetic && can_read_left_last(node)) {
+        generate_exp(gen, node->right);
+        if (is_commutative(node->type)) {
+            generate_combination(gen, node, direct_operand(node->left), 1);
+            return;
+        }
+        emit_insn2(gen->output, "movl", operand_register("eax"), operand_register("edx"));
+        emit_insn2(gen->output, "movl", direct_operand(node->left), operand_register("eax"));
+        generate_combination(gen, node, operand_register("edx"), 1);
+        return;
+    }
+
+    if (is_pure(node->left) && is_pure(node->right) &&
+        (expression_label(node->right) & LABEL_NEED) > (expression_label(node->left) & LABEL_NEED)) {
+        generate_exp(gen, node->right);
+        hold = hold_eax(gen, clobbers(expression_label(node->left)));
+        generate_exp(gen, node->left);
+        left_in_eax = 1;
+    } else {
+        generate_exp(gen, node->left);
+        hold = hold_eax(gen, clobbers(expression_label(node->right)));
+        generate_exp(gen, node->right);
+    }
+    other = release_hold(gen, hold);
+
+    if (pointer_arithmetic && is_pointer_value(node->left) != is_pointer_value(node->right)) {
+        generate_pointer_arithmetic(gen, node, other, left_in_eax);
+        return;
+    }
+    generate_combination(gen, node, operand_register(other), left_in_eax);
+}
+
+static void generate_exp(struct codegen *gen, struct ast_node *node)
 {
     switch (node->type) {
         case AST_INTLIT:
-            fprintf(output, "    movl    $%s, %%eax\n", node->value);
+            emit_insn2(gen->output, "movl", operand_immediate_text(node->value), operand_register("eax"));
             break;
         case AST_IDENTIFIER:
-            generate_identifier_load(node->value, output);
+            generate_identifier_load(gen, node);
             break;
         case AST_CALL: {
-            int arg_count = generate_call_args(node->left, output);
-            fprintf(output, "    call    _%s\n", node->value);
+            int arg_count = generate_call_args(gen, node->left);
+            emit_insn1(gen->output, "call", operand_symbol(node->value));
             if (arg_count > 0) {
-                fprintf(output, "    addl    $%d, %%esp\n", arg_count * 4);
+                emit_insn2(gen->output, "addl", operand_immediate(arg_count * 4), operand_register("esp"));
             }
             break;
         }
@@ -794,188 +1402,359 @@ void generate_exp(struct ast_node *node, FILE *output)
         case AST_LESS_EQUAL:
         case AST_GREATER:
         case AST_GREATER_EQUAL:
-            generate_binop(node, output);
+            generate_binop(gen, node);
             break;
         case AST_CONDITIONAL: {
-            int else_label = label_count++;
-            int end_label = label_count++;
-
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    je      .L%d\n", else_label);
-            generate_exp(node->right->left, output);
-            fprintf(output, "    jmp     .L%d\n", end_label);
-            fprintf(output, ".L%d:\n", else_label);
-            generate_exp(node->right->right, output);
-            fprintf(output, ".L%d:\n", end_label);
+            int else_label = gen->label_count++;
+            int end_label = gen->label_count++;
+
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "je", operand_label(gen->function_name, else_label));
+            generate_exp(gen, node->right->left);
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, end_label));
+            emit_label(gen->output, gen->function_name, else_label);
+            generate_exp(gen, node->right->right);
+            emit_label(gen->output, gen->function_name, end_label);
             break;
         }
         case AST_COMMA:
-            generate_exp(node->left, output);
-            generate_exp(node->right, output);
+            generate_exp(gen, node->left);
+            generate_exp(gen, node->right);
             break;
         case AST_LOGICAL_AND: {
-            int false_label = label_count++;
-            int end_label = label_count++;
-
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    je      .L%d\n", false_label);
-            generate_exp(node->right, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    je      .L%d\n", false_label);
-            fprintf(output, "    movl    $1, %%eax\n");
-            fprintf(output, "    jmp     .L%d\n", end_label);
-            fprintf(output, ".L%d:\n", false_label);
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, ".L%d:\n", end_label);
+            int false_label = gen->label_count++;
+            int end_label = gen->label_count++;
+
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "je", operand_label(gen->function_name, false_label));
+            generate_exp(gen, node->right);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "je", operand_label(gen->function_name, false_label));
+            emit_insn2(gen->output, "movl", operand_immediate(1), operand_register("eax"));
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, end_label));
+            emit_label(gen->output, gen->function_name, false_label);
+            emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+            emit_label(gen->output, gen->function_name, end_label);
             break;
         }
         case AST_LOGICAL_OR: {
-            int true_label = label_count++;
-            int end_label = label_count++;
-
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    jne     .L%d\n", true_label);
-            generate_exp(node->right, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    jne     .L%d\n", true_label);
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, "    jmp     .L%d\n", end_label);
-            fprintf(output, ".L%d:\n", true_label);
-            fprintf(output, "    movl    $1, %%eax\n");
-            fprintf(output, ".L%d:\n", end_label);
+            int true_label = gen->label_count++;
+            int end_label = gen->label_count++;
+
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "jne", operand_label(gen->function_name, true_label));
+            generate_exp(gen, node->right);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "jne", operand_label(gen->function_name, true_label));
+            emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "jmp", operand_label(gen->function_name, end_label));
+            emit_label(gen->output, gen->function_name, true_label);
+            emit_insn2(gen->output, "movl", operand_immediate(1), operand_register("eax"));
+            emit_label(gen->output, gen->function_name, end_label);
             break;
         }
-        case AST_ASSIGN:
-            generate_exp(node->right, output);
-            fprintf(output, "    push    %%eax\n");
-            generate_lvalue_address(node->left, output);
-            fprintf(output, "    pop     %%edx\n");
-            fprintf(output, "    movl    %%edx, (%%eax)\n");
-            fprintf(output, "    movl    %%edx, %%eax\n");
+        case AST_ASSIGN: {
+            struct operand target;
+            const char *value;
+            int hold;
+
+            generate_exp(gen, node->right);
+            if (node->left->type == AST_IDENTIFIER) {
+                generate_identifier_store(gen, node->left);
+                break;
+            }
+            hold = hold_eax(gen, clobbers(address_label(node->left)));
+            if (hold < 0) {
+                /* The value is on the stack; compute the address before popping it. */
+                generate_lvalue_address(gen, node->left);
+                target = operand_indirect("eax");
+            } else {
+                target = generate_target(gen, node->left);
+            }
+            value = release_hold(gen, hold);
+            emit_insn2(gen->output, "movl", operand_register(value), target);
+            emit_insn2(gen->output, "movl", operand_register(value), operand_register("eax"));
             break;
+        }
         case AST_ADDRESS_OF:
-            generate_lvalue_address(node->left, output);
+            generate_lvalue_address(gen, node->left);
             break;
         case AST_DEREFERENCE:
-            generate_exp(node->left, output);
-            fprintf(output, "    movl    (%%eax), %%eax\n");
-            break;
         case AST_ARRAY_SUBSCRIPT:
-            generate_lvalue_address(node, output);
-            fprintf(output, "    movl    (%%eax), %%eax\n");
+            emit_insn2(gen->output, "movl", generate_target(gen, node), operand_register("eax"));
             break;
         case AST_PRE_INCREMENT:
-            generate_identifier_load(node->left->value, output);
-            fprintf(output, "    addl    $%d, %%eax\n", node->pointer_depth > 0 ? 4 : 1);
-            generate_cast(codegen_type_name(node->data_type), output);
-            generate_identifier_store(node->left->value, output);
+            generate_identifier_load(gen, node->left);
+            emit_insn2(gen->output, "addl", operand_immediate(node->pointer_depth > 0 ? 4 : 1), operand_register("eax"));
+            generate_cast(gen, codegen_type_name(node->data_type));
+            generate_identifier_store(gen, node->left);
             break;
         case AST_PRE_DECREMENT:
-            generate_identifier_load(node->left->value, output);
-            fprintf(output, "    subl    $%d, %%eax\n", node->pointer_depth > 0 ? 4 : 1);
-            generate_cast(codegen_type_name(node->data_type), output);
-            generate_identifier_store(node->left->value, output);
+            generate_identifier_load(gen, node->left);
+            emit_insn2(gen->output, "subl", operand_immediate(node->pointer_depth > 0 ? 4 : 1), operand_register("eax"));
+            generate_cast(gen, codegen_type_name(node->data_type));
+            generate_identifier_store(gen, node->left);
             break;
         case AST_POST_INCREMENT:
-            generate_identifier_load(node->left->value, output);
-            fprintf(output, "    push    %%eax\n");
-            fprintf(output, "    addl    $%d, %%eax\n", node->pointer_depth > 0 ? 4 : 1);
-            generate_cast(codegen_type_name(node->data_type), output);
-            generate_identifier_store(node->left->value, output);
-            fprintf(output, "    pop     %%eax\n");
+            generate_identifier_load(gen, node->left);
+            emit_insn2(gen->output, "movl", operand_register("eax"), operand_register("edx"));
+            emit_insn2(gen->output, "addl", operand_immediate(node->pointer_depth > 0 ? 4 : 1), operand_register("eax"));
+            generate_cast(gen, codegen_type_name(node->data_type));
+            generate_identifier_store(gen, node->left);
+            emit_insn2(gen->output, "movl", operand_register("edx"), operand_register("eax"));
             break;
         case AST_POST_DECREMENT:
-            generate_identifier_load(node->left->value, output);
-            fprintf(output, "    push    %%eax\n");
-            fprintf(output, "    subl    $%d, %%eax\n", node->pointer_depth > 0 ? 4 : 1);
-            generate_cast(codegen_type_name(node->data_type), output);
-            generate_identifier_store(node->left->value, output);
-            fprintf(output, "    pop     %%eax\n");
+            generate_identifier_load(gen, node->left);
+            emit_insn2(gen->output, "movl", operand_register("eax"), operand_register("edx"));
+            emit_insn2(gen->output, "subl", operand_immediate(node->pointer_depth > 0 ? 4 : 1), operand_register("eax"));
+            generate_cast(gen, codegen_type_name(node->data_type));
+            generate_identifier_store(gen, node->left);
+            emit_insn2(gen->output, "movl", operand_register("edx"), operand_register("eax"));
             break;
         case AST_SIZEOF:
-            fprintf(output, "    movl    $%d, %%eax\n", type_size(node->value));
+            emit_insn2(gen->output, "movl", operand_immediate(type_size(node->value)), operand_register("eax"));
             break;
         case AST_CAST:
-            generate_exp(node->left, output);
-            generate_cast(node->value, output);
+            generate_exp(gen, node->left);
+            generate_cast(gen, node->value);
             break;
         case AST_NEGATION:
-            generate_exp(node->left, output);
-            fprintf(output, "    negl    %%eax\n");
+            generate_exp(gen, node->left);
+            emit_insn1(gen->output, "negl", operand_register("eax"));
             break;
         case AST_BITWISE_COMPLEMENT:
-            generate_exp(node->left, output);
-            fprintf(output, "    notl    %%eax\n");
+            generate_exp(gen, node->left);
+            emit_insn1(gen->output, "notl", operand_register("eax"));
             break;
         case AST_LOGICAL_NEGATION:
-            generate_exp(node->left, output);
-            fprintf(output, "    cmpl    $0, %%eax\n");
-            fprintf(output, "    movl    $0, %%eax\n");
-            fprintf(output, "    sete    %%al\n");
+            generate_exp(gen, node->left);
+            emit_insn2(gen->output, "cmpl", operand_immediate(0), operand_register("eax"));
+            emit_insn2(gen->output, "movl", operand_immediate(0), operand_register("eax"));
+            emit_insn1(gen->output, "sete", operand_register("al"));
             break;
         default:
-            fprintf(stderr, "Unsupported AST node type: %d\n", node->type);
-            exit(1);
+            codegen_error(gen, "Unsupported AST node type: %d\n", node->type);
     }
 }
 
-int generate_call_args(struct ast_node *node, FILE *output)
+/* Pushes the arguments right to left and returns how many there were. */
+static int generate_call_args(struct codegen *gen, struct ast_node *node)
 {
-    if (!node) {
+    if (node->type != AST_ARG_LIST) {
+        codegen_error(gen, "Unsupported argument node type: %d\n", node->type);
         return 0;
     }
 
-    if (node->type != AST_ARG_LIST) {
-        fprintf(stderr, "Unsupported argument node type: %d\n", node->type);
-        exit(1);
+    for (int i = node->child_count - 1; i >= 0; i--) {
+        generate_exp(gen, node->children[i]);
+        emit_insn1(gen->output, "push", operand_register("eax"));
     }
 
-    int count = generate_call_args(node->right, output);
-    generate_exp(node->left, output);
-    fprintf(output, "    push    %%eax\n");
-
-    return count + 1;
+    return node->child_count;
 }
 
-char* generate(struct ast_node *ast)
+struct codegen *codegen_create(struct compilation *unit, struct emitter *output)
 {
-    FILE *output = fopen("donkey_generate.tmp", "w+");
-    if (output == NULL) {
-        perror("Failed to create temporary file for assembly generation");
+    struct codegen *gen = calloc(1, sizeof(*gen));
+
+    if (!gen) {
+        perror("Error allocating code generator");
         exit(EXIT_FAILURE);
     }
+    gen->unit = unit;
+    gen->output = output;
+    gen->diagnostics = &unit->diagnostics;
+    gen->hold_pool = HOLD_SCRATCH;
+    gen->peephole_hits = unit->stats.peephole_hits;
+    emitter_init(&gen->function_output, NULL);
+    emitter_init(&gen->body_output, NULL);
+    emitter_record(&gen->body_output);
+    emitter_init(&gen->insn_output, NULL);
+    emitter_record(&gen->insn_output);
+    emitter_init(&gen->cache_record, NULL);
+    if (unit->options.cache_dir) {
+        gen->cache = malloc(sizeof(*gen->cache));
+        if (!gen->cache) {
+            perror("Error allocating function cache");
+            exit(EXIT_FAILURE);
+        }
+        function_cache_open(gen->cache, unit->options.cache_dir, unit->source_path);
+    }
+    return gen;
+}
+
+/*
+ * Releases the generator and returns 1 if everything it emitted is usable.
+ * keep says whether the caller keeps the output; the cache is only updated then.
+ */
+int codegen_destroy(struct codegen *gen, int keep)
+{
+    int ok = gen->error_count == 0;
+
+    if (gen->cache && !gen->parent) {
+        function_cache_close(gen->cache, ok && keep);
+        free(gen->cache);
+    }
+    free(gen->globals);
+    free(gen->loop_break_labels);
+    free(gen->loop_continue_labels);
+    emitter_release(&gen->function_output);
+    emitter_release(&gen->body_output);
+    emitter_release(&gen->insn_output);
+    emitter_release(&gen->cache_record);
+    free(gen);
+    return ok;
+}
 
-    generate_program(ast, output);
-    rewind(output);
-    fseek(output, 0, SEEK_END);
-    long size = ftell(output);
-    rewind(output);
+/*
+ * Streaming compiles emit a program piecewise: every global is added and
+ * codegen_emit_globals() writes the data section before the functions are
+ * emitted one by one, which yields the same output as generate_program().
+ */
+void codegen_add_global(struct codegen *gen, struct ast_node *declaration)
+{
+    add_global_node(gen, declaration);
+}
 
-    char *assembly = malloc(size + 1);
-    if (assembly == NULL) {
-        perror("Failed to allocate memory for assembly string");
+void codegen_emit_globals(struct codegen *gen)
+{
+    generate_globals(gen);
+}
+
+void codegen_emit_function(struct codegen *gen, struct ast_node *function)
+{
+    generate_function(gen, function);
+}
+
+/*
+ * Makes a generator that emits functions into separate buffers, for use on
+ * another thread. It shares the parent's cache, which is only read until
+ * codegen_merge() records the results.
+ */
+struct codegen *codegen_fork(struct codegen *gen)
+{
+    struct codegen *fork = calloc(1, sizeof(*fork));
+
+    if (!fork) {
+        perror("Error allocating code generator");
         exit(EXIT_FAILURE);
     }
+    fork->unit = gen->unit;
+    fork->parent = gen;
+    fork->cache = gen->cache;
+    fork->hold_pool = HOLD_SCRATCH;
+    emitter_init(&fork->function_output, NULL);
+    emitter_init(&fork->body_output, NULL);
+    emitter_record(&fork->body_output);
+    emitter_init(&fork->insn_output, NULL);
+    emitter_record(&fork->insn_output);
+    emitter_init(&fork->cache_record, NULL);
+    return fork;
+}
 
-    fread(assembly, 1, size, output);
-    assembly[size] = '\0';
+/* Generates one checked function on a fork, keeping its text and diagnostics in result. */
+void codegen_function_into(struct codegen *fork, struct ast_node *function,
+    struct function_result *result)
+{
+    emitter_init(&result->output, NULL);
+    emitter_init(&result->errors, NULL);
+    fork->output = &result->output;
+    fork->diagnostics = &result->errors;
+    fork->error_count = 0;
+    fork->peephole_hits = result->peephole_hits;
+    memset(result->peephole_hits, 0, sizeof(result->peephole_hits));
+    result->key = 0;
+    result->reused = 0;
+
+    if (!function->symbol) {
+        codegen_error(fork, "Function '%s' was not checked\n", function->value);
+    } else {
+        const char *cached = NULL;
+        int hits[PEEPHOLE_RULE_COUNT];
+        size_t length;
+
+        fork->function_name = function->value;
+        fork->label_count = 0;
+        fork->current_function_end_label = fork->label_count++;
+        if (fork->cache) {
+            result->key = function_key(fork, function);
+            cached = find_cached_function(fork, result->key, hits, &length);
+        }
+        if (cached) {
+            emit_bytes(&result->output, cached, length);
+            result->reused = 1;
+        } else {
+            generate_function_body(fork, function);
+        }
+    }
+    result->error_count = fork->error_count;
+    fork->output = NULL;
+    fork->diagnostics = NULL;
+    fork->peephole_hits = NULL;
+}
 
-    fclose(output);
-    remove("donkey_generate.tmp");
-    return assembly;
+/*
+ * Appends a fork's result as if gen had emitted the function itself. Merging
+ * results in source order reproduces a serial compile, cache pack included.
+ */
+void codegen_merge(struct codegen *gen, struct function_result *result)
+{
+    emitter_append(gen->output, &result->output);
+    if (gen->cache && result->error_count == 0) {
+        cache_function(gen, result->key, result->peephole_hits, result->output.data, result->output.length,
+            result->reused);
+    }
+    emitter_append(gen->diagnostics, &result->errors);
+    gen->error_count += result->error_count;
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+        gen->peephole_hits[rule] += result->peephole_hits[rule];
+    }
+    emitter_release(&result->output);
+    emitter_release(&result->errors);
 }
 
-void write_assembly_to_file(const char *filename, struct ast_node *ast)
+int generate_program(struct compilation *unit, struct ast_node *node, struct emitter *output)
 {
+    struct codegen *gen = codegen_create(unit, output);
+
+    generate_top_level(gen, node);
+    return codegen_destroy(gen, 1);
+}
+
+char* generate(struct compilation *unit, struct ast_node *ast)
+{
+    struct emitter emitter;
+
+    emitter_init(&emitter, NULL);
+    if (!generate_program(unit, ast, &emitter)) {
+        emitter_release(&emitter);
+        return NULL;
+    }
+    return emitter_take(&emitter);
+}
+
+int write_assembly_to_file(struct compilation *unit, const char *filename, struct ast_node *ast)
+{
+    struct emitter emitter;
     FILE *out_file = fopen(filename, "w");
+    int ok;
+
     if (!out_file) {
-        perror("Failed to open file for writing");
-        exit(EXIT_FAILURE);
+        compilation_diagnostic(unit, "Failed to open %s for writing: %s\n", filename, strerror(errno));
+        return 0;
     }
 
-    generate_program(ast, out_file);
+    emitter_init(&emitter, out_file);
+    ok = generate_program(unit, ast, &emitter);
+    emitter_flush(&emitter);
+    unit->stats.bytes_emitted = emitter.flushed;
+    emitter_release(&emitter);
     fclose(out_file);
+    if (!ok) {
+        remove(filename);
+    }
+    return ok;
 }
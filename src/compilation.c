@@ -0,0 +1,124 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+void compilation_init(struct compilation *unit, const char *source_path)
+{
+    memset(unit, 0, sizeof(*unit));
+    unit->source_path = source_path;
+    emitter_init(&unit->diagnostics, NULL);
+}
+
+/* Releases everything the unit owns except its diagnostics. */
+void compilation_release(struct compilation *unit)
+{
+    arena_free(&unit->ast_arena);
+    unit->ast = NULL;
+    free_tokens(unit->tokens);
+    unit->tokens = NULL;
+    unit->token_count = 0;
+    unit->token_capacity = 0;
+    free(unit->list_items);
+    unit->list_items = NULL;
+    unit->list_item_count = 0;
+    unit->list_item_capacity = 0;
+    free_intern_table(&unit->strings);
+    if (unit->source.data) {
+        release_source_file(&unit->source);
+    }
+}
+
+/*
+ * Empties the unit for another compilation while keeping its token buffer,
+ * string table and arena blocks, so a long-lived unit stops allocating once
+ * it has seen its largest input.
+ */
+void compilation_reset(struct compilation *unit, const char *source_path)
+{
+    unit->source_path = source_path;
+    arena_reset(&unit->ast_arena);
+    unit->ast = NULL;
+    unit->token_count = 0;
+    unit->list_item_count = 0;
+    reset_intern_table(&unit->strings);
+    if (unit->source.data) {
+        release_source_file(&unit->source);
+    }
+    unit->diagnostics.length = 0;
+    memset(&unit->stats, 0, sizeof(unit->stats));
+}
+
+void compilation_vdiagnostic(struct compilation *unit, const char *format, va_list args)
+{
+    emit_vformat(&unit->diagnostics, format, args);
+}
+
+void compilation_diagnostic(struct compilation *unit, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    compilation_vdiagnostic(unit, format, args);
+    va_end(args);
+}
+
+/* Abandons the unit after a fatal error; compile_unit() picks up from here. */
+void compilation_fail(struct compilation *unit)
+{
+    longjmp(unit->fatal, 1);
+}
+
+/*
+ * Options that change the generated code, which is what a compile server
+ * or a library caller has to agree on with a local compile. Returns 1 if
+ * argument is one of them and was applied, 0 if it is some other argument,
+ * and -1 if it names no peephole rule.
+ */
+int parse_codegen_option(struct compile_options *options, const char *argument)
+{
+    int rule;
+
+    if (strcmp(argument, "-O") == 0 || strcmp(argument, "-O1") == 0) {
+        options->optimize = 1;
+    } else if (strcmp(argument, "-O0") == 0) {
+        options->optimize = 0;
+    } else if (strcmp(argument, "-fpeephole") == 0) {
+        options->peephole_off = 0;
+    } else if (strcmp(argument, "-fno-peephole") == 0) {
+        options->peephole_off = PEEPHOLE_ALL;
+    } else if (strncmp(argument, "-fno-peephole=", 14) == 0) {
+        rule = peephole_rule_index(argument + 14);
+        if (rule < 0) {
+            return -1;
+        }
+        options->peephole_off |= 1 << rule;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Writes the options parse_codegen_option() understands, space-separated, so that they reproduce options. */
+void format_codegen_options(struct emitter *out, const struct compile_options *options)
+{
+    int peephole_off = options->peephole_off & PEEPHOLE_ALL;
+    const char *separator = "";
+
+    if (options->optimize) {
+        emit_text(out, "-O");
+        separator = " ";
+    }
+    if (peephole_off == PEEPHOLE_ALL) {
+        emit_format(out, "%s-fno-peephole", separator);
+        return;
+    }
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+        if (peephole_off & (1 << rule)) {
+            emit_format(out, "%s-fno-peephole=%s", separator, peephole_rule_name(rule));
+            separator = " ";
+        }
+    }
+}
@@ -0,0 +1,350 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Appends any requested reports to the unit's diagnostics and releases the rest of it. */
+static void finish_unit(struct compilation *unit)
+{
+    if (unit->options.time_report) {
+        stats_time_report(&unit->diagnostics, unit->source_path, &unit->stats);
+    }
+    if (unit->options.mem_report) {
+        stats_mem_report(&unit->diagnostics, unit->source_path, &unit->stats);
+    }
+    if (unit->options.peephole_report) {
+        stats_peephole_report(&unit->diagnostics, unit->source_path, &unit->stats);
+    }
+    compilation_release(unit);
+}
+
+/*
+ * Runs the whole pipeline for one translation unit and writes its assembly
+ * to output_path. Returns 1 on success. Diagnostics and statistics are left
+ * in the unit either way; everything else it owns has been released on return.
+ */
+int compile_unit(struct compilation *unit, const char *output_path)
+{
+    int ok;
+
+    if (setjmp(unit->fatal)) {
+        finish_unit(unit);
+        return 0;
+    }
+
+    if (!load_source_file(unit->source_path, &unit->source)) {
+        compilation_diagnostic(unit, "Error opening file %s: %s\n", unit->source_path, strerror(errno));
+        return 0;
+    }
+    if (unit->options.stream) {
+        ok = compile_stream(unit, output_path);
+        finish_unit(unit);
+        return ok;
+    }
+
+    stats_phase_begin(unit);
+    lex(unit, unit->source.data, unit->source.length);
+    stats_phase_end(unit, PHASE_LEX);
+    unit->stats.token_count = unit->token_count;
+
+    stats_phase_begin(unit);
+    unit->ast = parse_program(unit);
+    stats_phase_end(unit, PHASE_PARSE);
+
+    if (unit->options.function_jobs > 1) {
+        ok = compile_parallel(unit, output_path);
+        finish_unit(unit);
+        return ok;
+    }
+
+    ok = semantic_analyze(unit, unit->ast);
+    if (ok) {
+        stats_phase_begin(unit);
+        ok = write_assembly_to_file(unit, output_path, unit->ast);
+        stats_phase_end(unit, PHASE_CODEGEN);
+    }
+
+    finish_unit(unit);
+    return ok;
+}
+
+/*
+ * Batch mode: workers pull the next input off a shared counter and compile it
+ * into its own unit. Diagnostics are kept per input and printed in command
+ * line order once every worker is done, so the output does not depend on
+ * scheduling.
+ */
+struct batch_job {
+    const char *input;
+    char *output;
+    char *diagnostics;
+    size_t diagnostics_length;
+    struct compile_stats stats;
+    int ok;
+};
+
+struct batch {
+    struct batch_job *jobs;
+    int job_count;
+    int next_job;
+    const struct compile_options *options;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static int take_job(struct batch *batch)
+{
+    int index;
+
+#ifdef _WIN32
+    EnterCriticalSection(&batch->lock);
+    index = batch->next_job++;
+    LeaveCriticalSection(&batch->lock);
+#else
+    pthread_mutex_lock(&batch->lock);
+    index = batch->next_job++;
+    pthread_mutex_unlock(&batch->lock);
+#endif
+    return index;
+}
+
+static void run_batch_worker(struct batch *batch)
+{
+    int index;
+
+    while ((index = take_job(batch)) < batch->job_count) {
+        struct batch_job *job = &batch->jobs[index];
+        struct compilation unit;
+
+        compilation_init(&unit, job->input);
+        unit.options = *batch->options;
+        job->ok = compile_unit(&unit, job->output);
+        job->stats = unit.stats;
+        job->diagnostics_length = unit.diagnostics.length;
+        job->diagnostics = emitter_take(&unit.diagnostics);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI batch_worker_main(LPVOID argument)
+{
+    run_batch_worker(argument);
+    return 0;
+}
+#else
+static void *batch_worker_main(void *argument)
+{
+    run_batch_worker(argument);
+    return NULL;
+}
+#endif
+
+static char *batch_output_path(const char *input, const char *output_dir)
+{
+    const char *name = input;
+    const char *extension;
+    size_t dir_length = strlen(output_dir);
+    size_t stem_length;
+    char *path;
+
+    for (const char *cursor = input; *cursor; cursor++) {
+        if (*cursor == '/' || *cursor == '\\') {
+            name = cursor + 1;
+        }
+    }
+    extension = strrchr(name, '.');
+    stem_length = extension && extension != name ? (size_t)(extension - name) : strlen(name);
+
+    while (dir_length > 1 && (output_dir[dir_length - 1] == '/' || output_dir[dir_length - 1] == '\\')) {
+        dir_length--;
+    }
+
+    path = malloc(dir_length + stem_length + 6);
+    if (!path) {
+        perror("Error allocating output path");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(path, output_dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, name, stem_length);
+    memcpy(path + dir_length + 1 + stem_length, ".asm", 5);
+    return path;
+}
+
+/* Windows file systems ignore case, so a/Main.c and b/main.c collide there too. */
+#ifdef _WIN32
+#define compare_paths(a, b) _stricmp(a, b)
+#else
+#define compare_paths(a, b) strcmp(a, b)
+#endif
+
+static int compare_outputs(const void *left, const void *right)
+{
+    const struct batch_job *a = *(const struct batch_job *const *)left;
+    const struct batch_job *b = *(const struct batch_job *const *)right;
+    int order = compare_paths(a->output, b->output);
+
+    if (order != 0) {
+        return order;
+    }
+    return a < b ? -1 : a > b;
+}
+
+/*
+ * Outputs keep only the input's basename, so a/x.c and b/x.c would race to
+ * write the same file. Reports every such pair and returns how many there are.
+ */
+static int report_output_collisions(const struct batch *batch)
+{
+    struct batch_job **order = malloc((size_t)batch->job_count * sizeof(*order));
+    int collisions = 0;
+
+    if (!order) {
+        perror("Error allocating batch jobs");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < batch->job_count; i++) {
+        order[i] = &batch->jobs[i];
+    }
+    qsort(order, (size_t)batch->job_count, sizeof(*order), compare_outputs);
+    for (int i = 1; i < batch->job_count; i++) {
+        if (compare_paths(order[i - 1]->output, order[i]->output) == 0) {
+            fprintf(stderr, "Inputs %s and %s would both be written to %s\n", order[i - 1]->input,
+                order[i]->input, order[i]->output);
+            collisions++;
+        }
+    }
+    free(order);
+    return collisions;
+}
+
+static int write_batch_stats(const struct batch *batch, const char *path)
+{
+    const char **inputs = malloc((size_t)batch->job_count * sizeof(*inputs));
+    struct compile_stats *stats = malloc((size_t)batch->job_count * sizeof(*stats));
+    int *ok = malloc((size_t)batch->job_count * sizeof(*ok));
+    int written;
+
+    if (!inputs || !stats || !ok) {
+        perror("Error allocating batch statistics");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < batch->job_count; i++) {
+        inputs[i] = batch->jobs[i].input;
+        stats[i] = batch->jobs[i].stats;
+        ok[i] = batch->jobs[i].ok;
+    }
+    written = stats_write_json(path, inputs, ok, stats, batch->job_count);
+
+    free(inputs);
+    free(stats);
+    free(ok);
+    return written;
+}
+
+/* Compiles every input into output_dir with up to `jobs` threads. Returns the number of failures. */
+int compile_batch(const char **inputs, int input_count, const char *output_dir, int jobs,
+    const struct compile_options *options)
+{
+    struct batch batch;
+    int failures = 0;
+    int worker_count;
+    int started = 0;
+#ifdef _WIN32
+    HANDLE *workers;
+#else
+    pthread_t *workers;
+#endif
+
+    batch.jobs = calloc((size_t)input_count, sizeof(struct batch_job));
+    batch.job_count = input_count;
+    batch.next_job = 0;
+    batch.options = options;
+    worker_count = jobs < input_count ? jobs : input_count;
+    workers = calloc(worker_count > 0 ? (size_t)worker_count : 1, sizeof(*workers));
+    if (!batch.jobs || !workers) {
+        perror("Error allocating batch jobs");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < input_count; i++) {
+        batch.jobs[i].input = inputs[i];
+        batch.jobs[i].output = batch_output_path(inputs[i], output_dir);
+    }
+    failures = report_output_collisions(&batch);
+    if (failures) {
+        for (int i = 0; i < input_count; i++) {
+            free(batch.jobs[i].output);
+        }
+        free(workers);
+        free(batch.jobs);
+        return failures;
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&batch.lock);
+    for (int i = 1; i < worker_count; i++) {
+        workers[started] = CreateThread(NULL, 0, batch_worker_main, &batch, 0, NULL);
+        if (workers[started]) {
+            started++;
+        }
+    }
+#else
+    pthread_mutex_init(&batch.lock, NULL);
+    for (int i = 1; i < worker_count; i++) {
+        if (pthread_create(&workers[started], NULL, batch_worker_main, &batch) == 0) {
+            started++;
+        }
+    }
+#endif
+
+    /* The calling thread is a worker too, so a failed thread start only costs parallelism. */
+    run_batch_worker(&batch);
+
+    for (int i = 0; i < started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(workers[i], INFINITE);
+        CloseHandle(workers[i]);
+#else
+        pthread_join(workers[i], NULL);
+#endif
+    }
+#ifdef _WIN32
+    DeleteCriticalSection(&batch.lock);
+#else
+    pthread_mutex_destroy(&batch.lock);
+#endif
+
+    for (int i = 0; i < input_count; i++) {
+        struct batch_job *job = &batch.jobs[i];
+
+        fwrite(job->diagnostics, 1, job->diagnostics_length, stderr);
+        if (job->ok) {
+            printf("Compiled %s -> %s\n", job->input, job->output);
+            fflush(stdout);
+        } else {
+            failures++;
+        }
+    }
+    if (options->stats_json && !write_batch_stats(&batch, options->stats_json)) {
+        failures++;
+    }
+
+    for (int i = 0; i < input_count; i++) {
+        free(batch.jobs[i].diagnostics);
+        free(batch.jobs[i].output);
+    }
+    free(workers);
+    free(batch.jobs);
+    return failures;
+}
@@ -0,0 +1,469 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/*
+ * Assembly text is appended to one large buffer by writers that know the
+ * exact shape of each operand, so the hot path is a handful of memcpy calls
+ * rather than a printf format parse per instruction. With a file attached,
+ * the buffer goes to it in big chunks whenever it fills up; without one, the
+ * buffer simply grows and emitter_take() hands the text to the caller.
+ * A recording emitter keeps a function's instructions as records instead,
+ * for the peephole pass, and emitter_append() turns them into text.
+ */
+
+#define EMITTER_BUFFER_SIZE (1024 * 1024)
+#define MNEMONIC_WIDTH 8
+
+static void emitter_grow(struct emitter *out, size_t needed)
+{
+    size_t capacity = out->capacity ? out->capacity : out->file ? EMITTER_BUFFER_SIZE : 256;
+
+    while (capacity - out->length < needed) {
+        capacity *= 2;
+    }
+    out->data = realloc(out->data, capacity);
+    if (!out->data) {
+        perror("Error allocating assembly buffer");
+        exit(EXIT_FAILURE);
+    }
+    out->capacity = capacity;
+}
+
+static void write_chunk(FILE *file, const char *data, size_t length)
+{
+#ifndef _WIN32
+    int fd = fileno(file);
+
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing assembly output");
+            exit(EXIT_FAILURE);
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+#else
+    if (fwrite(data, 1, length, file) != length) {
+        perror("Error writing assembly output");
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+void emitter_init(struct emitter *out, FILE *file)
+{
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+    out->flushed = 0;
+    out->file = file;
+    out->insns = NULL;
+    out->insn_count = 0;
+    out->insn_capacity = 0;
+    out->recording = 0;
+    if (file) {
+        fflush(file);
+        emitter_grow(out, EMITTER_BUFFER_SIZE);
+    }
+}
+
+void emitter_flush(struct emitter *out)
+{
+    if (out->file && out->length > 0) {
+        write_chunk(out->file, out->data, out->length);
+        out->flushed += out->length;
+        out->length = 0;
+    }
+}
+
+void emitter_release(struct emitter *out)
+{
+    emitter_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+    free(out->insns);
+    out->insns = NULL;
+    out->insn_count = 0;
+    out->insn_capacity = 0;
+}
+
+/* Makes a buffer-only emitter keep records from now on. */
+void emitter_record(struct emitter *out)
+{
+    out->recording = 1;
+}
+
+/* Empties a buffer-only emitter, keeping its memory and mode. */
+void emitter_reset(struct emitter *out)
+{
+    out->length = 0;
+    out->insn_count = 0;
+}
+
+static struct insn *record_insn(struct emitter *out, InsnKind kind, const char *mnemonic, int operand_count)
+{
+    struct insn *insn;
+
+    if (out->insn_count == out->insn_capacity) {
+        int capacity = out->insn_capacity ? out->insn_capacity * 2 : 64;
+        struct insn *insns = realloc(out->insns, (size_t)capacity * sizeof(*insns));
+
+        if (!insns) {
+            perror("Error allocating instruction records");
+            exit(EXIT_FAILURE);
+        }
+        out->insns = insns;
+        out->insn_capacity = capacity;
+    }
+    insn = &out->insns[out->insn_count++];
+    insn->kind = kind;
+    insn->mnemonic = mnemonic;
+    insn->operand_count = operand_count;
+    return insn;
+}
+
+static char *emit_reserve(struct emitter *out, size_t length)
+{
+    if (out->capacity - out->length < length) {
+        emitter_flush(out);
+        if (out->capacity - out->length < length) {
+            emitter_grow(out, length);
+        }
+    }
+    return out->data + out->length;
+}
+
+void emit_bytes(struct emitter *out, const char *text, size_t length)
+{
+    memcpy(emit_reserve(out, length), text, length);
+    out->length += length;
+}
+
+static void replay_insn(struct emitter *out, const struct insn *insn)
+{
+    switch (insn->kind) {
+        case INSN_INSTRUCTION:
+            if (insn->operand_count == 0) {
+                emit_insn0(out, insn->mnemonic);
+            } else if (insn->operand_count == 1) {
+                emit_insn1(out, insn->mnemonic, insn->operands[0]);
+            } else {
+                emit_insn2(out, insn->mnemonic, insn->operands[0], insn->operands[1]);
+            }
+            break;
+        case INSN_LABEL:
+            emit_label(out, insn->operands[0].text, insn->operands[0].value);
+            break;
+        case INSN_GLOBAL:
+            emit_global_symbol(out, insn->mnemonic);
+            break;
+        case INSN_DELETED:
+            break;
+    }
+}
+
+/*
+ * Appends what a buffer-only emitter, such as one per function, holds:
+ * its text, or its records replayed onto out.
+ */
+void emitter_append(struct emitter *out, const struct emitter *text)
+{
+    if (text->length > 0) {
+        emit_bytes(out, text->data, text->length);
+    }
+    for (int i = 0; i < text->insn_count; i++) {
+        replay_insn(out, &text->insns[i]);
+    }
+}
+
+char *emitter_take(struct emitter *out)
+{
+    char *text;
+
+    emit_reserve(out, 1);
+    out->data[out->length] = '\0';
+    text = out->data;
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+    return text;
+}
+
+/* NUL-terminates the buffered text and returns it; the emitter keeps ownership. */
+const char *emitter_text(struct emitter *out)
+{
+    emit_reserve(out, 1);
+    out->data[out->length] = '\0';
+    return out->data;
+}
+
+void emit_text(struct emitter *out, const char *text)
+{
+    emit_bytes(out, text, strlen(text));
+}
+
+void emit_vformat(struct emitter *out, const char *format, va_list args)
+{
+    va_list measure;
+    int length;
+
+    va_copy(measure, args);
+    length = vsnprintf(NULL, 0, format, measure);
+    va_end(measure);
+    if (length <= 0) {
+        return;
+    }
+    vsnprintf(emit_reserve(out, (size_t)length + 1), (size_t)length + 1, format, args);
+    out->length += (size_t)length;
+}
+
+void emit_format(struct emitter *out, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    emit_vformat(out, format, args);
+    va_end(args);
+}
+
+void emit_int(struct emitter *out, int value)
+{
+    char digits[12];
+    char *cursor = digits + sizeof(digits);
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        *--cursor = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--cursor = '-';
+    }
+    emit_bytes(out, cursor, (size_t)(digits + sizeof(digits) - cursor));
+}
+
+static void emit_operand(struct emitter *out, struct operand operand)
+{
+    switch (operand.kind) {
+        case OPERAND_REGISTER:
+            emit_bytes(out, "%", 1);
+            emit_text(out, operand.text);
+            break;
+        case OPERAND_IMMEDIATE:
+            emit_bytes(out, "$", 1);
+            emit_int(out, operand.value);
+            break;
+        case OPERAND_IMMEDIATE_TEXT:
+            emit_bytes(out, "$", 1);
+            emit_text(out, operand.text);
+            break;
+        case OPERAND_FRAME:
+            emit_int(out, operand.value);
+            emit_bytes(out, "(%ebp)", 6);
+            break;
+        case OPERAND_INDIRECT:
+            emit_bytes(out, "(%", 2);
+            emit_text(out, operand.text);
+            emit_bytes(out, ")", 1);
+            break;
+        case OPERAND_SYMBOL:
+            emit_bytes(out, "_", 1);
+            emit_text(out, operand.text);
+            break;
+        case OPERAND_SYMBOL_ADDRESS:
+            emit_bytes(out, "$_", 2);
+            emit_text(out, operand.text);
+            break;
+        case OPERAND_MEMORY:
+            if (operand.text) {
+                emit_bytes(out, "_", 1);
+                emit_text(out, operand.text);
+                if (operand.value > 0) {
+                    emit_bytes(out, "+", 1);
+                }
+            }
+            if (operand.value != 0 || (!operand.text && !operand.base && !operand.index)) {
+                emit_int(out, operand.value);
+            }
+            if (operand.base || operand.index) {
+                emit_bytes(out, "(", 1);
+                if (operand.base) {
+                    emit_bytes(out, "%", 1);
+                    emit_text(out, operand.base);
+                }
+                if (operand.index) {
+                    emit_bytes(out, ",%", 2);
+                    emit_text(out, operand.index);
+                    emit_bytes(out, ",", 1);
+                    emit_int(out, operand.scale);
+                }
+                emit_bytes(out, ")", 1);
+            }
+            break;
+        case OPERAND_LABEL:
+            emit_bytes(out, ".L", 2);
+            emit_text(out, operand.text);
+            emit_bytes(out, "_", 1);
+            emit_int(out, operand.value);
+            break;
+    }
+}
+
+static void emit_mnemonic(struct emitter *out, const char *mnemonic)
+{
+    size_t length = strlen(mnemonic);
+    size_t padding = length < MNEMONIC_WIDTH ? MNEMONIC_WIDTH - length : 1;
+    char *cursor = emit_reserve(out, 4 + length + padding);
+
+    memcpy(cursor, "    ", 4);
+    memcpy(cursor + 4, mnemonic, length);
+    memset(cursor + 4 + length, ' ', padding);
+    out->length += 4 + length + padding;
+}
+
+void emit_insn0(struct emitter *out, const char *mnemonic)
+{
+    if (out->recording) {
+        record_insn(out, INSN_INSTRUCTION, mnemonic, 0);
+        return;
+    }
+    emit_bytes(out, "    ", 4);
+    emit_text(out, mnemonic);
+    emit_bytes(out, "\n", 1);
+}
+
+void emit_insn1(struct emitter *out, const char *mnemonic, struct operand operand)
+{
+    if (out->recording) {
+        record_insn(out, INSN_INSTRUCTION, mnemonic, 1)->operands[0] = operand;
+        return;
+    }
+    emit_mnemonic(out, mnemonic);
+    emit_operand(out, operand);
+    emit_bytes(out, "\n", 1);
+}
+
+void emit_insn2(struct emitter *out, const char *mnemonic, struct operand source,
+    struct operand destination)
+{
+    if (out->recording) {
+        struct insn *insn = record_insn(out, INSN_INSTRUCTION, mnemonic, 2);
+
+        insn->operands[0] = source;
+        insn->operands[1] = destination;
+        return;
+    }
+    emit_mnemonic(out, mnemonic);
+    emit_operand(out, source);
+    emit_bytes(out, ", ", 2);
+    emit_operand(out, destination);
+    emit_bytes(out, "\n", 1);
+}
+
+/*
+ * Labels are numbered per function and named after it, so one function's
+ * code never refers to a label whose name depends on what came before it.
+ */
+void emit_label(struct emitter *out, const char *function, int label)
+{
+    if (out->recording) {
+        record_insn(out, INSN_LABEL, NULL, 1)->operands[0] = operand_label(function, label);
+        return;
+    }
+    emit_bytes(out, ".L", 2);
+    emit_text(out, function);
+    emit_bytes(out, "_", 1);
+    emit_int(out, label);
+    emit_bytes(out, ":\n", 2);
+}
+
+void emit_global_symbol(struct emitter *out, const char *name)
+{
+    if (out->recording) {
+        record_insn(out, INSN_GLOBAL, name, 0);
+        return;
+    }
+    emit_bytes(out, ".globl _", 8);
+    emit_text(out, name);
+    emit_bytes(out, "\n_", 2);
+    emit_text(out, name);
+    emit_bytes(out, ":\n", 2);
+}
+
+void emit_long(struct emitter *out, int value)
+{
+    emit_mnemonic(out, ".long");
+    emit_int(out, value);
+    emit_bytes(out, "\n", 1);
+}
+
+struct operand operand_register(const char *name)
+{
+    struct operand operand = { OPERAND_REGISTER, 0, name, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_immediate(int value)
+{
+    struct operand operand = { OPERAND_IMMEDIATE, value, NULL, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_immediate_text(const char *text)
+{
+    struct operand operand = { OPERAND_IMMEDIATE_TEXT, 0, text, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_frame(int offset)
+{
+    struct operand operand = { OPERAND_FRAME, offset, NULL, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_indirect(const char *name)
+{
+    struct operand operand = { OPERAND_INDIRECT, 0, name, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_symbol(const char *name)
+{
+    struct operand operand = { OPERAND_SYMBOL, 0, name, NULL, NULL, 0 };
+    return operand;
+}
+
+struct operand operand_symbol_address(const char *name)
+{
+    struct operand operand = { OPERAND_SYMBOL_ADDRESS, 0, name, NULL, NULL, 0 };
+    return operand;
+}
+
+/* symbol+displacement(base,index,scale); symbol, base and index may be NULL. */
+struct operand operand_memory(const char *symbol, int displacement, const char *base,
+    const char *index, int scale)
+{
+    struct operand operand = { OPERAND_MEMORY, displacement, symbol, base, index, scale };
+    return operand;
+}
+
+struct operand operand_label(const char *function, int label)
+{
+    struct operand operand = { OPERAND_LABEL, label, function, NULL, NULL, 0 };
+    return operand;
+}
@@ -0,0 +1,364 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Constant folding and propagation for checked functions. It runs once the
+ * conversion casts are in, so every operator sees its operands in their
+ * final types and every narrowing shows up as a cast, which is applied with
+ * cast_constant(). Folded expressions become AST_INTLIT nodes in place.
+ *
+ * A scalar local whose initializer folds to a constant, and which is never
+ * assigned, incremented or has its address taken, holds that constant for
+ * its whole life, so its uses are folded too. Scoping guarantees that every
+ * use comes after the declaration in the walk.
+ *
+ * Anything whose value the target would not agree on is left to run time:
+ * division by zero, INT_MIN / -1, and shifts by 32 or more.
+ */
+
+struct folding {
+    struct arena *arena;
+    int *changed;
+    int *known;
+    int *values;
+    int slot_count;
+};
+
+int type_size(const char *type)
+{
+    if (!type) {
+        return 4;
+    }
+    if (strcmp(type, "char") == 0 || strcmp(type, "uchar") == 0) {
+        return 1;
+    }
+    if (strcmp(type, "short") == 0 || strcmp(type, "ushort") == 0) {
+        return 2;
+    }
+    return 4;
+}
+
+int cast_constant(int value, const char *type)
+{
+    if (strcmp(type, "char") == 0) return (int)(int8_t)value;
+    if (strcmp(type, "uchar") == 0) return (int)(uint8_t)value;
+    if (strcmp(type, "short") == 0) return (int)(int16_t)value;
+    if (strcmp(type, "ushort") == 0) return (int)(uint16_t)value;
+    return value;
+}
+
+static int is_unsigned(CType type)
+{
+    return type == TYPE_UCHAR || type == TYPE_USHORT ||
+        type == TYPE_UINT || type == TYPE_ULONG;
+}
+
+/* The frame slot of a scalar local, or -1 for anything else. */
+static int slot_of(struct folding *fold, struct symbol *symbol)
+{
+    int slot;
+
+    if (!symbol || symbol->kind != SYMBOL_LOCAL || symbol->offset >= 0 ||
+        symbol->pointer_depth > 0 || symbol->array_length > 0) {
+        return -1;
+    }
+    slot = -symbol->offset / 4 - 1;
+    return slot < fold->slot_count ? slot : -1;
+}
+
+static void mark_changed(struct folding *fold, struct ast_node *node)
+{
+    int slot;
+
+    if (!node) {
+        return;
+    }
+    switch (node->type) {
+        case AST_ASSIGN:
+        case AST_ADDRESS_OF:
+        case AST_PRE_INCREMENT:
+        case AST_PRE_DECREMENT:
+        case AST_POST_INCREMENT:
+        case AST_POST_DECREMENT:
+            if (node->left->type == AST_IDENTIFIER && (slot = slot_of(fold, node->left->symbol)) >= 0) {
+                fold->changed[slot] = 1;
+            }
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        mark_changed(fold, node->children[i]);
+    }
+    mark_changed(fold, node->left);
+    mark_changed(fold, node->right);
+}
+
+static int is_constant(struct ast_node *node)
+{
+    return node && node->type == AST_INTLIT;
+}
+
+static int constant_value(struct ast_node *node)
+{
+    return (int)(uint32_t)strtoul(node->value, NULL, 10);
+}
+
+static void make_constant(struct folding *fold, struct ast_node *node, int value)
+{
+    char text[16];
+    size_t length = (size_t)snprintf(text, sizeof(text), "%d", value);
+    char *copy = arena_alloc(fold->arena, length + 1);
+
+    memcpy(copy, text, length + 1);
+    node->type = AST_INTLIT;
+    node->value = copy;
+    node->left = NULL;
+    node->right = NULL;
+    node->symbol = NULL;
+}
+
+/* Replaces *slot with part when that does not change the expression's type. */
+static void replace_with(struct ast_node **slot, struct ast_node *part)
+{
+    struct ast_node *node = *slot;
+
+    if (part->data_type == node->data_type && part->pointer_depth == node->pointer_depth &&
+        part->array_length == node->array_length) {
+        *slot = part;
+    }
+}
+
+/* Evaluates a binary operator on constants; returns 0 if it must be left to run time. */
+static int fold_binary(struct ast_node *node, int left, int right, int *result)
+{
+    uint32_t a = (uint32_t)left;
+    uint32_t b = (uint32_t)right;
+    int is_unsigned_operation = is_unsigned(node->left->data_type);
+
+    switch (node->type) {
+        case AST_ADD: *result = (int)(a + b); return 1;
+        case AST_SUB: *result = (int)(a - b); return 1;
+        case AST_MUL: *result = (int)(a * b); return 1;
+        case AST_BITWISE_AND: *result = left & right; return 1;
+        case AST_BITWISE_OR: *result = left | right; return 1;
+        case AST_BITWISE_XOR: *result = left ^ right; return 1;
+        case AST_DIV:
+        case AST_MOD:
+            if (right == 0 || (!is_unsigned_operation && left == INT32_MIN && right == -1)) {
+                return 0;
+            }
+            if (is_unsigned_operation) {
+                *result = (int)(node->type == AST_DIV ? a / b : a % b);
+            } else {
+                *result = node->type == AST_DIV ? left / right : left % right;
+            }
+            return 1;
+        case AST_SHIFT_LEFT:
+        case AST_SHIFT_RIGHT:
+            if (b > 31) {
+                return 0;
+            }
+            if (node->type == AST_SHIFT_LEFT) {
+                *result = (int)(a << b);
+            } else {
+                *result = is_unsigned_operation ? (int)(a >> b) : left >> right;
+            }
+            return 1;
+        case AST_EQUAL: *result = left == right; return 1;
+        case AST_NOT_EQUAL: *result = left != right; return 1;
+        case AST_LESS: *result = is_unsigned_operation ? a < b : left < right; return 1;
+        case AST_LESS_EQUAL: *result = is_unsigned_operation ? a <= b : left <= right; return 1;
+        case AST_GREATER: *result = is_unsigned_operation ? a > b : left > right; return 1;
+        case AST_GREATER_EQUAL: *result = is_unsigned_operation ? a >= b : left >= right; return 1;
+        default:
+            return 0;
+    }
+}
+
+static void fold_node(struct folding *fold, struct ast_node **slot)
+{
+    struct ast_node *node = *slot;
+    int slot_index;
+    int value;
+
+    if (!node) {
+        return;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        fold_node(fold, &node->children[i]);
+    }
+    fold_node(fold, &node->left);
+    fold_node(fold, &node->right);
+
+    switch (node->type) {
+        case AST_DECL:
+            slot_index = slot_of(fold, node->symbol);
+            if (slot_index >= 0 && !fold->changed[slot_index] && is_constant(node->left)) {
+                fold->known[slot_index] = 1;
+                fold->values[slot_index] = constant_value(node->left);
+            }
+            return;
+        case AST_IDENTIFIER:
+            slot_index = slot_of(fold, node->symbol);
+            if (slot_index >= 0 && fold->known[slot_index]) {
+                make_constant(fold, node, fold->values[slot_index]);
+            }
+            return;
+        case AST_SIZEOF:
+            make_constant(fold, node, type_size(node->value));
+            return;
+        case AST_CAST:
+            if (is_constant(node->left)) {
+                make_constant(fold, node, cast_constant(constant_value(node->left), node->value));
+            }
+            return;
+        case AST_NEGATION:
+        case AST_BITWISE_COMPLEMENT:
+        case AST_LOGICAL_NEGATION:
+            if (is_constant(node->left)) {
+                value = constant_value(node->left);
+                value = node->type == AST_NEGATION ? (int)(0u - (uint32_t)value) :
+                    node->type == AST_BITWISE_COMPLEMENT ? ~value : !value;
+                make_constant(fold, node, value);
+            }
+            return;
+        case AST_LOGICAL_AND:
+        case AST_LOGICAL_OR:
+            /* The right side only matters when the left does not decide. */
+            if (is_constant(node->left) && (constant_value(node->left) != 0) == (node->type == AST_LOGICAL_OR)) {
+                make_constant(fold, node, node->type == AST_LOGICAL_OR);
+            } else if (is_constant(node->left) && is_constant(node->right)) {
+                make_constant(fold, node, constant_value(node->right) != 0);
+            }
+            return;
+        case AST_CONDITIONAL:
+            if (is_constant(node->left)) {
+                replace_with(slot, constant_value(node->left) ? node->right->left : node->right->right);
+            }
+            return;
+        case AST_COMMA:
+            if (is_constant(node->left)) {
+                replace_with(slot, node->right);
+            }
+            return;
+        case AST_ADD:
+            /* (x + a) + b becomes x + (a + b), and x + 0 becomes x. */
+            if (is_constant(node->right) && node->pointer_depth == 0 && node->left->type == AST_ADD &&
+                is_constant(node->left->right) && node->left->pointer_depth == 0) {
+                make_constant(fold, node->right,
+                    (int)((uint32_t)constant_value(node->left->right) + (uint32_t)constant_value(node->right)));
+                node->left = node->left->left;
+            }
+            if (is_constant(node->right) && !is_constant(node->left) && node->pointer_depth == 0 &&
+                constant_value(node->right) == 0) {
+                replace_with(slot, node->left);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    if (node->left && node->right && is_constant(node->left) && is_constant(node->right) &&
+        node->pointer_depth == 0 && node->array_length == 0 &&
+        fold_binary(node, constant_value(node->left), constant_value(node->right), &value)) {
+        make_constant(fold, node, value);
+    }
+}
+
+/*
+ * Evaluates a checked constant expression the way codegen evaluates global
+ * initializers, taking only the branch that decides ?:, && and || and only
+ * the right side of a comma. Shift counts are masked as shll/sarl mask them.
+ * Returns 0 if it meets a division by zero or INT_MIN / -1, which have no
+ * value and would trap the compiler itself.
+ */
+int evaluate_constant(struct ast_node *node, int *value)
+{
+    int left;
+    int right;
+
+    if (!node) {
+        *value = 0;
+        return 1;
+    }
+    switch (node->type) {
+        case AST_INTLIT:
+            *value = constant_value(node);
+            return 1;
+        case AST_SIZEOF:
+            *value = type_size(node->value);
+            return 1;
+        case AST_CAST:
+            if (!evaluate_constant(node->left, &left)) {
+                return 0;
+            }
+            *value = cast_constant(left, node->value);
+            return 1;
+        case AST_NEGATION:
+        case AST_BITWISE_COMPLEMENT:
+        case AST_LOGICAL_NEGATION:
+            if (!evaluate_constant(node->left, &left)) {
+                return 0;
+            }
+            *value = node->type == AST_NEGATION ? (int)(0u - (uint32_t)left) :
+                node->type == AST_BITWISE_COMPLEMENT ? ~left : !left;
+            return 1;
+        case AST_LOGICAL_AND:
+        case AST_LOGICAL_OR:
+            if (!evaluate_constant(node->left, &left)) {
+                return 0;
+            }
+            if ((left != 0) == (node->type == AST_LOGICAL_OR)) {
+                *value = node->type == AST_LOGICAL_OR;
+                return 1;
+            }
+            if (!evaluate_constant(node->right, &right)) {
+                return 0;
+            }
+            *value = right != 0;
+            return 1;
+        case AST_CONDITIONAL:
+            if (!evaluate_constant(node->left, &left)) {
+                return 0;
+            }
+            return evaluate_constant(left ? node->right->left : node->right->right, value);
+        case AST_COMMA:
+            return evaluate_constant(node->right, value);
+        default:
+            if (!evaluate_constant(node->left, &left) || !evaluate_constant(node->right, &right)) {
+                return 0;
+            }
+            if (node->type == AST_SHIFT_LEFT || node->type == AST_SHIFT_RIGHT) {
+                right &= 31;
+            }
+            return fold_binary(node, left, right, value);
+    }
+}
+
+/* Folds the body of a checked function, allocating new literals from arena. */
+void fold_function(struct ast_node *function, struct arena *arena)
+{
+    struct folding fold;
+
+    fold.arena = arena;
+    fold.slot_count = function->symbol->frame_size / 4;
+    fold.changed = calloc(fold.slot_count > 0 ? (size_t)fold.slot_count : 1, sizeof(int));
+    fold.known = calloc(fold.slot_count > 0 ? (size_t)fold.slot_count : 1, sizeof(int));
+    fold.values = calloc(fold.slot_count > 0 ? (size_t)fold.slot_count : 1, sizeof(int));
+    if (!fold.changed || !fold.known || !fold.values) {
+        perror("Error allocating constant folding tables");
+        exit(EXIT_FAILURE);
+    }
+
+    mark_changed(&fold, function->right);
+    fold_node(&fold, &function->right);
+
+    free(fold.changed);
+    free(fold.known);
+    free(fold.values);
+}
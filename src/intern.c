@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Identifier and literal spellings are stored once in a hash-consed table, so
+ * two names are equal exactly when their pointers are. The text itself is
+ * bump-allocated and only released as a whole by free_intern_table(). Each
+ * compilation has its own table, so names from different units never mix.
+ */
+
+struct intern_entry {
+    const char *text;
+    size_t length;
+    unsigned int hash;
+};
+
+static unsigned int hash_text(const char *text, size_t length)
+{
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void grow_intern_table(struct intern_table *table)
+{
+    size_t capacity = table->capacity ? table->capacity * 2 : 1024;
+    struct intern_entry *entries = calloc(capacity, sizeof(struct intern_entry));
+
+    if (!entries) {
+        perror("Error allocating string table");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        size_t slot;
+
+        if (!table->entries[i].text) {
+            continue;
+        }
+        slot = table->entries[i].hash & (capacity - 1);
+        while (entries[slot].text) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        entries[slot] = table->entries[i];
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+const char *intern_string(struct intern_table *table, const char *text, size_t length)
+{
+    unsigned int hash = hash_text(text, length);
+    size_t slot;
+    char *copy;
+
+    if ((table->count + 1) * 2 > table->capacity) {
+        grow_intern_table(table);
+    }
+
+    slot = hash & (table->capacity - 1);
+    while (table->entries[slot].text) {
+        if (table->entries[slot].hash == hash && table->entries[slot].length == length &&
+            memcmp(table->entries[slot].text, text, length) == 0) {
+            return table->entries[slot].text;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    copy = arena_alloc(&table->arena, length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    table->entries[slot].text = copy;
+    table->entries[slot].length = length;
+    table->entries[slot].hash = hash;
+    table->count++;
+    return copy;
+}
+
+/* Forgets every string but keeps the slot array and the arena's newest block. */
+void reset_intern_table(struct intern_table *table)
+{
+    if (table->entries) {
+        memset(table->entries, 0, table->capacity * sizeof(struct intern_entry));
+    }
+    table->count = 0;
+    arena_reset(&table->arena);
+}
+
+void free_intern_table(struct intern_table *table)
+{
+    arena_free(&table->arena);
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
@@ -6,313 +6,511 @@
 #include "defs.h"
 #include "decl.h"
 
-static const char *lexer_source_path;
-static int current_line;
-static int current_column;
-static int last_line;
-static int last_column;
-static int previous_line;
-static int previous_column;
-static int token_line;
-static int token_column;
+struct lexer {
+    struct compilation *unit;
+    int line;
+    int column;
+    int depth;
+    int initializer;
+};
 
-static int tracked_fgetc(FILE *infile)
+/* Typical sources average a little over four bytes per token. */
+#define TOKEN_BYTES_ESTIMATE 4
+
+static const char *const token_spellings[] = {
+    [T_OPENBRACE] = "{",
+    [T_CLOSEBRACE] = "}",
+    [T_OPENPAREN] = "(",
+    [T_CLOSEPAREN] = ")",
+    [T_OPENBRACKET] = "[",
+    [T_CLOSEBRACKET] = "]",
+    [T_SEMICOLON] = ";",
+    [T_COMMA] = ",",
+    [T_QUESTION] = "?",
+    [T_COLON] = ":",
+    [T_CHAR] = "char",
+    [T_SHORT] = "short",
+    [T_INT] = "int",
+    [T_LONG] = "long",
+    [T_SIGNED] = "signed",
+    [T_UNSIGNED] = "unsigned",
+    [T_RETURN] = "return",
+    [T_IF] = "if",
+    [T_ELSE] = "else",
+    [T_WHILE] = "while",
+    [T_FOR] = "for",
+    [T_BREAK] = "break",
+    [T_CONTINUE] = "continue",
+    [T_SIZEOF] = "sizeof",
+    [T_BITWISE_COMPLEMENT] = "~",
+    [T_LOGICAL_NEGATION] = "!",
+    [T_PLUS] = "+",
+    [T_PLUS_PLUS] = "++",
+    [T_PLUS_ASSIGN] = "+=",
+    [T_STAR] = "*",
+    [T_STAR_ASSIGN] = "*=",
+    [T_SLASH] = "/",
+    [T_SLASH_ASSIGN] = "/=",
+    [T_MINUS] = "-",
+    [T_MINUS_MINUS] = "--",
+    [T_MINUS_ASSIGN] = "-=",
+    [T_PERCENT] = "%",
+    [T_PERCENT_ASSIGN] = "%=",
+    [T_AMPERSAND] = "&",
+    [T_AMPERSAND_ASSIGN] = "&=",
+    [T_PIPE] = "|",
+    [T_PIPE_ASSIGN] = "|=",
+    [T_CARET] = "^",
+    [T_CARET_ASSIGN] = "^=",
+    [T_SHIFT_LEFT] = "<<",
+    [T_SHIFT_RIGHT] = ">>",
+    [T_SHIFT_LEFT_ASSIGN] = "<<=",
+    [T_SHIFT_RIGHT_ASSIGN] = ">>=",
+    [T_LOGICAL_AND] = "&&",
+    [T_LOGICAL_OR] = "||",
+    [T_EQUAL] = "==",
+    [T_NOT_EQUAL] = "!=",
+    [T_ASSIGN] = "=",
+    [T_LESS] = "<",
+    [T_LESS_EQUAL] = "<=",
+    [T_GREATER] = ">",
+    [T_GREATER_EQUAL] = ">=",
+    [T_EOF] = "EOF",
+};
+
+static void lex_error_at(struct lexer *lexer, const char *format, ...)
+{
+    va_list args;
+
+    compilation_diagnostic(lexer->unit, "Lex error at %s:%d:%d: ",
+        lexer->unit->source_path, lexer->line, lexer->column);
+    va_start(args, format);
+    compilation_vdiagnostic(lexer->unit, format, args);
+    va_end(args);
+    compilation_diagnostic(lexer->unit, "\n");
+    compilation_fail(lexer->unit);
+}
+
+static void reserve_tokens(struct lexer *lexer, int capacity)
 {
-    int c;
+    struct token *resized;
 
-    previous_line = current_line;
-    previous_column = current_column;
-    c = fgetc(infile);
-    if (c == EOF) {
-        return EOF;
+    if (capacity <= lexer->unit->token_capacity) {
+        return;
+    }
+    resized = realloc(lexer->unit->tokens, (size_t)capacity * sizeof(struct token));
+    if (!resized) {
+        perror("Error allocating token");
+        exit(EXIT_FAILURE);
     }
+    lexer->unit->tokens = resized;
+    lexer->unit->token_capacity = capacity;
+}
+
+static void add_token(struct lexer *lexer, TokenType type, const char *value, int offset, int length)
+{
+    struct compilation *unit = lexer->unit;
+    struct token *token;
 
-    if (c == '\n') {
-        current_line++;
-        current_column = 0;
-    } else {
-        current_column++;
+    if (unit->token_count == unit->token_capacity) {
+        reserve_tokens(lexer, unit->token_capacity > 0 ? unit->token_capacity * 2 : 64);
     }
 
-    last_line = current_line;
-    last_column = c == '\n' ? 1 : current_column;
-    return c;
+    token = &unit->tokens[unit->token_count];
+    token->type = type;
+    token->location.line = lexer->line;
+    token->location.column = lexer->column;
+    token->offset = offset;
+    token->length = length;
+    token->value = value;
+    unit->token_count++;
 }
 
-static void tracked_ungetc(int c, FILE *infile)
+/*
+ * A top-level declaration ends at a ';' or '}' outside any brackets, except
+ * the '}' closing a global's initializer. A stray closing bracket ends it
+ * early, so the parser reports that token just as a whole-file compile would.
+ */
+static int ends_declaration(struct lexer *lexer, TokenType type)
 {
-    if (c == EOF) {
-        return;
+    switch (type) {
+        case T_OPENBRACE:
+        case T_OPENPAREN:
+        case T_OPENBRACKET:
+            lexer->depth++;
+            return 0;
+        case T_CLOSEPAREN:
+        case T_CLOSEBRACKET:
+            return --lexer->depth < 0;
+        case T_CLOSEBRACE:
+            lexer->depth--;
+            return lexer->depth < 0 || (lexer->depth == 0 && !lexer->initializer);
+        case T_ASSIGN:
+            lexer->initializer |= lexer->depth == 0;
+            return 0;
+        case T_SEMICOLON:
+            return lexer->depth <= 0;
+        default:
+            return 0;
     }
-    ungetc(c, infile);
-    current_line = previous_line;
-    current_column = previous_column;
 }
 
-#define fgetc tracked_fgetc
-#define ungetc tracked_ungetc
+static int is_identifier_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/*
+ * Keywords live in a small table indexed by a hash of their length, first and
+ * last character, so classifying a word costs one probe and one memcmp no
+ * matter how many keywords exist. Slots are assigned at compile time: adding
+ * a keyword is one KEYWORD() line, and if it collides with an existing entry
+ * -Woverride-init (enabled by -Wextra) flags the overwritten slot.
+ */
+#define KEYWORD_SLOTS 64
+#define KEYWORD_SLOT(length, first, last) \
+    ((((length) << 2) + (unsigned char)(first) + (unsigned char)(last)) & (KEYWORD_SLOTS - 1))
+#define KEYWORD(text, first, last, type) \
+    [KEYWORD_SLOT(sizeof(text) - 1, first, last)] = { text, sizeof(text) - 1, type }
+
+struct keyword {
+    const char *text;
+    size_t length;
+    TokenType type;
+};
 
-static void lex_error_at(int line, int column, const char *format, ...)
+static const struct keyword keywords[KEYWORD_SLOTS] = {
+    KEYWORD("char", 'c', 'r', T_CHAR),
+    KEYWORD("short", 's', 't', T_SHORT),
+    KEYWORD("int", 'i', 't', T_INT),
+    KEYWORD("long", 'l', 'g', T_LONG),
+    KEYWORD("signed", 's', 'd', T_SIGNED),
+    KEYWORD("unsigned", 'u', 'd', T_UNSIGNED),
+    KEYWORD("return", 'r', 'n', T_RETURN),
+    KEYWORD("if", 'i', 'f', T_IF),
+    KEYWORD("else", 'e', 'e', T_ELSE),
+    KEYWORD("while", 'w', 'e', T_WHILE),
+    KEYWORD("for", 'f', 'r', T_FOR),
+    KEYWORD("break", 'b', 'k', T_BREAK),
+    KEYWORD("continue", 'c', 'e', T_CONTINUE),
+    KEYWORD("sizeof", 's', 'f', T_SIZEOF),
+};
+
+static TokenType classify_word(const char *start, size_t length)
 {
-    va_list args;
+    const struct keyword *keyword =
+        &keywords[KEYWORD_SLOT(length, start[0], start[length - 1])];
 
-    fprintf(stderr, "Lex error at %s:%d:%d: ", lexer_source_path, line, column);
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-    fprintf(stderr, "\n");
-    exit(EXIT_FAILURE);
+    if (keyword->length == length && memcmp(keyword->text, start, length) == 0) {
+        return keyword->type;
+    }
+    return T_IDENTIFIER;
 }
 
-void lex(FILE *infile, const char *source_path, struct token **tokens, int *token_count)
+/*
+ * The scanner walks a cursor over the whole source buffer. The buffer is
+ * required to hold a NUL byte at source[length], so one or two characters of
+ * lookahead never need a bounds check: the sentinel simply fails to match.
+ * Tokens record their slice of the buffer; only identifier and literal
+ * spellings are copied, once each, into the unit's intern table. A lex error
+ * leaves the tokens scanned so far in the unit, where they are released with
+ * the rest of it.
+ */
+static void scan(struct compilation *unit, const char *source, size_t length,
+    struct lex_cursor *position, int one_declaration)
 {
-    char c;
-    char buffer[256];
-    int buffer_index = 0;
-
-    lexer_source_path = source_path;
-    current_line = 1;
-    current_column = 0;
-    last_line = 1;
-    last_column = 1;
+    struct lexer lexer = { unit, 1, 1, 0, 0 };
+    const char *cursor = source + position->offset;
+    const char *end = source + length;
+    const char *line_start = source + position->line_start;
+    int line = position->line;
 
-    *tokens = NULL;
-    *token_count = 0;
+    while (cursor < end) {
+        const char *start = cursor;
+        const char *value = NULL;
+        TokenType type;
 
-    while ((c = fgetc(infile)) != EOF) {
-        token_line = last_line;
-        token_column = last_column;
-        if (isspace(c)) {
-            continue;
-        }
+        lexer.line = line;
+        lexer.column = (int)(cursor - line_start) + 1;
 
-        if (c == '{') {
-            add_token(tokens, token_count, T_OPENBRACE, "{");
-        } else if (c == '}') {
-            add_token(tokens, token_count, T_CLOSEBRACE, "}");
-        } else if (c == '(') {
-            add_token(tokens, token_count, T_OPENPAREN, "(");
-        } else if (c == ')') {
-            add_token(tokens, token_count, T_CLOSEPAREN, ")");
-        } else if (c == '[') {
-            add_token(tokens, token_count, T_OPENBRACKET, "[");
-        } else if (c == ']') {
-            add_token(tokens, token_count, T_CLOSEBRACKET, "]");
-        } else if (c == ';') {
-            add_token(tokens, token_count, T_SEMICOLON, ";");
-        } else if (c == ',') {
-            add_token(tokens, token_count, T_COMMA, ",");
-        } else if (c == '?') {
-            add_token(tokens, token_count, T_QUESTION, "?");
-        } else if (c == ':') {
-            add_token(tokens, token_count, T_COLON, ":");
-        } else if (c == '-') {
-            if ((c = fgetc(infile)) == '-') {
-                add_token(tokens, token_count, T_MINUS_MINUS, "--");
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_MINUS_ASSIGN, "-=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_MINUS, "-");
-            }
-        } else if (c == '~') {
-            add_token(tokens, token_count, T_BITWISE_COMPLEMENT, "~");
-        } else if (c == '!') {
-            if ((c = fgetc(infile)) == '=') {
-                add_token(tokens, token_count, T_NOT_EQUAL, "!=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_LOGICAL_NEGATION, "!");
-            }
-        } else if (c == '+') {
-            if ((c = fgetc(infile)) == '+') {
-                add_token(tokens, token_count, T_PLUS_PLUS, "++");
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_PLUS_ASSIGN, "+=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_PLUS, "+");
-            }
-        } else if (c == '*') {
-            if ((c = fgetc(infile)) == '=') {
-                add_token(tokens, token_count, T_STAR_ASSIGN, "*=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_STAR, "*");
-            }
-        } else if (c == '/') {
-            if ((c = fgetc(infile)) == '/') {
-                while ((c = fgetc(infile)) != EOF && c != '\n') {
+        switch (*cursor) {
+            case '\n':
+                cursor++;
+                line++;
+                line_start = cursor;
+                continue;
+            case ' ':
+            case '\t':
+            case '\v':
+            case '\f':
+            case '\r':
+                cursor++;
+                continue;
+            case '{':
+                type = T_OPENBRACE;
+                cursor++;
+                break;
+            case '}':
+                type = T_CLOSEBRACE;
+                cursor++;
+                break;
+            case '(':
+                type = T_OPENPAREN;
+                cursor++;
+                break;
+            case ')':
+                type = T_CLOSEPAREN;
+                cursor++;
+                break;
+            case '[':
+                type = T_OPENBRACKET;
+                cursor++;
+                break;
+            case ']':
+                type = T_CLOSEBRACKET;
+                cursor++;
+                break;
+            case ';':
+                type = T_SEMICOLON;
+                cursor++;
+                break;
+            case ',':
+                type = T_COMMA;
+                cursor++;
+                break;
+            case '?':
+                type = T_QUESTION;
+                cursor++;
+                break;
+            case ':':
+                type = T_COLON;
+                cursor++;
+                break;
+            case '~':
+                type = T_BITWISE_COMPLEMENT;
+                cursor++;
+                break;
+            case '-':
+                if (cursor[1] == '-') {
+                    type = T_MINUS_MINUS;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_MINUS_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_MINUS;
+                    cursor++;
                 }
-            } else if (c == '*') {
-                int prev = 0;
-                int closed = 0;
-                int comment_line = token_line;
-                int comment_column = token_column;
-
-                while ((c = fgetc(infile)) != EOF) {
-                    if (prev == '*' && c == '/') {
-                        closed = 1;
-                        break;
+                break;
+            case '!':
+                if (cursor[1] == '=') {
+                    type = T_NOT_EQUAL;
+                    cursor += 2;
+                } else {
+                    type = T_LOGICAL_NEGATION;
+                    cursor++;
+                }
+                break;
+            case '+':
+                if (cursor[1] == '+') {
+                    type = T_PLUS_PLUS;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_PLUS_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_PLUS;
+                    cursor++;
+                }
+                break;
+            case '*':
+                if (cursor[1] == '=') {
+                    type = T_STAR_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_STAR;
+                    cursor++;
+                }
+                break;
+            case '/':
+                if (cursor[1] == '/') {
+                    cursor += 2;
+                    while (cursor < end && *cursor != '\n') {
+                        cursor++;
                     }
-                    prev = c;
+                    continue;
                 }
-
-                if (!closed) {
-                    lex_error_at(comment_line, comment_column, "unterminated block comment");
+                if (cursor[1] == '*') {
+                    cursor += 2;
+                    while (cursor < end) {
+                        if (*cursor == '\n') {
+                            line++;
+                            line_start = cursor + 1;
+                        } else if (*cursor == '*' && cursor[1] == '/') {
+                            break;
+                        }
+                        cursor++;
+                    }
+                    if (cursor >= end) {
+                        lex_error_at(&lexer, "unterminated block comment");
+                    }
+                    cursor += 2;
+                    continue;
                 }
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_SLASH_ASSIGN, "/=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_SLASH, "/");
-            }
-        } else if (c == '%') {
-            if ((c = fgetc(infile)) == '=') {
-                add_token(tokens, token_count, T_PERCENT_ASSIGN, "%=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_PERCENT, "%");
-            }
-        } else if (c == '&') {
-            if ((c = fgetc(infile)) == '&') {
-                add_token(tokens, token_count, T_LOGICAL_AND, "&&");
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_AMPERSAND_ASSIGN, "&=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_AMPERSAND, "&");
-            }
-        } else if (c == '|') {
-            if ((c = fgetc(infile)) == '|') {
-                add_token(tokens, token_count, T_LOGICAL_OR, "||");
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_PIPE_ASSIGN, "|=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_PIPE, "|");
-            }
-        } else if (c == '^') {
-            if ((c = fgetc(infile)) == '=') {
-                add_token(tokens, token_count, T_CARET_ASSIGN, "^=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_CARET, "^");
-            }
-        } else if (c == '=') {
-            if ((c = fgetc(infile)) == '=') {
-                add_token(tokens, token_count, T_EQUAL, "==");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_ASSIGN, "=");
-            }
-        } else if (c == '<') {
-            if ((c = fgetc(infile)) == '<') {
-                if ((c = fgetc(infile)) == '=') {
-                    add_token(tokens, token_count, T_SHIFT_LEFT_ASSIGN, "<<=");
+                if (cursor[1] == '=') {
+                    type = T_SLASH_ASSIGN;
+                    cursor += 2;
                 } else {
-                    ungetc(c, infile);
-                    add_token(tokens, token_count, T_SHIFT_LEFT, "<<");
+                    type = T_SLASH;
+                    cursor++;
                 }
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_LESS_EQUAL, "<=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_LESS, "<");
-            }
-        } else if (c == '>') {
-            if ((c = fgetc(infile)) == '>') {
-                if ((c = fgetc(infile)) == '=') {
-                    add_token(tokens, token_count, T_SHIFT_RIGHT_ASSIGN, ">>=");
+                break;
+            case '%':
+                if (cursor[1] == '=') {
+                    type = T_PERCENT_ASSIGN;
+                    cursor += 2;
                 } else {
-                    ungetc(c, infile);
-                    add_token(tokens, token_count, T_SHIFT_RIGHT, ">>");
+                    type = T_PERCENT;
+                    cursor++;
                 }
-            } else if (c == '=') {
-                add_token(tokens, token_count, T_GREATER_EQUAL, ">=");
-            } else {
-                ungetc(c, infile);
-                add_token(tokens, token_count, T_GREATER, ">");
-            }
-        } else if (isalpha(c)) {
-            buffer[buffer_index++] = c;
-            while (isalnum(c = fgetc(infile)) || c == '_') {
-                buffer[buffer_index++] = c;
-            }
-            ungetc(c, infile);
-            buffer[buffer_index] = '\0';
-
-            if (strcmp(buffer, "char") == 0) {
-                add_token(tokens, token_count, T_CHAR, buffer);
-            } else if (strcmp(buffer, "short") == 0) {
-                add_token(tokens, token_count, T_SHORT, buffer);
-            } else if (strcmp(buffer, "int") == 0) {
-                add_token(tokens, token_count, T_INT, buffer);
-            } else if (strcmp(buffer, "long") == 0) {
-                add_token(tokens, token_count, T_LONG, buffer);
-            } else if (strcmp(buffer, "signed") == 0) {
-                add_token(tokens, token_count, T_SIGNED, buffer);
-            } else if (strcmp(buffer, "unsigned") == 0) {
-                add_token(tokens, token_count, T_UNSIGNED, buffer);
-            } else if (strcmp(buffer, "return") == 0) {
-                add_token(tokens, token_count, T_RETURN, buffer);
-            } else if (strcmp(buffer, "if") == 0) {
-                add_token(tokens, token_count, T_IF, buffer);
-            } else if (strcmp(buffer, "else") == 0) {
-                add_token(tokens, token_count, T_ELSE, buffer);
-            } else if (strcmp(buffer, "while") == 0) {
-                add_token(tokens, token_count, T_WHILE, buffer);
-            } else if (strcmp(buffer, "for") == 0) {
-                add_token(tokens, token_count, T_FOR, buffer);
-            } else if (strcmp(buffer, "break") == 0) {
-                add_token(tokens, token_count, T_BREAK, buffer);
-            } else if (strcmp(buffer, "continue") == 0) {
-                add_token(tokens, token_count, T_CONTINUE, buffer);
-            } else if (strcmp(buffer, "sizeof") == 0) {
-                add_token(tokens, token_count, T_SIZEOF, buffer);
-            } else {
-                add_token(tokens, token_count, T_IDENTIFIER, buffer);
-            }
-            buffer_index = 0;
-        } else if (isdigit(c)) {
-            buffer[buffer_index++] = c;
-            while (isdigit(c = fgetc(infile))) {
-                buffer[buffer_index++] = c;
-            }
-            ungetc(c, infile);
-            buffer[buffer_index] = '\0';
+                break;
+            case '&':
+                if (cursor[1] == '&') {
+                    type = T_LOGICAL_AND;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_AMPERSAND_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_AMPERSAND;
+                    cursor++;
+                }
+                break;
+            case '|':
+                if (cursor[1] == '|') {
+                    type = T_LOGICAL_OR;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_PIPE_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_PIPE;
+                    cursor++;
+                }
+                break;
+            case '^':
+                if (cursor[1] == '=') {
+                    type = T_CARET_ASSIGN;
+                    cursor += 2;
+                } else {
+                    type = T_CARET;
+                    cursor++;
+                }
+                break;
+            case '=':
+                if (cursor[1] == '=') {
+                    type = T_EQUAL;
+                    cursor += 2;
+                } else {
+                    type = T_ASSIGN;
+                    cursor++;
+                }
+                break;
+            case '<':
+                if (cursor[1] == '<' && cursor[2] == '=') {
+                    type = T_SHIFT_LEFT_ASSIGN;
+                    cursor += 3;
+                } else if (cursor[1] == '<') {
+                    type = T_SHIFT_LEFT;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_LESS_EQUAL;
+                    cursor += 2;
+                } else {
+                    type = T_LESS;
+                    cursor++;
+                }
+                break;
+            case '>':
+                if (cursor[1] == '>' && cursor[2] == '=') {
+                    type = T_SHIFT_RIGHT_ASSIGN;
+                    cursor += 3;
+                } else if (cursor[1] == '>') {
+                    type = T_SHIFT_RIGHT;
+                    cursor += 2;
+                } else if (cursor[1] == '=') {
+                    type = T_GREATER_EQUAL;
+                    cursor += 2;
+                } else {
+                    type = T_GREATER;
+                    cursor++;
+                }
+                break;
+            default:
+                if (isalpha((unsigned char)*cursor)) {
+                    cursor++;
+                    while (is_identifier_char(*cursor)) {
+                        cursor++;
+                    }
+                    type = classify_word(start, (size_t)(cursor - start));
+                    if (type == T_IDENTIFIER) {
+                        value = intern_string(&unit->strings, start, (size_t)(cursor - start));
+                    }
+                } else if (isdigit((unsigned char)*cursor)) {
+                    cursor++;
+                    while (isdigit((unsigned char)*cursor)) {
+                        cursor++;
+                    }
+                    type = T_INTLIT;
+                    value = intern_string(&unit->strings, start, (size_t)(cursor - start));
+                } else {
+                    if (isprint((unsigned char)*cursor)) {
+                        lex_error_at(&lexer, "invalid character '%c'", *cursor);
+                    } else {
+                        lex_error_at(&lexer, "invalid character '\\x%02x'", (unsigned char)*cursor);
+                    }
+                    return;
+                }
+                break;
+        }
 
-            add_token(tokens, token_count, T_INTLIT, buffer);
-            buffer_index = 0;
-        } else {
-            lex_error_at(token_line, token_column, "invalid character '%c'", c);
+        add_token(&lexer, type, value ? value : token_spellings[type],
+            (int)(start - source), (int)(cursor - start));
+        if (one_declaration && ends_declaration(&lexer, type)) {
+            break;
         }
     }
 
-    token_line = current_line;
-    token_column = current_column + 1;
-    add_token(tokens, token_count, T_EOF, "EOF");
+    position->offset = (size_t)(cursor - source);
+    position->line_start = (size_t)(line_start - source);
+    position->line = line;
+    lexer.line = line;
+    lexer.column = (int)(cursor - line_start) + 1;
+    add_token(&lexer, T_EOF, token_spellings[T_EOF], (int)(cursor - source), 0);
 }
 
-void add_token(struct token **tokens, int *token_count, TokenType type, const char *value)
+void lex(struct compilation *unit, const char *source, size_t length)
 {
-    *tokens = realloc(*tokens, (*token_count + 1) * sizeof(struct token));
-    if (!*tokens) {
-        perror("Error allocating token");
-        exit(EXIT_FAILURE);
-    }
+    struct lexer lexer = { unit, 1, 1, 0, 0 };
+    struct lex_cursor position = { 0, 0, 1 };
 
-    (*tokens)[*token_count].type = type;
-    (*tokens)[*token_count].location.line = token_line;
-    (*tokens)[*token_count].location.column = token_column;
-    (*tokens)[*token_count].value = strdup(value);
-    (*token_count)++;
+    unit->token_count = 0;
+    reserve_tokens(&lexer, (int)(length / TOKEN_BYTES_ESTIMATE) + 16);
+    scan(unit, source, length, &position, 0);
 }
 
-void free_tokens(struct token *tokens, int token_count)
+/*
+ * Streaming compiles lex one top-level declaration per call. The unit's
+ * tokens are replaced with that declaration followed by T_EOF, and position
+ * moves past it; once the source is used up, only T_EOF is left.
+ */
+void lex_declaration(struct compilation *unit, const char *source, size_t length, struct lex_cursor *position)
+{
+    unit->token_count = 0;
+    scan(unit, source, length, position, 1);
+}
+
+void free_tokens(struct token *tokens)
 {
-    for (int i = 0; i < token_count; i++) {
-        free(tokens[i].value);
-    }
     free(tokens);
 }
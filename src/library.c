@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+#include "donkey.h"
+
+/*
+ * A context is a compilation unit that is reset rather than released between
+ * calls, plus an output emitter and a copy of the source with the NUL
+ * sentinel the lexer expects. After the first few calls a context compiles
+ * inputs of similar size without touching the allocator for any of these.
+ */
+struct donkey_context {
+    struct compilation unit;
+    struct emitter assembly;
+    char *source;
+    size_t source_capacity;
+};
+
+struct donkey_context *donkey_create(void)
+{
+    struct donkey_context *context = calloc(1, sizeof(struct donkey_context));
+
+    if (!context) {
+        return NULL;
+    }
+    compilation_init(&context->unit, "<input>");
+    emitter_init(&context->assembly, NULL);
+    return context;
+}
+
+void donkey_destroy(struct donkey_context *context)
+{
+    if (!context) {
+        return;
+    }
+    compilation_release(&context->unit);
+    emitter_release(&context->unit.diagnostics);
+    emitter_release(&context->assembly);
+    free(context->source);
+    free(context);
+}
+
+static void copy_source(struct donkey_context *context, const char *source, size_t length)
+{
+    if (context->source_capacity < length + 1) {
+        char *resized = realloc(context->source, length + 1);
+
+        if (!resized) {
+            perror("Error allocating source buffer");
+            exit(EXIT_FAILURE);
+        }
+        context->source = resized;
+        context->source_capacity = length + 1;
+    }
+    if (length > 0) {
+        memcpy(context->source, source, length);
+    }
+    context->source[length] = '\0';
+}
+
+donkey_status donkey_compile(struct donkey_context *context, const char *name, const char *source,
+    size_t length, const char **assembly, size_t *assembly_length)
+{
+    return donkey_compile_with_options(context, name, source, length, NULL, assembly, assembly_length);
+}
+
+donkey_status donkey_compile_with_options(struct donkey_context *context, const char *name,
+    const char *source, size_t length, const struct donkey_options *options, const char **assembly,
+    size_t *assembly_length)
+{
+    struct compilation *unit;
+
+    if (!context || (!source && length > 0)) {
+        return DONKEY_ERROR_ARGUMENT;
+    }
+
+    unit = &context->unit;
+    compilation_reset(unit, name ? name : "<input>");
+    unit->options.optimize = options ? options->optimize != 0 : 0;
+    unit->options.peephole_off = options ? options->peephole_off & PEEPHOLE_ALL : 0;
+    context->assembly.length = 0;
+    copy_source(context, source, length);
+
+    if (setjmp(unit->fatal)) {
+        return DONKEY_ERROR_SYNTAX;
+    }
+    lex(unit, context->source, length);
+    unit->ast = parse_program(unit);
+
+    if (!semantic_analyze(unit, unit->ast)) {
+        return DONKEY_ERROR_SEMANTIC;
+    }
+    if (!generate_program(unit, unit->ast, &context->assembly)) {
+        return DONKEY_ERROR_CODEGEN;
+    }
+
+    if (assembly) {
+        *assembly = emitter_text(&context->assembly);
+    }
+    if (assembly_length) {
+        *assembly_length = context->assembly.length;
+    }
+    return DONKEY_OK;
+}
+
+int donkey_peephole_rule(const char *name)
+{
+    return name ? peephole_rule_index(name) : -1;
+}
+
+const char *donkey_diagnostics(struct donkey_context *context)
+{
+    return emitter_text(&context->unit.diagnostics);
+}
+
+const char *donkey_status_string(donkey_status status)
+{
+    switch (status) {
+        case DONKEY_OK:
+            return "ok";
+        case DONKEY_ERROR_ARGUMENT:
+            return "invalid argument";
+        case DONKEY_ERROR_SYNTAX:
+            return "syntax error";
+        case DONKEY_ERROR_SEMANTIC:
+            return "semantic error";
+        case DONKEY_ERROR_CODEGEN:
+            return "code generation error";
+    }
+    return "unknown status";
+}
@@ -1,44 +1,164 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "defs.h"
 #include "decl.h"
 
-int main(int argc, char *argv[])
+static void usage(const char *program)
 {
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s <input_file> [output_file]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    fprintf(stderr, "Usage: %s [options] <input_file> [output_file]\n", program);
+    fprintf(stderr, "       %s [options] [-j jobs] [-o output_dir] <input_file>...\n", program);
+    fprintf(stderr, "       %s --serve <socket_path>\n", program);
+    fprintf(stderr, "       %s [-O] [-fno-peephole[=rule]] --client <socket_path> <input_file> [output_file]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --cache <dir>        Reuse generated functions from earlier compiles\n");
+    fprintf(stderr, "  --stream             Compile one top-level declaration at a time to bound memory\n");
+    fprintf(stderr, "  --function-jobs <n>  Check and generate functions on n threads\n");
+    fprintf(stderr, "  -O, -O0              Keep variables and temporaries in registers, or not\n");
+    fprintf(stderr, "  -fno-peephole[=rule] Skip the peephole pass, or one of its rules\n");
+    fprintf(stderr, "  -fpeephole-report    Print how often each peephole rule fired\n");
+    fprintf(stderr, "  -ftime-report        Print time spent in each phase\n");
+    fprintf(stderr, "  -fmem-report         Print arena allocations and peak memory per phase\n");
+    fprintf(stderr, "  --stats-json <file>  Write per-file statistics as JSON ('-' for stdout)\n");
+    exit(EXIT_FAILURE);
+}
+
+static int compile_single(const char *input, const char *output_file, const struct compile_options *options)
+{
+    struct compilation unit;
+    size_t diagnostics_length;
+    char *diagnostics;
+    int ok;
+
+    compilation_init(&unit, input);
+    unit.options = *options;
+    ok = compile_unit(&unit, output_file);
+    diagnostics_length = unit.diagnostics.length;
+    diagnostics = emitter_take(&unit.diagnostics);
+    fwrite(diagnostics, 1, diagnostics_length, stderr);
+    free(diagnostics);
+    if (ok) {
+        printf("Compiled %s -> %s\n", input, output_file);
     }
+    if (options->stats_json && !stats_write_json(options->stats_json, &input, &ok, &unit.stats, 1)) {
+        ok = 0;
+    }
+    return ok;
+}
 
-    const char *output_file = argc == 3 ? argv[2] : "output.asm";
+int main(int argc, char *argv[])
+{
+    const char **inputs = calloc((size_t)argc, sizeof(const char *));
+    const char *output_dir = NULL;
+    const char *client_socket = NULL;
+    const char *local_option = NULL;
+    struct compile_options options = { NULL, NULL, 0, 0, 0, 1, 0, 0, 0 };
+    int input_count = 0;
+    int jobs = 0;
+    int ok;
 
-    FILE *infile = fopen(argv[1], "r");
-    if (!infile) {
-        perror("Error opening file");
+    if (!inputs) {
+        perror("Error allocating input list");
         exit(EXIT_FAILURE);
     }
 
-    struct token *tokens = NULL;
-    int token_count = 0;
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        free(inputs);
+        return serve(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        int codegen_option = parse_codegen_option(&options, argv[i]);
 
-    lex(infile, argv[1], &tokens, &token_count);
+        if (codegen_option < 0) {
+            usage(argv[0]);
+        } else if (codegen_option > 0) {
+            continue;
+        }
+        if (strcmp(argv[i], "--client") == 0) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            client_socket = argv[++i];
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] && !local_option) {
+            local_option = argv[i];
+        }
+        if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            jobs = atoi(count);
+            if (jobs < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            output_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            options.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--stats-json") == 0) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            options.stats_json = argv[++i];
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = 1;
+        } else if (strcmp(argv[i], "--function-jobs") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                usage(argv[0]);
+            }
+            options.function_jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-fpeephole-report") == 0) {
+            options.peephole_report = 1;
+        } else if (strcmp(argv[i], "-ftime-report") == 0) {
+            options.time_report = 1;
+        } else if (strcmp(argv[i], "-fmem-report") == 0) {
+            options.mem_report = 1;
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            usage(argv[0]);
+        } else {
+            inputs[input_count++] = argv[i];
+        }
+    }
 
-    int token_index = 0;
-    struct ast_node *ast = parse_program(tokens, &token_index, argv[1]);
+    /* The server only hears about options that change the generated code. */
+    if (client_socket) {
+        if (local_option) {
+            fprintf(stderr, "Option %s cannot be used with --client\n", local_option);
+            free(inputs);
+            return EXIT_FAILURE;
+        }
+        if (input_count < 1 || input_count > 2) {
+            usage(argv[0]);
+        }
+        ok = compile_remote(client_socket, inputs[0], input_count == 2 ? inputs[1] : "output.asm", &options);
+        free(inputs);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    if (!semantic_analyze(ast, argv[1])) {
-        free_ast_node(ast);
-        free_tokens(tokens, token_count);
-        fclose(infile);
+    if (options.cache_dir && !cache_prepare(options.cache_dir)) {
+        free(inputs);
         return EXIT_FAILURE;
     }
 
-    write_assembly_to_file(output_file, ast);
-    printf("Compiled %s -> %s\n", argv[1], output_file);
-
-    free_ast_node(ast);
-    free_tokens(tokens, token_count);
-    fclose(infile);
+    /* Without -j or -o, keep the original one-file interface. */
+    if (!jobs && !output_dir) {
+        if (input_count < 1 || input_count > 2) {
+            usage(argv[0]);
+        }
+        ok = compile_single(inputs[0], input_count == 2 ? inputs[1] : "output.asm", &options);
+    } else {
+        if (input_count < 1) {
+            usage(argv[0]);
+        }
+        ok = compile_batch(inputs, input_count, output_dir ? output_dir : ".", jobs ? jobs : 1, &options) == 0;
+    }
 
-    return EXIT_SUCCESS;
+    free(inputs);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
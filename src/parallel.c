@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * Function-parallel compiles (--function-jobs). Once the signatures and
+ * globals are collected, top-level declarations no longer depend on each
+ * other, so a pool of threads checks them and then emits the functions.
+ * Every thread works on its own semantic and codegen fork with its own arena,
+ * and every declaration reports into its own result. The results are merged
+ * in source order, so the output and diagnostics match a serial compile
+ * byte for byte whatever the scheduling.
+ *
+ * Code generation runs over windows of functions so that only a window's
+ * worth of assembly is held in memory before it is written out.
+ */
+
+#define JOBS_PER_WORKER 256
+
+struct pool;
+
+struct worker {
+    struct pool *pool;
+    struct arena arena;
+    struct semantic *sema;
+    struct codegen *gen;
+};
+
+struct pool {
+    struct ast_node **items;
+    int first;
+    int end;
+    int next;
+    int generating;
+    struct check_result *checks;
+    struct function_result *functions;
+    struct worker *workers;
+    int worker_count;
+#ifdef _WIN32
+    HANDLE *threads;
+    CRITICAL_SECTION lock;
+#else
+    pthread_t *threads;
+    pthread_mutex_t lock;
+#endif
+};
+
+static int take_item(struct pool *pool)
+{
+    int index;
+
+#ifdef _WIN32
+    EnterCriticalSection(&pool->lock);
+    index = pool->next++;
+    LeaveCriticalSection(&pool->lock);
+#else
+    pthread_mutex_lock(&pool->lock);
+    index = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    return index;
+}
+
+static void run_worker(struct worker *worker)
+{
+    struct pool *pool = worker->pool;
+    int index;
+
+    while ((index = take_item(pool)) < pool->end) {
+        struct ast_node *item = pool->items[index];
+
+        if (!pool->generating) {
+            semantic_check_into(worker->sema, item, &pool->checks[index]);
+        } else if (item->type == AST_FUNCTION) {
+            codegen_function_into(worker->gen, item, &pool->functions[index - pool->first]);
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID argument)
+{
+    run_worker(argument);
+    return 0;
+}
+#else
+static void *worker_main(void *argument)
+{
+    run_worker(argument);
+    return NULL;
+}
+#endif
+
+/* Hands items [first, end) to the workers and returns once all are done. */
+static void run_pool(struct pool *pool, int first, int end)
+{
+    int count = end - first < pool->worker_count ? end - first : pool->worker_count;
+    int started = 0;
+
+    pool->first = first;
+    pool->end = end;
+    pool->next = first;
+
+    for (int i = 1; i < count; i++) {
+#ifdef _WIN32
+        pool->threads[started] = CreateThread(NULL, 0, worker_main, &pool->workers[i], 0, NULL);
+        if (pool->threads[started]) {
+            started++;
+        }
+#else
+        if (pthread_create(&pool->threads[started], NULL, worker_main, &pool->workers[i]) == 0) {
+            started++;
+        }
+#endif
+    }
+
+    /* As in batch mode, the calling thread works too. */
+    run_worker(&pool->workers[0]);
+
+    for (int i = 0; i < started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+}
+
+static int check_all(struct compilation *unit, struct pool *pool, int item_count)
+{
+    struct semantic *sema = semantic_create(unit);
+    int ok;
+
+    semantic_declare(sema, unit->ast);
+
+    stats_phase_begin(unit);
+    pool->checks = calloc(item_count > 0 ? (size_t)item_count : 1, sizeof(*pool->checks));
+    if (!pool->checks) {
+        perror("Error allocating semantic results");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        pool->workers[i].sema = semantic_fork(sema, &pool->workers[i].arena);
+    }
+    pool->generating = 0;
+    run_pool(pool, 0, item_count);
+    for (int i = 0; i < item_count; i++) {
+        semantic_merge(sema, &pool->checks[i]);
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        struct arena *arena = &pool->workers[i].arena;
+
+        semantic_destroy(pool->workers[i].sema);
+        /* Count the forks' symbols and casts as the serial check would. */
+        unit->ast_arena.allocation_count += arena->allocation_count;
+        unit->ast_arena.allocated_bytes += arena->allocated_bytes;
+        arena->allocation_count = 0;
+        arena->allocated_bytes = 0;
+    }
+    free(pool->checks);
+    stats_phase_end(unit, PHASE_SEMANTIC_CHECK);
+
+    ok = semantic_finish(sema);
+    semantic_destroy(sema);
+    return ok;
+}
+
+static int generate_all(struct compilation *unit, struct pool *pool, int item_count,
+    struct emitter *output)
+{
+    struct codegen *gen = codegen_create(unit, output);
+    int window = pool->worker_count * JOBS_PER_WORKER;
+
+    pool->functions = calloc((size_t)window, sizeof(*pool->functions));
+    if (!pool->functions) {
+        perror("Error allocating function results");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < item_count; i++) {
+        if (pool->items[i]->type == AST_GLOBAL_DECL) {
+            codegen_add_global(gen, pool->items[i]);
+        }
+    }
+    codegen_emit_globals(gen);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pool->workers[i].gen = codegen_fork(gen);
+    }
+    pool->generating = 1;
+    for (int first = 0; first < item_count; first += window) {
+        int end = item_count - first < window ? item_count : first + window;
+
+        run_pool(pool, first, end);
+        for (int i = first; i < end; i++) {
+            if (pool->items[i]->type == AST_FUNCTION) {
+                codegen_merge(gen, &pool->functions[i - first]);
+            }
+        }
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        codegen_destroy(pool->workers[i].gen, 0);
+    }
+    free(pool->functions);
+    return codegen_destroy(gen, 1);
+}
+
+/* Compiles the unit's parsed AST to output_path with unit->options.function_jobs threads. */
+int compile_parallel(struct compilation *unit, const char *output_path)
+{
+    struct ast_node *list = unit->ast ? unit->ast->left : NULL;
+    int item_count = list ? list->child_count : 0;
+    struct pool pool;
+    FILE *file;
+    struct emitter output;
+    int ok;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.items = list ? list->children : NULL;
+    pool.worker_count = unit->options.function_jobs;
+    pool.workers = calloc((size_t)pool.worker_count, sizeof(*pool.workers));
+    pool.threads = calloc((size_t)pool.worker_count, sizeof(*pool.threads));
+    if (!pool.workers || !pool.threads) {
+        perror("Error allocating function workers");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < pool.worker_count; i++) {
+        pool.workers[i].pool = &pool;
+    }
+#ifdef _WIN32
+    InitializeCriticalSection(&pool.lock);
+#else
+    pthread_mutex_init(&pool.lock, NULL);
+#endif
+
+    ok = check_all(unit, &pool, item_count);
+    if (ok) {
+        file = fopen(output_path, "w");
+        if (!file) {
+            compilation_diagnostic(unit, "Failed to open %s for writing: %s\n", output_path, strerror(errno));
+            ok = 0;
+        } else {
+            stats_phase_begin(unit);
+            emitter_init(&output, file);
+            ok = generate_all(unit, &pool, item_count, &output);
+            emitter_flush(&output);
+            unit->stats.bytes_emitted = output.flushed;
+            emitter_release(&output);
+            fclose(file);
+            stats_phase_end(unit, PHASE_CODEGEN);
+            if (!ok) {
+                remove(output_path);
+            }
+        }
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&pool.lock);
+#else
+    pthread_mutex_destroy(&pool.lock);
+#endif
+    for (int i = 0; i < pool.worker_count; i++) {
+        arena_free(&pool.workers[i].arena);
+    }
+    free(pool.workers);
+    free(pool.threads);
+    return ok;
+}
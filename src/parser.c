@@ -5,19 +5,17 @@
 #include <string.h>
 #include "decl.h"
 
-static const char *parser_source_path;
-
-static void parse_error_at(struct token *token, const char *format, ...)
+static void parse_error_at(struct parser *parser, struct token *token, const char *format, ...)
 {
     va_list args;
 
-    fprintf(stderr, "Parse error at %s:%d:%d: ",
-        parser_source_path, token->location.line, token->location.column);
+    compilation_diagnostic(parser->unit, "Parse error at %s:%d:%d: ",
+        parser->unit->source_path, token->location.line, token->location.column);
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    compilation_vdiagnostic(parser->unit, format, args);
     va_end(args);
-    fprintf(stderr, "\n");
-    exit(EXIT_FAILURE);
+    compilation_diagnostic(parser->unit, "\n");
+    compilation_fail(parser->unit);
 }
 
 static const char* parse_type_name(struct token *tokens, int *token_index)
@@ -81,67 +79,94 @@ static int parse_pointer_stars(struct token *tokens, int *token_index)
     return pointer_depth;
 }
 
-static int parse_array_length(struct token *tokens, int *token_index)
+static int parse_array_length(struct parser *parser)
 {
     int length;
 
-    if (tokens[*token_index].type != T_OPENBRACKET) {
+    if (parser->tokens[parser->index].type != T_OPENBRACKET) {
         return 0;
     }
-    (*token_index)++;
-    if (tokens[*token_index].type != T_INTLIT) {
-        parse_error_at(&tokens[*token_index], "expected array length, found '%s'",
-            tokens[*token_index].value);
+    parser->index++;
+    if (parser->tokens[parser->index].type != T_INTLIT) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected array length, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    length = atoi(tokens[*token_index].value);
+    length = atoi(parser->tokens[parser->index].value);
     if (length <= 0) {
-        parse_error_at(&tokens[*token_index], "array length must be greater than zero");
+        parse_error_at(parser, &parser->tokens[parser->index], "array length must be greater than zero");
     }
-    (*token_index)++;
-    if (tokens[*token_index].type != T_CLOSEBRACKET) {
-        parse_error_at(&tokens[*token_index], "expected ']', found '%s'",
-            tokens[*token_index].value);
+    parser->index++;
+    if (parser->tokens[parser->index].type != T_CLOSEBRACKET) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ']', found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
     return length;
 }
 
-static struct ast_node* parse_initializer(struct token *tokens, int *token_index);
-
-static struct ast_node* parse_initializer_list(struct token *tokens, int *token_index)
+/*
+ * Elements of the lists being parsed wait on a stack in the unit, so lists
+ * are built in a loop however long they are. Inner lists finish first and pop
+ * back to where they started, leaving the enclosing list's elements in place.
+ */
+static void push_list_item(struct parser *parser, struct ast_node *item)
 {
-    if (tokens[*token_index].type == T_CLOSEBRACE) {
-        return NULL;
-    }
+    struct compilation *unit = parser->unit;
 
-    struct ast_node *initializer = parse_initializer(tokens, token_index);
-    struct ast_node *rest = NULL;
-    if (tokens[*token_index].type == T_COMMA) {
-        (*token_index)++;
-        rest = parse_initializer_list(tokens, token_index);
+    if (unit->list_item_count == unit->list_item_capacity) {
+        int capacity = unit->list_item_capacity ? unit->list_item_capacity * 2 : 64;
+        struct ast_node **items = realloc(unit->list_items, (size_t)capacity * sizeof(*items));
+
+        if (!items) {
+            perror("Error allocating AST list");
+            exit(EXIT_FAILURE);
+        }
+        unit->list_items = items;
+        unit->list_item_capacity = capacity;
     }
+    unit->list_items[unit->list_item_count++] = item;
+}
 
-    return create_ast_node(AST_INITIALIZER_LIST, NULL, initializer, rest);
+/* Moves the items pushed since base into a new list node. */
+static struct ast_node* finish_list(struct parser *parser, ASTNodeType type, int base, SourceLocation location)
+{
+    struct compilation *unit = parser->unit;
+    struct ast_node *list = create_ast_node_at(unit, type, NULL, NULL, NULL, location);
+    int count = unit->list_item_count - base;
+
+    if (count > 0) {
+        list->children = arena_alloc(&unit->ast_arena, (size_t)count * sizeof(*list->children));
+        memcpy(list->children, unit->list_items + base, (size_t)count * sizeof(*list->children));
+        list->child_count = count;
+    }
+    unit->list_item_count = base;
+    return list;
 }
 
-static struct ast_node* parse_initializer(struct token *tokens, int *token_index)
+static struct ast_node* parse_initializer(struct parser *parser)
 {
     SourceLocation location;
-    struct ast_node *list;
+    int base = parser->unit->list_item_count;
 
-    if (tokens[*token_index].type != T_OPENBRACE) {
-        return parse_assignment(tokens, token_index);
+    if (parser->tokens[parser->index].type != T_OPENBRACE) {
+        return parse_assignment(parser);
     }
 
-    location = tokens[*token_index].location;
-    (*token_index)++;
-    list = parse_initializer_list(tokens, token_index);
-    if (tokens[*token_index].type != T_CLOSEBRACE) {
-        parse_error_at(&tokens[*token_index], "expected '}', found '%s'",
-            tokens[*token_index].value);
+    location = parser->tokens[parser->index].location;
+    parser->index++;
+    while (parser->tokens[parser->index].type != T_CLOSEBRACE) {
+        push_list_item(parser, parse_initializer(parser));
+        if (parser->tokens[parser->index].type != T_COMMA) {
+            break;
+        }
+        parser->index++;
+    }
+    if (parser->tokens[parser->index].type != T_CLOSEBRACE) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected '}', found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
-    return create_ast_node_at(AST_INITIALIZER_LIST, NULL, list, NULL, location);
+    parser->index++;
+    return finish_list(parser, AST_INITIALIZER_LIST, base, location);
 }
 
 static int is_type_start(TokenType type)
@@ -150,118 +175,160 @@ static int is_type_start(TokenType type)
         type == T_LONG || type == T_SIGNED || type == T_UNSIGNED;
 }
 
-struct ast_node* parse_program(struct token *tokens, int *token_index, const char *source_path)
+struct ast_node* parse_program(struct compilation *unit)
 {
-    parser_source_path = source_path;
-    return create_ast_node_at(AST_PROGRAM, NULL, parse_function_list(tokens, token_index), NULL,
-        tokens[*token_index].location);
+    struct parser parser = { unit, unit->tokens, 0 };
+    struct ast_node *functions = parse_function_list(&parser);
+
+    return create_ast_node_at(unit, AST_PROGRAM, NULL, functions, NULL,
+        parser.tokens[parser.index].location);
 }
 
-struct ast_node* parse_function_list(struct token *tokens, int *token_index)
+struct ast_node* parse_function_list(struct parser *parser)
 {
-    if (tokens[*token_index].type == T_EOF) {
-        return NULL;
-    }
+    SourceLocation location = parser->tokens[parser->index].location;
+    int base = parser->unit->list_item_count;
 
-    struct ast_node *function = parse_external_declaration(tokens, token_index);
-    struct ast_node *rest = parse_function_list(tokens, token_index);
+    while (parser->tokens[parser->index].type != T_EOF) {
+        push_list_item(parser, parse_external_declaration(parser));
+    }
 
-    return create_ast_node(AST_FUNCTION_LIST, NULL, function, rest);
+    return finish_list(parser, AST_FUNCTION_LIST, base, location);
 }
 
-struct ast_node* parse_external_declaration(struct token *tokens, int *token_index)
+static int is_function_definition(struct parser *parser)
 {
-    int name_index = *token_index;
+    int name_index = parser->index;
 
-    if (!parse_type_name(tokens, &name_index)) {
-        parse_error_at(&tokens[*token_index], "expected top-level declaration, found '%s'",
-            tokens[*token_index].value);
+    if (!parse_type_name(parser->tokens, &name_index)) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected top-level declaration, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    parse_pointer_stars(tokens, &name_index);
+    parse_pointer_stars(parser->tokens, &name_index);
 
-    if (tokens[name_index].type != T_IDENTIFIER) {
-        parse_error_at(&tokens[name_index], "expected identifier in top-level declaration, found '%s'",
-            tokens[name_index].value);
+    if (parser->tokens[name_index].type != T_IDENTIFIER) {
+        parse_error_at(parser, &parser->tokens[name_index], "expected identifier in top-level declaration, found '%s'",
+            parser->tokens[name_index].value);
     }
 
-    if (tokens[name_index + 1].type == T_OPENPAREN) {
-        return parse_function(tokens, token_index);
+    return parser->tokens[name_index + 1].type == T_OPENPAREN;
+}
+
+struct ast_node* parse_external_declaration(struct parser *parser)
+{
+    if (is_function_definition(parser)) {
+        return parse_function(parser);
     }
 
-    return parse_global_declaration(tokens, token_index);
+    return parse_global_declaration(parser);
 }
 
-struct ast_node* parse_function(struct token *tokens, int *token_index)
+/*
+ * Parses the single top-level declaration that lex_declaration() left in the
+ * unit, for streaming compiles. With signatures set, a function's body is
+ * skipped; without it, global declarations are skipped and yield NULL.
+ */
+struct ast_node* parse_top_level(struct compilation *unit, int signatures)
 {
-    const char *type_name = parse_type_name(tokens, token_index);
+    struct parser parser = { unit, unit->tokens, 0 };
+    struct ast_node *declaration;
+
+    if (is_function_definition(&parser)) {
+        if (signatures) {
+            return parse_function_signature(&parser);
+        }
+        declaration = parse_function(&parser);
+    } else if (signatures) {
+        declaration = parse_global_declaration(&parser);
+    } else {
+        return NULL;
+    }
+
+    if (parser.tokens[parser.index].type != T_EOF) {
+        parse_error_at(&parser, &parser.tokens[parser.index], "expected top-level declaration, found '%s'",
+            parser.tokens[parser.index].value);
+    }
+    return declaration;
+}
+
+/* Parses a function up to its body, which is left to the caller. */
+struct ast_node* parse_function_signature(struct parser *parser)
+{
+    const char *type_name = parse_type_name(parser->tokens, &parser->index);
     struct token *tok;
     int pointer_depth;
 
     if (!type_name) {
-        parse_error_at(&tokens[*token_index], "expected function return type, found '%s'",
-            tokens[*token_index].value);
+        parse_error_at(parser, &parser->tokens[parser->index], "expected function return type, found '%s'",
+            parser->tokens[parser->index].value);
     }
 
-    pointer_depth = parse_pointer_stars(tokens, token_index);
-    tok = &tokens[*token_index];
+    pointer_depth = parse_pointer_stars(parser->tokens, &parser->index);
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_IDENTIFIER) {
-        parse_error_at(tok, "expected identifier, found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected identifier, found '%s'", tok->value);
     }
 
-    char *func_name = tok->value;
+    const char *func_name = tok->value;
     SourceLocation function_location = tok->location;
-    (*token_index)++;
+    parser->index++;
 
-    tok = &tokens[*token_index];
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_OPENPAREN) {
-        parse_error_at(tok, "expected '(', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected '(', found '%s'", tok->value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *params = parse_param_list(tokens, token_index);
+    struct ast_node *params = parse_param_list(parser);
 
-    tok = &tokens[*token_index];
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_CLOSEPAREN) {
-        parse_error_at(tok, "expected ')', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected ')', found '%s'", tok->value);
     }
-    (*token_index)++;
-
-    struct ast_node *body = parse_block(tokens, token_index);
+    parser->index++;
 
-    struct ast_node *function = create_ast_node_at(AST_FUNCTION, func_name, params, body, function_location);
+    struct ast_node *function = create_ast_node_at(parser->unit, AST_FUNCTION, func_name, params, NULL, function_location);
     function->data_type = type_from_name(type_name);
     function->pointer_depth = pointer_depth;
     return function;
 }
 
-struct ast_node* parse_global_declaration(struct token *tokens, int *token_index)
+struct ast_node* parse_function(struct parser *parser)
+{
+    struct ast_node *function = parse_function_signature(parser);
+
+    function->right = parse_block(parser);
+    return function;
+}
+
+struct ast_node* parse_global_declaration(struct parser *parser)
 {
-    const char *type_name = parse_type_name(tokens, token_index);
-    int pointer_depth = parse_pointer_stars(tokens, token_index);
+    const char *type_name = parse_type_name(parser->tokens, &parser->index);
+    int pointer_depth = parse_pointer_stars(parser->tokens, &parser->index);
 
-    struct token *tok = &tokens[*token_index];
+    struct token *tok = &parser->tokens[parser->index];
     if (tok->type != T_IDENTIFIER) {
-        parse_error_at(tok, "expected global variable name, found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected global variable name, found '%s'", tok->value);
     }
 
-    char *name = tok->value;
+    const char *name = tok->value;
     SourceLocation declaration_location = tok->location;
-    (*token_index)++;
-    int array_length = parse_array_length(tokens, token_index);
+    parser->index++;
+    int array_length = parse_array_length(parser);
 
     struct ast_node *initializer = NULL;
-    if (tokens[*token_index].type == T_ASSIGN) {
-        (*token_index)++;
-        initializer = parse_initializer(tokens, token_index);
+    if (parser->tokens[parser->index].type == T_ASSIGN) {
+        parser->index++;
+        initializer = parse_initializer(parser);
     }
 
-    if (tokens[*token_index].type != T_SEMICOLON) {
-        parse_error_at(&tokens[*token_index], "expected ';' after global declaration, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_SEMICOLON) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ';' after global declaration, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *declaration = create_ast_node_at(AST_GLOBAL_DECL, name, initializer, NULL,
+    struct ast_node *declaration = create_ast_node_at(parser->unit, AST_GLOBAL_DECL, name, initializer, NULL,
         declaration_location);
     declaration->data_type = type_from_name(type_name);
     declaration->pointer_depth = pointer_depth;
@@ -269,172 +336,179 @@ struct ast_node* parse_global_declaration(struct token *tokens, int *token_index
     return declaration;
 }
 
-struct ast_node* parse_param_list(struct token *tokens, int *token_index)
+static struct ast_node* parse_param(struct parser *parser);
+
+struct ast_node* parse_param_list(struct parser *parser)
 {
-    if (tokens[*token_index].type == T_CLOSEPAREN) {
-        return NULL;
+    SourceLocation location = parser->tokens[parser->index].location;
+    int base = parser->unit->list_item_count;
+
+    while (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+        push_list_item(parser, parse_param(parser));
+        if (parser->tokens[parser->index].type != T_COMMA) {
+            break;
+        }
+        parser->index++;
     }
 
-    const char *type_name = parse_type_name(tokens, token_index);
+    return finish_list(parser, AST_PARAM_LIST, base, location);
+}
+
+static struct ast_node* parse_param(struct parser *parser)
+{
+    const char *type_name = parse_type_name(parser->tokens, &parser->index);
     int pointer_depth;
     if (!type_name) {
-        parse_error_at(&tokens[*token_index], "expected parameter type, found '%s'",
-            tokens[*token_index].value);
+        parse_error_at(parser, &parser->tokens[parser->index], "expected parameter type, found '%s'",
+            parser->tokens[parser->index].value);
     }
 
-    pointer_depth = parse_pointer_stars(tokens, token_index);
-    struct token *tok = &tokens[*token_index];
+    pointer_depth = parse_pointer_stars(parser->tokens, &parser->index);
+    struct token *tok = &parser->tokens[parser->index];
     if (tok->type != T_IDENTIFIER) {
-        parse_error_at(tok, "expected parameter name, found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected parameter name, found '%s'", tok->value);
     }
 
-    struct ast_node *param = create_ast_node_at(AST_IDENTIFIER, tok->value, NULL, NULL, tok->location);
+    struct ast_node *param = create_ast_node_at(parser->unit, AST_IDENTIFIER, tok->value, NULL, NULL, tok->location);
     param->data_type = type_from_name(type_name);
     param->pointer_depth = pointer_depth;
-    (*token_index)++;
-
-    struct ast_node *rest = NULL;
-    if (tokens[*token_index].type == T_COMMA) {
-        (*token_index)++;
-        rest = parse_param_list(tokens, token_index);
-    }
-
-    return create_ast_node(AST_PARAM_LIST, NULL, param, rest);
+    parser->index++;
+    return param;
 }
 
-struct ast_node* parse_block(struct token *tokens, int *token_index)
+struct ast_node* parse_block(struct parser *parser)
 {
-    struct token *tok = &tokens[*token_index];
+    struct token *tok = &parser->tokens[parser->index];
 
     if (tok->type != T_OPENBRACE) {
-        parse_error_at(tok, "expected '{', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected '{', found '%s'", tok->value);
     }
     SourceLocation block_location = tok->location;
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *statements = parse_statement_list(tokens, token_index);
+    struct ast_node *statements = parse_statement_list(parser);
 
-    tok = &tokens[*token_index];
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_CLOSEBRACE) {
-        parse_error_at(tok, "expected '}', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected '}', found '%s'", tok->value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    return create_ast_node_at(AST_BLOCK, NULL, statements, NULL, block_location);
+    return create_ast_node_at(parser->unit, AST_BLOCK, NULL, statements, NULL, block_location);
 }
 
-struct ast_node* parse_statement_list(struct token *tokens, int *token_index)
+struct ast_node* parse_statement_list(struct parser *parser)
 {
-    if (tokens[*token_index].type == T_CLOSEBRACE) {
-        return NULL;
-    }
+    SourceLocation location = parser->tokens[parser->index].location;
+    int base = parser->unit->list_item_count;
 
-    struct ast_node *stmt = parse_statement(tokens, token_index);
-    struct ast_node *rest = parse_statement_list(tokens, token_index);
+    while (parser->tokens[parser->index].type != T_CLOSEBRACE) {
+        push_list_item(parser, parse_statement(parser));
+    }
 
-    return create_ast_node(AST_STATEMENT_LIST, NULL, stmt, rest);
+    return finish_list(parser, AST_STATEMENT_LIST, base, location);
 }
 
-struct ast_node* parse_statement(struct token *tokens, int *token_index)
+struct ast_node* parse_statement(struct parser *parser)
 {
-    struct token *tok = &tokens[*token_index];
+    struct token *tok = &parser->tokens[parser->index];
 
     if (tok->type == T_OPENBRACE) {
-        return parse_block(tokens, token_index);
+        return parse_block(parser);
     }
 
     if (is_type_start(tok->type)) {
-        return parse_declaration(tokens, token_index);
+        return parse_declaration(parser);
     }
 
     if (tok->type == T_IF) {
-        return parse_if_statement(tokens, token_index);
+        return parse_if_statement(parser);
     }
 
     if (tok->type == T_WHILE) {
-        return parse_while_statement(tokens, token_index);
+        return parse_while_statement(parser);
     }
 
     if (tok->type == T_FOR) {
-        return parse_for_statement(tokens, token_index);
+        return parse_for_statement(parser);
     }
 
     if (tok->type == T_BREAK) {
         SourceLocation break_location = tok->location;
-        (*token_index)++;
-        tok = &tokens[*token_index];
+        parser->index++;
+        tok = &parser->tokens[parser->index];
         if (tok->type != T_SEMICOLON) {
-            parse_error_at(tok, "expected ';', found '%s'", tok->value);
+            parse_error_at(parser, tok, "expected ';', found '%s'", tok->value);
         }
-        (*token_index)++;
-        return create_ast_node_at(AST_BREAK, NULL, NULL, NULL, break_location);
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_BREAK, NULL, NULL, NULL, break_location);
     }
 
     if (tok->type == T_CONTINUE) {
         SourceLocation continue_location = tok->location;
-        (*token_index)++;
-        tok = &tokens[*token_index];
+        parser->index++;
+        tok = &parser->tokens[parser->index];
         if (tok->type != T_SEMICOLON) {
-            parse_error_at(tok, "expected ';', found '%s'", tok->value);
+            parse_error_at(parser, tok, "expected ';', found '%s'", tok->value);
         }
-        (*token_index)++;
-        return create_ast_node_at(AST_CONTINUE, NULL, NULL, NULL, continue_location);
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_CONTINUE, NULL, NULL, NULL, continue_location);
     }
 
     if (tok->type == T_RETURN) {
         SourceLocation return_location = tok->location;
-        (*token_index)++;
+        parser->index++;
 
-        struct ast_node *exp = parse_exp(tokens, token_index);
+        struct ast_node *exp = parse_exp(parser);
 
-        tok = &tokens[*token_index];
+        tok = &parser->tokens[parser->index];
         if (tok->type != T_SEMICOLON) {
-            parse_error_at(tok, "expected ';', found '%s'", tok->value);
+            parse_error_at(parser, tok, "expected ';', found '%s'", tok->value);
         }
-        (*token_index)++;
+        parser->index++;
 
-        return create_ast_node_at(AST_RETURN, NULL, exp, NULL, return_location);
+        return create_ast_node_at(parser->unit, AST_RETURN, NULL, exp, NULL, return_location);
     }
 
-    struct ast_node *exp = parse_exp(tokens, token_index);
+    struct ast_node *exp = parse_exp(parser);
 
-    tok = &tokens[*token_index];
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_SEMICOLON) {
-        parse_error_at(tok, "expected ';', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected ';', found '%s'", tok->value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    return create_ast_node_at(AST_EXPR_STMT, NULL, exp, NULL, exp->location);
+    return create_ast_node_at(parser->unit, AST_EXPR_STMT, NULL, exp, NULL, exp->location);
 }
 
-struct ast_node* parse_declaration(struct token *tokens, int *token_index)
+struct ast_node* parse_declaration(struct parser *parser)
 {
-    const char *type_name = parse_type_name(tokens, token_index);
-    int pointer_depth = parse_pointer_stars(tokens, token_index);
+    const char *type_name = parse_type_name(parser->tokens, &parser->index);
+    int pointer_depth = parse_pointer_stars(parser->tokens, &parser->index);
 
-    struct token *tok = &tokens[*token_index];
+    struct token *tok = &parser->tokens[parser->index];
     if (tok->type != T_IDENTIFIER) {
-        parse_error_at(tok, "expected identifier in declaration, found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected identifier in declaration, found '%s'", tok->value);
     }
 
-    char *name = tok->value;
+    const char *name = tok->value;
     SourceLocation declaration_location = tok->location;
-    (*token_index)++;
-    int array_length = parse_array_length(tokens, token_index);
+    parser->index++;
+    int array_length = parse_array_length(parser);
 
     struct ast_node *initializer = NULL;
-    if (tokens[*token_index].type == T_ASSIGN) {
-        (*token_index)++;
-        initializer = parse_initializer(tokens, token_index);
+    if (parser->tokens[parser->index].type == T_ASSIGN) {
+        parser->index++;
+        initializer = parse_initializer(parser);
     }
 
-    tok = &tokens[*token_index];
+    tok = &parser->tokens[parser->index];
     if (tok->type != T_SEMICOLON) {
-        parse_error_at(tok, "expected ';', found '%s'", tok->value);
+        parse_error_at(parser, tok, "expected ';', found '%s'", tok->value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *declaration = create_ast_node_at(AST_DECL, name, initializer, NULL,
+    struct ast_node *declaration = create_ast_node_at(parser->unit, AST_DECL, name, initializer, NULL,
         declaration_location);
     declaration->data_type = type_from_name(type_name);
     declaration->pointer_depth = pointer_depth;
@@ -442,241 +516,241 @@ struct ast_node* parse_declaration(struct token *tokens, int *token_index)
     return declaration;
 }
 
-struct ast_node* parse_if_statement(struct token *tokens, int *token_index)
+struct ast_node* parse_if_statement(struct parser *parser)
 {
-    SourceLocation if_location = tokens[*token_index].location;
-    (*token_index)++;
+    SourceLocation if_location = parser->tokens[parser->index].location;
+    parser->index++;
 
-    if (tokens[*token_index].type != T_OPENPAREN) {
-        parse_error_at(&tokens[*token_index], "expected '(' after if, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_OPENPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected '(' after if, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *cond = parse_exp(tokens, token_index);
+    struct ast_node *cond = parse_exp(parser);
 
-    if (tokens[*token_index].type != T_CLOSEPAREN) {
-        parse_error_at(&tokens[*token_index], "expected ')' after if condition, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ')' after if condition, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *then_stmt = parse_statement(tokens, token_index);
+    struct ast_node *then_stmt = parse_statement(parser);
     struct ast_node *else_stmt = NULL;
 
-    if (tokens[*token_index].type == T_ELSE) {
-        (*token_index)++;
-        else_stmt = parse_statement(tokens, token_index);
+    if (parser->tokens[parser->index].type == T_ELSE) {
+        parser->index++;
+        else_stmt = parse_statement(parser);
     }
 
-    return create_ast_node_at(AST_IF, NULL, cond,
-        create_ast_node_at(AST_IF_BRANCHES, NULL, then_stmt, else_stmt, if_location),
+    return create_ast_node_at(parser->unit, AST_IF, NULL, cond,
+        create_ast_node_at(parser->unit, AST_IF_BRANCHES, NULL, then_stmt, else_stmt, if_location),
         if_location);
 }
 
-struct ast_node* parse_while_statement(struct token *tokens, int *token_index)
+struct ast_node* parse_while_statement(struct parser *parser)
 {
-    SourceLocation while_location = tokens[*token_index].location;
-    (*token_index)++;
+    SourceLocation while_location = parser->tokens[parser->index].location;
+    parser->index++;
 
-    if (tokens[*token_index].type != T_OPENPAREN) {
-        parse_error_at(&tokens[*token_index], "expected '(' after while, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_OPENPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected '(' after while, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *cond = parse_exp(tokens, token_index);
+    struct ast_node *cond = parse_exp(parser);
 
-    if (tokens[*token_index].type != T_CLOSEPAREN) {
-        parse_error_at(&tokens[*token_index], "expected ')' after while condition, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ')' after while condition, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    return create_ast_node_at(AST_WHILE, NULL, cond, parse_statement(tokens, token_index),
+    return create_ast_node_at(parser->unit, AST_WHILE, NULL, cond, parse_statement(parser),
         while_location);
 }
 
-struct ast_node* parse_for_statement(struct token *tokens, int *token_index)
+struct ast_node* parse_for_statement(struct parser *parser)
 {
-    SourceLocation for_location = tokens[*token_index].location;
-    (*token_index)++;
+    SourceLocation for_location = parser->tokens[parser->index].location;
+    parser->index++;
 
-    if (tokens[*token_index].type != T_OPENPAREN) {
-        parse_error_at(&tokens[*token_index], "expected '(' after for, found '%s'",
-            tokens[*token_index].value);
+    if (parser->tokens[parser->index].type != T_OPENPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected '(' after for, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *init = parse_for_init(tokens, token_index);
+    struct ast_node *init = parse_for_init(parser);
 
-    struct ast_node *cond = parse_optional_exp(tokens, token_index);
-    if (tokens[*token_index].type != T_SEMICOLON) {
-        parse_error_at(&tokens[*token_index], "expected ';' after for condition, found '%s'",
-            tokens[*token_index].value);
+    struct ast_node *cond = parse_optional_exp(parser);
+    if (parser->tokens[parser->index].type != T_SEMICOLON) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ';' after for condition, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *post = parse_optional_exp(tokens, token_index);
-    if (tokens[*token_index].type != T_CLOSEPAREN) {
-        parse_error_at(&tokens[*token_index], "expected ')' after for clauses, found '%s'",
-            tokens[*token_index].value);
+    struct ast_node *post = parse_optional_exp(parser);
+    if (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ')' after for clauses, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
-    struct ast_node *cond_post = create_ast_node_at(AST_FOR_PARTS, NULL, cond, post, for_location);
-    struct ast_node *parts = create_ast_node_at(AST_FOR_PARTS, NULL, init, cond_post, for_location);
+    struct ast_node *cond_post = create_ast_node_at(parser->unit, AST_FOR_PARTS, NULL, cond, post, for_location);
+    struct ast_node *parts = create_ast_node_at(parser->unit, AST_FOR_PARTS, NULL, init, cond_post, for_location);
 
-    return create_ast_node_at(AST_FOR, NULL, parts, parse_statement(tokens, token_index),
+    return create_ast_node_at(parser->unit, AST_FOR, NULL, parts, parse_statement(parser),
         for_location);
 }
 
-struct ast_node* parse_for_init(struct token *tokens, int *token_index)
+struct ast_node* parse_for_init(struct parser *parser)
 {
-    if (tokens[*token_index].type == T_SEMICOLON) {
-        (*token_index)++;
+    if (parser->tokens[parser->index].type == T_SEMICOLON) {
+        parser->index++;
         return NULL;
     }
 
-    if (is_type_start(tokens[*token_index].type)) {
-        return parse_declaration(tokens, token_index);
+    if (is_type_start(parser->tokens[parser->index].type)) {
+        return parse_declaration(parser);
     }
 
-    struct ast_node *init = parse_exp(tokens, token_index);
-    if (tokens[*token_index].type != T_SEMICOLON) {
-        parse_error_at(&tokens[*token_index], "expected ';' after for initializer, found '%s'",
-            tokens[*token_index].value);
+    struct ast_node *init = parse_exp(parser);
+    if (parser->tokens[parser->index].type != T_SEMICOLON) {
+        parse_error_at(parser, &parser->tokens[parser->index], "expected ';' after for initializer, found '%s'",
+            parser->tokens[parser->index].value);
     }
-    (*token_index)++;
+    parser->index++;
 
     return init;
 }
 
-struct ast_node* parse_optional_exp(struct token *tokens, int *token_index)
+struct ast_node* parse_optional_exp(struct parser *parser)
 {
-    if (tokens[*token_index].type == T_SEMICOLON || tokens[*token_index].type == T_CLOSEPAREN) {
+    if (parser->tokens[parser->index].type == T_SEMICOLON || parser->tokens[parser->index].type == T_CLOSEPAREN) {
         return NULL;
     }
 
-    return parse_exp(tokens, token_index);
+    return parse_exp(parser);
 }
 
-struct ast_node* parse_factor(struct token *tokens, int *token_index)
+struct ast_node* parse_factor(struct parser *parser)
 {
-    struct token *tok = &tokens[*token_index];
+    struct token *tok = &parser->tokens[parser->index];
 
     if (tok->type == T_PLUS_PLUS) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        struct ast_node *operand = parse_factor(tokens, token_index);
+        parser->index++;
+        struct ast_node *operand = parse_factor(parser);
         if (operand->type != AST_IDENTIFIER) {
-            parse_error_at(tok, "operand of prefix ++ must be an identifier");
+            parse_error_at(parser, tok, "operand of prefix ++ must be an identifier");
         }
-        return create_ast_node_at(AST_PRE_INCREMENT, NULL, operand, NULL, operator_location);
+        return create_ast_node_at(parser->unit, AST_PRE_INCREMENT, NULL, operand, NULL, operator_location);
     } else if (tok->type == T_MINUS_MINUS) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        struct ast_node *operand = parse_factor(tokens, token_index);
+        parser->index++;
+        struct ast_node *operand = parse_factor(parser);
         if (operand->type != AST_IDENTIFIER) {
-            parse_error_at(tok, "operand of prefix -- must be an identifier");
+            parse_error_at(parser, tok, "operand of prefix -- must be an identifier");
         }
-        return create_ast_node_at(AST_PRE_DECREMENT, NULL, operand, NULL, operator_location);
+        return create_ast_node_at(parser->unit, AST_PRE_DECREMENT, NULL, operand, NULL, operator_location);
     } else if (tok->type == T_SIZEOF) {
         SourceLocation sizeof_location = tok->location;
-        (*token_index)++;
-        if (tokens[*token_index].type == T_OPENPAREN) {
-            int type_index = *token_index + 1;
-            const char *type_name = parse_type_name(tokens, &type_index);
-            if (type_name && tokens[type_index].type == T_CLOSEPAREN) {
-                *token_index = type_index + 1;
-                struct ast_node *size = create_ast_node_at(AST_SIZEOF, (char *)type_name, NULL, NULL,
+        parser->index++;
+        if (parser->tokens[parser->index].type == T_OPENPAREN) {
+            int type_index = parser->index + 1;
+            const char *type_name = parse_type_name(parser->tokens, &type_index);
+            if (type_name && parser->tokens[type_index].type == T_CLOSEPAREN) {
+                parser->index = type_index + 1;
+                struct ast_node *size = create_ast_node_at(parser->unit, AST_SIZEOF, type_name, NULL, NULL,
                     sizeof_location);
                 size->data_type = TYPE_UINT;
                 return size;
             }
         }
 
-        parse_factor(tokens, token_index);
-        struct ast_node *size = create_ast_node_at(AST_SIZEOF, "int", NULL, NULL, sizeof_location);
+        parse_factor(parser);
+        struct ast_node *size = create_ast_node_at(parser->unit, AST_SIZEOF, "int", NULL, NULL, sizeof_location);
         size->data_type = TYPE_UINT;
         return size;
     } else if (tok->type == T_MINUS) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        return create_ast_node_at(AST_NEGATION, NULL, parse_factor(tokens, token_index), NULL,
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_NEGATION, NULL, parse_factor(parser), NULL,
             operator_location);
     } else if (tok->type == T_LOGICAL_NEGATION) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        return create_ast_node_at(AST_LOGICAL_NEGATION, NULL, parse_factor(tokens, token_index), NULL,
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_LOGICAL_NEGATION, NULL, parse_factor(parser), NULL,
             operator_location);
     } else if (tok->type == T_BITWISE_COMPLEMENT) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        return create_ast_node_at(AST_BITWISE_COMPLEMENT, NULL, parse_factor(tokens, token_index), NULL,
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_BITWISE_COMPLEMENT, NULL, parse_factor(parser), NULL,
             operator_location);
     } else if (tok->type == T_AMPERSAND) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        return create_ast_node_at(AST_ADDRESS_OF, NULL, parse_factor(tokens, token_index), NULL,
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_ADDRESS_OF, NULL, parse_factor(parser), NULL,
             operator_location);
     } else if (tok->type == T_STAR) {
         SourceLocation operator_location = tok->location;
-        (*token_index)++;
-        return create_ast_node_at(AST_DEREFERENCE, NULL, parse_factor(tokens, token_index), NULL,
+        parser->index++;
+        return create_ast_node_at(parser->unit, AST_DEREFERENCE, NULL, parse_factor(parser), NULL,
             operator_location);
     }
 
     if (tok->type == T_INTLIT) {
-        struct ast_node *lit_node = create_ast_node_at(AST_INTLIT, tok->value, NULL, NULL,
+        struct ast_node *lit_node = create_ast_node_at(parser->unit, AST_INTLIT, tok->value, NULL, NULL,
             tok->location);
-        (*token_index)++;
+        parser->index++;
         return lit_node;
     }
 
     if (tok->type == T_IDENTIFIER) {
-        char *name = tok->value;
+        const char *name = tok->value;
         SourceLocation identifier_location = tok->location;
-        (*token_index)++;
-
-        if (tokens[*token_index].type == T_OPENPAREN) {
-            (*token_index)++;
-            struct ast_node *args = parse_arg_list(tokens, token_index);
-            if (tokens[*token_index].type != T_CLOSEPAREN) {
-                parse_error_at(&tokens[*token_index], "expected ')' after function call, found '%s'",
-                    tokens[*token_index].value);
+        parser->index++;
+
+        if (parser->tokens[parser->index].type == T_OPENPAREN) {
+            parser->index++;
+            struct ast_node *args = parse_arg_list(parser);
+            if (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+                parse_error_at(parser, &parser->tokens[parser->index], "expected ')' after function call, found '%s'",
+                    parser->tokens[parser->index].value);
             }
-            (*token_index)++;
-            struct ast_node *call = create_ast_node_at(AST_CALL, name, args, NULL,
+            parser->index++;
+            struct ast_node *call = create_ast_node_at(parser->unit, AST_CALL, name, args, NULL,
                 identifier_location);
-            if (tokens[*token_index].type == T_PLUS_PLUS || tokens[*token_index].type == T_MINUS_MINUS) {
-                parse_error_at(&tokens[*token_index],
+            if (parser->tokens[parser->index].type == T_PLUS_PLUS || parser->tokens[parser->index].type == T_MINUS_MINUS) {
+                parse_error_at(parser, &parser->tokens[parser->index],
                     "postfix increment/decrement requires an identifier");
             }
             return call;
         }
 
-        struct ast_node *id = create_ast_node_at(AST_IDENTIFIER, name, NULL, NULL,
+        struct ast_node *id = create_ast_node_at(parser->unit, AST_IDENTIFIER, name, NULL, NULL,
             identifier_location);
-        while (tokens[*token_index].type == T_OPENBRACKET) {
-            SourceLocation bracket_location = tokens[*token_index].location;
-            (*token_index)++;
-            struct ast_node *index = parse_exp(tokens, token_index);
-            if (tokens[*token_index].type != T_CLOSEBRACKET) {
-                parse_error_at(&tokens[*token_index], "expected ']', found '%s'",
-                    tokens[*token_index].value);
+        while (parser->tokens[parser->index].type == T_OPENBRACKET) {
+            SourceLocation bracket_location = parser->tokens[parser->index].location;
+            parser->index++;
+            struct ast_node *index = parse_exp(parser);
+            if (parser->tokens[parser->index].type != T_CLOSEBRACKET) {
+                parse_error_at(parser, &parser->tokens[parser->index], "expected ']', found '%s'",
+                    parser->tokens[parser->index].value);
             }
-            (*token_index)++;
-            id = create_ast_node_at(AST_ARRAY_SUBSCRIPT, NULL, id, index, bracket_location);
+            parser->index++;
+            id = create_ast_node_at(parser->unit, AST_ARRAY_SUBSCRIPT, NULL, id, index, bracket_location);
         }
-        if (tokens[*token_index].type == T_PLUS_PLUS) {
-            SourceLocation operator_location = tokens[*token_index].location;
-            (*token_index)++;
-            return create_ast_node_at(AST_POST_INCREMENT, NULL, id, NULL, operator_location);
-        } else if (tokens[*token_index].type == T_MINUS_MINUS) {
-            SourceLocation operator_location = tokens[*token_index].location;
-            (*token_index)++;
-            return create_ast_node_at(AST_POST_DECREMENT, NULL, id, NULL, operator_location);
+        if (parser->tokens[parser->index].type == T_PLUS_PLUS) {
+            SourceLocation operator_location = parser->tokens[parser->index].location;
+            parser->index++;
+            return create_ast_node_at(parser->unit, AST_POST_INCREMENT, NULL, id, NULL, operator_location);
+        } else if (parser->tokens[parser->index].type == T_MINUS_MINUS) {
+            SourceLocation operator_location = parser->tokens[parser->index].location;
+            parser->index++;
+            return create_ast_node_at(parser->unit, AST_POST_DECREMENT, NULL, id, NULL, operator_location);
         }
 
         return id;
@@ -684,92 +758,67 @@ struct ast_node* parse_factor(struct token *tokens, int *token_index)
 
     if (tok->type == T_OPENPAREN) {
         SourceLocation paren_location = tok->location;
-        (*token_index)++;
-        int type_index = *token_index;
-        const char *type_name = parse_type_name(tokens, &type_index);
-        if (type_name && tokens[type_index].type == T_CLOSEPAREN) {
-            *token_index = type_index + 1;
-            struct ast_node *cast = create_ast_node_at(AST_CAST, (char *)type_name,
-                parse_factor(tokens, token_index), NULL, paren_location);
+        parser->index++;
+        int type_index = parser->index;
+        const char *type_name = parse_type_name(parser->tokens, &type_index);
+        if (type_name && parser->tokens[type_index].type == T_CLOSEPAREN) {
+            parser->index = type_index + 1;
+            struct ast_node *cast = create_ast_node_at(parser->unit, AST_CAST, type_name,
+                parse_factor(parser), NULL, paren_location);
             cast->data_type = type_from_name(type_name);
             return cast;
         }
 
-        struct ast_node *inner_exp = parse_exp(tokens, token_index);
-        tok = &tokens[*token_index];
+        struct ast_node *inner_exp = parse_exp(parser);
+        tok = &parser->tokens[parser->index];
         if (tok->type != T_CLOSEPAREN) {
-            parse_error_at(tok, "expected closing parenthesis, found '%s'", tok->value);
+            parse_error_at(parser, tok, "expected closing parenthesis, found '%s'", tok->value);
         }
-        (*token_index)++;
+        parser->index++;
         return inner_exp;
     }
 
-    parse_error_at(tok, "unexpected token '%s' in expression parsing", tok->value);
+    parse_error_at(parser, tok, "unexpected token '%s' in expression parsing", tok->value);
     return NULL;
 }
 
-struct ast_node* parse_arg_list(struct token *tokens, int *token_index)
-{
-    if (tokens[*token_index].type == T_CLOSEPAREN) {
-        return NULL;
-    }
-
-    struct ast_node *arg = parse_assignment(tokens, token_index);
-    struct ast_node *rest = NULL;
-
-    if (tokens[*token_index].type == T_COMMA) {
-        (*token_index)++;
-        rest = parse_arg_list(tokens, token_index);
-    }
-
-    return create_ast_node(AST_ARG_LIST, NULL, arg, rest);
-}
-
-struct ast_node* parse_term(struct token *tokens, int *token_index)
+struct ast_node* parse_arg_list(struct parser *parser)
 {
-    struct ast_node *left = parse_factor(tokens, token_index);
+    SourceLocation location = parser->tokens[parser->index].location;
+    int base = parser->unit->list_item_count;
 
-    while (1) {
-        struct token *tok = &tokens[*token_index];
-
-        if (tok->type == T_STAR) {
-            (*token_index)++;
-            left = create_ast_node(AST_MUL, NULL, left, parse_factor(tokens, token_index));
-        } else if (tok->type == T_SLASH) {
-            (*token_index)++;
-            left = create_ast_node(AST_DIV, NULL, left, parse_factor(tokens, token_index));
-        } else if (tok->type == T_PERCENT) {
-            (*token_index)++;
-            left = create_ast_node(AST_MOD, NULL, left, parse_factor(tokens, token_index));
-        } else {
+    while (parser->tokens[parser->index].type != T_CLOSEPAREN) {
+        push_list_item(parser, parse_assignment(parser));
+        if (parser->tokens[parser->index].type != T_COMMA) {
             break;
         }
+        parser->index++;
     }
 
-    return left;
+    return finish_list(parser, AST_ARG_LIST, base, location);
 }
 
-struct ast_node* parse_exp(struct token *tokens, int *token_index)
+struct ast_node* parse_exp(struct parser *parser)
 {
-    return parse_comma(tokens, token_index);
+    return parse_comma(parser);
 }
 
-struct ast_node* parse_comma(struct token *tokens, int *token_index)
+struct ast_node* parse_comma(struct parser *parser)
 {
-    struct ast_node *left = parse_assignment(tokens, token_index);
+    struct ast_node *left = parse_assignment(parser);
 
-    while (tokens[*token_index].type == T_COMMA) {
-        (*token_index)++;
-        left = create_ast_node(AST_COMMA, NULL, left, parse_assignment(tokens, token_index));
+    while (parser->tokens[parser->index].type == T_COMMA) {
+        parser->index++;
+        left = create_ast_node(parser->unit, AST_COMMA, NULL, left, parse_assignment(parser));
     }
 
     return left;
 }
 
-struct ast_node* parse_assignment(struct token *tokens, int *token_index)
+struct ast_node* parse_assignment(struct parser *parser)
 {
-    struct ast_node *left = parse_conditional(tokens, token_index);
-    TokenType op = tokens[*token_index].type;
+    struct ast_node *left = parse_conditional(parser);
+    TokenType op = parser->tokens[parser->index].type;
 
     if (op == T_ASSIGN || op == T_PLUS_ASSIGN || op == T_MINUS_ASSIGN ||
         op == T_STAR_ASSIGN || op == T_SLASH_ASSIGN || op == T_PERCENT_ASSIGN ||
@@ -778,18 +827,18 @@ struct ast_node* parse_assignment(struct token *tokens, int *token_index)
         if (left->type != AST_IDENTIFIER &&
             left->type != AST_DEREFERENCE &&
             left->type != AST_ARRAY_SUBSCRIPT) {
-            parse_error_at(&tokens[*token_index], "left side of assignment must be an identifier");
+            parse_error_at(parser, &parser->tokens[parser->index], "left side of assignment must be an identifier");
         }
 
-        SourceLocation operator_location = tokens[*token_index].location;
-        (*token_index)++;
-        struct ast_node *right = parse_assignment(tokens, token_index);
+        SourceLocation operator_location = parser->tokens[parser->index].location;
+        parser->index++;
+        struct ast_node *right = parse_assignment(parser);
 
         if (op == T_ASSIGN) {
-            return create_ast_node_at(AST_ASSIGN, NULL, left, right, operator_location);
+            return create_ast_node_at(parser->unit, AST_ASSIGN, NULL, left, right, operator_location);
         }
         if (left->type != AST_IDENTIFIER) {
-            parse_error_at(&tokens[*token_index],
+            parse_error_at(parser, &parser->tokens[parser->index],
                 "compound assignment target must be an identifier");
         }
 
@@ -804,12 +853,12 @@ struct ast_node* parse_assignment(struct token *tokens, int *token_index)
         else if (op == T_SHIFT_LEFT_ASSIGN) binop = AST_SHIFT_LEFT;
         else if (op == T_SHIFT_RIGHT_ASSIGN) binop = AST_SHIFT_RIGHT;
 
-        return create_ast_node(
+        return create_ast_node(parser->unit, 
             AST_ASSIGN,
             NULL,
             left,
-            create_ast_node_at(binop, NULL,
-                create_ast_node_at(AST_IDENTIFIER, left->value, NULL, NULL, left->location),
+            create_ast_node_at(parser->unit, binop, NULL,
+                create_ast_node_at(parser->unit, AST_IDENTIFIER, left->value, NULL, NULL, left->location),
                 right,
                 operator_location)
         );
@@ -818,184 +867,82 @@ struct ast_node* parse_assignment(struct token *tokens, int *token_index)
     return left;
 }
 
-struct ast_node* parse_conditional(struct token *tokens, int *token_index)
+struct ast_node* parse_conditional(struct parser *parser)
 {
-    struct ast_node *cond = parse_logical_or(tokens, token_index);
+    struct ast_node *cond = parse_binary(parser, 1);
 
-    if (tokens[*token_index].type == T_QUESTION) {
-        (*token_index)++;
-        struct ast_node *then_exp = parse_exp(tokens, token_index);
+    if (parser->tokens[parser->index].type == T_QUESTION) {
+        parser->index++;
+        struct ast_node *then_exp = parse_exp(parser);
 
-        if (tokens[*token_index].type != T_COLON) {
-            parse_error_at(&tokens[*token_index],
+        if (parser->tokens[parser->index].type != T_COLON) {
+            parse_error_at(parser, &parser->tokens[parser->index],
                 "expected ':' in conditional expression, found '%s'",
-                tokens[*token_index].value);
+                parser->tokens[parser->index].value);
         }
-        (*token_index)++;
+        parser->index++;
 
-        struct ast_node *else_exp = parse_conditional(tokens, token_index);
-        return create_ast_node(
+        struct ast_node *else_exp = parse_conditional(parser);
+        return create_ast_node(parser->unit, 
             AST_CONDITIONAL,
             NULL,
             cond,
-            create_ast_node(AST_CONDITIONAL_BRANCHES, NULL, then_exp, else_exp)
+            create_ast_node(parser->unit, AST_CONDITIONAL_BRANCHES, NULL, then_exp, else_exp)
         );
     }
 
     return cond;
 }
 
-struct ast_node* parse_logical_or(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_logical_and(tokens, token_index);
-
-    while (tokens[*token_index].type == T_LOGICAL_OR) {
-        (*token_index)++;
-        left = create_ast_node(AST_LOGICAL_OR, NULL, left, parse_logical_and(tokens, token_index));
-    }
-
-    return left;
-}
-
-struct ast_node* parse_logical_and(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_bitwise_or(tokens, token_index);
-
-    while (tokens[*token_index].type == T_LOGICAL_AND) {
-        (*token_index)++;
-        left = create_ast_node(AST_LOGICAL_AND, NULL, left, parse_bitwise_or(tokens, token_index));
-    }
-
-    return left;
-}
-
-struct ast_node* parse_bitwise_or(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_bitwise_xor(tokens, token_index);
-
-    while (tokens[*token_index].type == T_PIPE) {
-        (*token_index)++;
-        left = create_ast_node(AST_BITWISE_OR, NULL, left, parse_bitwise_xor(tokens, token_index));
-    }
-
-    return left;
-}
-
-struct ast_node* parse_bitwise_xor(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_bitwise_and(tokens, token_index);
-
-    while (tokens[*token_index].type == T_CARET) {
-        (*token_index)++;
-        left = create_ast_node(AST_BITWISE_XOR, NULL, left, parse_bitwise_and(tokens, token_index));
-    }
-
-    return left;
-}
-
-struct ast_node* parse_bitwise_and(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_equality(tokens, token_index);
-
-    while (tokens[*token_index].type == T_AMPERSAND) {
-        (*token_index)++;
-        left = create_ast_node(AST_BITWISE_AND, NULL, left, parse_equality(tokens, token_index));
-    }
-
-    return left;
-}
-
-struct ast_node* parse_equality(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_relational(tokens, token_index);
+/*
+ * Binary operators by token, from loosest (||) to tightest (* / %). Every
+ * level is left-associative, so a single precedence-climbing loop builds the
+ * same trees as one descent function per level would, without walking
+ * through every level for each operand.
+ */
+static const struct binary_operator {
+    int precedence;
+    ASTNodeType node_type;
+} binary_operators[T_INVALID + 1] = {
+    [T_LOGICAL_OR] = { 1, AST_LOGICAL_OR },
+    [T_LOGICAL_AND] = { 2, AST_LOGICAL_AND },
+    [T_PIPE] = { 3, AST_BITWISE_OR },
+    [T_CARET] = { 4, AST_BITWISE_XOR },
+    [T_AMPERSAND] = { 5, AST_BITWISE_AND },
+    [T_EQUAL] = { 6, AST_EQUAL },
+    [T_NOT_EQUAL] = { 6, AST_NOT_EQUAL },
+    [T_LESS] = { 7, AST_LESS },
+    [T_LESS_EQUAL] = { 7, AST_LESS_EQUAL },
+    [T_GREATER] = { 7, AST_GREATER },
+    [T_GREATER_EQUAL] = { 7, AST_GREATER_EQUAL },
+    [T_SHIFT_LEFT] = { 8, AST_SHIFT_LEFT },
+    [T_SHIFT_RIGHT] = { 8, AST_SHIFT_RIGHT },
+    [T_PLUS] = { 9, AST_ADD },
+    [T_MINUS] = { 9, AST_SUB },
+    [T_STAR] = { 10, AST_MUL },
+    [T_SLASH] = { 10, AST_DIV },
+    [T_PERCENT] = { 10, AST_MOD },
+};
+
+/* Parses operators that bind at least as tightly as min_precedence. */
+struct ast_node* parse_binary(struct parser *parser, int min_precedence)
+{
+    struct ast_node *left = parse_factor(parser);
 
     while (1) {
-        struct token *tok = &tokens[*token_index];
-
-        if (tok->type == T_EQUAL) {
-            (*token_index)++;
-            left = create_ast_node(AST_EQUAL, NULL, left, parse_relational(tokens, token_index));
-        } else if (tok->type == T_NOT_EQUAL) {
-            (*token_index)++;
-            left = create_ast_node(AST_NOT_EQUAL, NULL, left, parse_relational(tokens, token_index));
-        } else {
-            break;
-        }
-    }
-
-    return left;
-}
+        const struct binary_operator *op = &binary_operators[parser->tokens[parser->index].type];
 
-struct ast_node* parse_relational(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_shift(tokens, token_index);
-
-    while (1) {
-        struct token *tok = &tokens[*token_index];
-
-        if (tok->type == T_LESS) {
-            (*token_index)++;
-            left = create_ast_node(AST_LESS, NULL, left, parse_shift(tokens, token_index));
-        } else if (tok->type == T_LESS_EQUAL) {
-            (*token_index)++;
-            left = create_ast_node(AST_LESS_EQUAL, NULL, left, parse_shift(tokens, token_index));
-        } else if (tok->type == T_GREATER) {
-            (*token_index)++;
-            left = create_ast_node(AST_GREATER, NULL, left, parse_shift(tokens, token_index));
-        } else if (tok->type == T_GREATER_EQUAL) {
-            (*token_index)++;
-            left = create_ast_node(AST_GREATER_EQUAL, NULL, left, parse_shift(tokens, token_index));
-        } else {
+        if (op->precedence == 0 || op->precedence < min_precedence) {
             break;
         }
+        parser->index++;
+        left = create_ast_node(parser->unit, op->node_type, NULL, left, parse_binary(parser, op->precedence + 1));
     }
 
     return left;
 }
 
-struct ast_node* parse_shift(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_additive(tokens, token_index);
-
-    while (1) {
-        struct token *tok = &tokens[*token_index];
-
-        if (tok->type == T_SHIFT_LEFT) {
-            (*token_index)++;
-            left = create_ast_node(AST_SHIFT_LEFT, NULL, left, parse_additive(tokens, token_index));
-        } else if (tok->type == T_SHIFT_RIGHT) {
-            (*token_index)++;
-            left = create_ast_node(AST_SHIFT_RIGHT, NULL, left, parse_additive(tokens, token_index));
-        } else {
-            break;
-        }
-    }
-
-    return left;
-}
-
-struct ast_node* parse_additive(struct token *tokens, int *token_index)
-{
-    struct ast_node *left = parse_term(tokens, token_index);
-
-    while (1) {
-        struct token *tok = &tokens[*token_index];
-
-        if (tok->type == T_PLUS) {
-            (*token_index)++;
-            left = create_ast_node(AST_ADD, NULL, left, parse_term(tokens, token_index));
-        } else if (tok->type == T_MINUS) {
-            (*token_index)++;
-            left = create_ast_node(AST_SUB, NULL, left, parse_term(tokens, token_index));
-        } else {
-            break;
-        }
-    }
-
-    return left;
-}
-
-struct ast_node* create_ast_node(ASTNodeType type, char *value, struct ast_node *left, struct ast_node *right)
+struct ast_node* create_ast_node(struct compilation *unit, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right)
 {
     SourceLocation location = {0, 0};
 
@@ -1004,34 +951,35 @@ struct ast_node* create_ast_node(ASTNodeType type, char *value, struct ast_node
     } else if (right) {
         location = right->location;
     }
-    return create_ast_node_at(type, value, left, right, location);
+    return create_ast_node_at(unit, type, value, left, right, location);
 }
 
-struct ast_node* create_ast_node_at(ASTNodeType type, char *value, struct ast_node *left, struct ast_node *right, SourceLocation location)
+/*
+ * Every node comes from an arena, so the whole tree is released in one step.
+ * The parser uses the unit's AST arena; semantic analysis allocates the casts
+ * it inserts from its own arena, which lives as long as the tree.
+ */
+struct ast_node* arena_ast_node(struct arena *arena, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right, SourceLocation location)
 {
-    struct ast_node *node = malloc(sizeof(struct ast_node));
-    if (!node) {
-        perror("Error allocating AST node");
-        exit(EXIT_FAILURE);
-    }
+    struct ast_node *node = arena_alloc(arena, sizeof(struct ast_node));
 
     node->type = type;
     node->data_type = TYPE_INVALID;
     node->pointer_depth = 0;
     node->array_length = 0;
     node->location = location;
-    node->value = value ? strdup(value) : NULL;
+    node->value = value;
     node->left = left;
     node->right = right;
+    node->children = NULL;
+    node->child_count = 0;
+    node->label = 0;
+    node->symbol = NULL;
     return node;
 }
 
-void free_ast_node(struct ast_node *node)
+struct ast_node* create_ast_node_at(struct compilation *unit, ASTNodeType type, const char *value, struct ast_node *left, struct ast_node *right, SourceLocation location)
 {
-    if (node) {
-        free_ast_node(node->left);
-        free_ast_node(node->right);
-        free(node->value);
-        free(node);
-    }
+    unit->stats.ast_nodes++;
+    return arena_ast_node(&unit->ast_arena, type, value, left, right, location);
 }
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Peephole optimization of one function's instruction records. Each rule
+ * looks at a window of consecutive records and rewrites or deletes some of
+ * them, and the table is slid over the function until no rule matches
+ * anywhere. Labels are records too, so no window spans a jump target unless
+ * the rule asks for it. Every rule only deletes records or turns one into a
+ * form no rule rewrites again, so this always stops.
+ *
+ * The code generator keeps nothing in the flags across a label or a call,
+ * and every function ends in ret, which is what lets zero-register decide
+ * from a forward scan alone that the flags are dead.
+ */
+
+#define PEEPHOLE_WINDOW 2
+#define FLAGS_SCAN_LIMIT 32
+
+struct peephole {
+    struct insn *insns;
+    int count;
+    int *labels;
+    int label_count;
+};
+
+struct peephole_rule {
+    const char *name;
+    int window;
+    int (*apply)(struct peephole *pass, const int *window);
+};
+
+/* Writes the flags without reading them. */
+static const char *const flag_setters[] = {
+    "addl", "subl", "andl", "orl", "xorl", "cmpl", "testl", "imull", "negl", "idivl", "divl", NULL
+};
+
+/* Leaves the flags alone. */
+static const char *const flag_keepers[] = {
+    "movl", "leal", "push", "pop", "movsbl", "movzbl", "movswl", "movzwl", "cdq", "notl", "xchgl",
+    "leave", NULL
+};
+
+static int is_one_of(const char *mnemonic, const char *const *list)
+{
+    for (; *list; list++) {
+        if (strcmp(mnemonic, *list) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_instruction(const struct insn *insn, const char *mnemonic)
+{
+    return insn->kind == INSN_INSTRUCTION && strcmp(insn->mnemonic, mnemonic) == 0;
+}
+
+static int same_text(const char *a, const char *b)
+{
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static int same_operand(const struct operand *a, const struct operand *b)
+{
+    return a->kind == b->kind && a->value == b->value && a->scale == b->scale &&
+        same_text(a->text, b->text) && same_text(a->base, b->base) && same_text(a->index, b->index);
+}
+
+/* Literals from the source arrive as their text. */
+static int is_zero(const struct operand *operand)
+{
+    return (operand->kind == OPERAND_IMMEDIATE && operand->value == 0) ||
+        (operand->kind == OPERAND_IMMEDIATE_TEXT && strcmp(operand->text, "0") == 0);
+}
+
+/* Identifies a register so that %al, %ax and %eax compare equal. */
+static int register_id(const char *name)
+{
+    size_t length = strlen(name);
+
+    if (length == 2 && (name[1] == 'l' || name[1] == 'h' || name[1] == 'x')) {
+        return name[0];
+    }
+    if (length == 3 && name[0] == 'e' && name[2] == 'x') {
+        return name[1];
+    }
+    return name[0] << 16 | name[1] << 8 | name[2];
+}
+
+static int same_register(const char *a, const char *b)
+{
+    return register_id(a) == register_id(b);
+}
+
+/* Whether reading the operand reads the register, as a value or an address. */
+static int mentions(const struct operand *operand, const char *reg)
+{
+    switch (operand->kind) {
+        case OPERAND_REGISTER:
+        case OPERAND_INDIRECT:
+            return same_register(operand->text, reg);
+        case OPERAND_MEMORY:
+            return (operand->base && same_register(operand->base, reg)) ||
+                (operand->index && same_register(operand->index, reg));
+        default:
+            return 0;
+    }
+}
+
+static int next_live(const struct peephole *pass, int at)
+{
+    for (at++; at < pass->count; at++) {
+        if (pass->insns[at].kind != INSN_DELETED) {
+            return at;
+        }
+    }
+    return -1;
+}
+
+static int find_label(const struct peephole *pass, const struct operand *label)
+{
+    int at;
+
+    if (label->kind != OPERAND_LABEL || label->value < 0 || label->value >= pass->label_count) {
+        return -1;
+    }
+    at = pass->labels[label->value];
+    return at >= 0 && same_operand(&pass->insns[at].operands[0], label) ? at : -1;
+}
+
+/* Labels are numbered per function, so their record positions fit in an array by number. */
+static void index_labels(struct peephole *pass)
+{
+    for (int i = 0; i < pass->count; i++) {
+        if (pass->insns[i].kind == INSN_LABEL && pass->insns[i].operands[0].value >= pass->label_count) {
+            pass->label_count = pass->insns[i].operands[0].value + 1;
+        }
+    }
+    pass->labels = malloc((size_t)(pass->label_count > 0 ? pass->label_count : 1) * sizeof(int));
+    if (!pass->labels) {
+        perror("Error allocating peephole label index");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < pass->label_count; i++) {
+        pass->labels[i] = -1;
+    }
+    for (int i = 0; i < pass->count; i++) {
+        if (pass->insns[i].kind == INSN_LABEL) {
+            pass->labels[pass->insns[i].operands[0].value] = i;
+        }
+    }
+}
+
+/* Whether every path from after record at writes the flags before reading them. */
+static int flags_dead_after(const struct peephole *pass, int at)
+{
+    int at_next = next_live(pass, at);
+
+    for (int steps = 0; at_next >= 0 && steps < FLAGS_SCAN_LIMIT; steps++) {
+        const struct insn *insn = &pass->insns[at_next];
+
+        if (insn->kind == INSN_INSTRUCTION) {
+            if (is_one_of(insn->mnemonic, flag_setters) || is_instruction(insn, "call") ||
+                is_instruction(insn, "ret")) {
+                return 1;
+            }
+            if (is_instruction(insn, "jmp")) {
+                at_next = find_label(pass, &insn->operands[0]);
+                continue;
+            }
+            if (!is_one_of(insn->mnemonic, flag_keepers)) {
+                return 0;
+            }
+        }
+        at_next = next_live(pass, at_next);
+    }
+    return 0;
+}
+
+static void delete_insn(struct peephole *pass, int at)
+{
+    pass->insns[at].kind = INSN_DELETED;
+}
+
+/* push X; pop R becomes movl X, R, or nothing when X is R. */
+static int push_pop(struct peephole *pass, const int *window)
+{
+    struct insn *push = &pass->insns[window[0]];
+    struct insn *pop = &pass->insns[window[1]];
+
+    if (!is_instruction(push, "push") || !is_instruction(pop, "pop") ||
+        pop->operands[0].kind != OPERAND_REGISTER) {
+        return 0;
+    }
+    if (push->operands[0].kind == OPERAND_REGISTER &&
+        same_register(push->operands[0].text, pop->operands[0].text)) {
+        delete_insn(pass, window[0]);
+    } else {
+        push->mnemonic = "movl";
+        push->operand_count = 2;
+        push->operands[1] = pop->operands[0];
+    }
+    delete_insn(pass, window[1]);
+    return 1;
+}
+
+/* jmp L just before L, or before a run of labels that includes it. */
+static int jump_to_next(struct peephole *pass, const int *window)
+{
+    struct insn *jump = &pass->insns[window[0]];
+
+    if (!is_instruction(jump, "jmp")) {
+        return 0;
+    }
+    for (int at = window[1]; at >= 0 && pass->insns[at].kind == INSN_LABEL; at = next_live(pass, at)) {
+        if (same_operand(&jump->operands[0], &pass->insns[at].operands[0])) {
+            delete_insn(pass, window[0]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Nothing after jmp or ret runs until the next label. */
+static int unreachable(struct peephole *pass, const int *window)
+{
+    struct insn *jump = &pass->insns[window[0]];
+
+    if ((is_instruction(jump, "jmp") || is_instruction(jump, "ret")) &&
+        pass->insns[window[1]].kind == INSN_INSTRUCTION) {
+        delete_insn(pass, window[1]);
+        return 1;
+    }
+    return 0;
+}
+
+/* movl R, R */
+static int self_move(struct peephole *pass, const int *window)
+{
+    struct insn *move = &pass->insns[window[0]];
+
+    if (is_instruction(move, "movl") && move->operands[0].kind == OPERAND_REGISTER &&
+        same_operand(&move->operands[0], &move->operands[1])) {
+        delete_insn(pass, window[0]);
+        return 1;
+    }
+    return 0;
+}
+
+/* movl A, B; movl B, A: the second copies back the value A already holds. */
+static int move_back(struct peephole *pass, const int *window)
+{
+    struct insn *first = &pass->insns[window[0]];
+    struct insn *second = &pass->insns[window[1]];
+
+    if (!is_instruction(first, "movl") || !is_instruction(second, "movl") ||
+        !same_operand(&first->operands[0], &second->operands[1]) ||
+        !same_operand(&first->operands[1], &second->operands[0])) {
+        return 0;
+    }
+    /* movl (%eax), %eax changes the address the value would go back to. */
+    if (first->operands[1].kind == OPERAND_REGISTER && mentions(&first->operands[0], first->operands[1].text)) {
+        return 0;
+    }
+    delete_insn(pass, window[1]);
+    return 1;
+}
+
+/* movl X, R; movl Y, R where Y does not read R: the first value is never used. */
+static int dead_move(struct peephole *pass, const int *window)
+{
+    struct insn *first = &pass->insns[window[0]];
+    struct insn *second = &pass->insns[window[1]];
+
+    if ((!is_instruction(first, "movl") && !is_instruction(first, "leal")) || !is_instruction(second, "movl") ||
+        first->operands[1].kind != OPERAND_REGISTER || second->operands[1].kind != OPERAND_REGISTER ||
+        !same_register(first->operands[1].text, second->operands[1].text) ||
+        mentions(&second->operands[0], second->operands[1].text)) {
+        return 0;
+    }
+    delete_insn(pass, window[0]);
+    return 1;
+}
+
+/* movl $0, R becomes the shorter xorl R, R where nothing reads the flags it writes. */
+static int zero_register(struct peephole *pass, const int *window)
+{
+    struct insn *move = &pass->insns[window[0]];
+
+    if (!is_instruction(move, "movl") || !is_zero(&move->operands[0]) ||
+        move->operands[1].kind != OPERAND_REGISTER ||
+        !flags_dead_after(pass, window[0])) {
+        return 0;
+    }
+    move->mnemonic = "xorl";
+    move->operands[0] = move->operands[1];
+    return 1;
+}
+
+static const struct peephole_rule rules[PEEPHOLE_RULE_COUNT] = {
+    [PEEPHOLE_PUSH_POP] = { "push-pop", 2, push_pop },
+    [PEEPHOLE_JUMP_TO_NEXT] = { "jump-to-next", 2, jump_to_next },
+    [PEEPHOLE_UNREACHABLE] = { "unreachable", 2, unreachable },
+    [PEEPHOLE_SELF_MOVE] = { "self-move", 1, self_move },
+    [PEEPHOLE_MOVE_BACK] = { "move-back", 2, move_back },
+    [PEEPHOLE_DEAD_MOVE] = { "dead-move", 2, dead_move },
+    [PEEPHOLE_ZERO_REGISTER] = { "zero-register", 1, zero_register },
+};
+
+const char *peephole_rule_name(int rule)
+{
+    return rules[rule].name;
+}
+
+/* The rule called name, or -1. */
+int peephole_rule_index(const char *name)
+{
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+        if (strcmp(rules[rule].name, name) == 0) {
+            return rule;
+        }
+    }
+    return -1;
+}
+
+static int previous_live(const struct peephole *pass, int at)
+{
+    for (at--; at >= 0; at--) {
+        if (pass->insns[at].kind != INSN_DELETED) {
+            return at;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Slides the rules over the function until none matches. A rewrite can only
+ * open a match for a window that overlaps it, so after one the slide backs
+ * up a record rather than starting over, and when it reaches the end the
+ * function is at its fixpoint. The flags scan of zero-register looks further,
+ * but no rule removes a flag write or read on a path it follows.
+ */
+static void peephole_slide(struct peephole *pass, int rules_off, int *hits)
+{
+    int at = 0;
+
+    while (at < pass->count) {
+        int window[PEEPHOLE_WINDOW];
+        int size = 1;
+        int rule;
+
+        if (pass->insns[at].kind == INSN_DELETED) {
+            at++;
+            continue;
+        }
+        window[0] = at;
+        while (size < PEEPHOLE_WINDOW && (window[size] = next_live(pass, window[size - 1])) >= 0) {
+            size++;
+        }
+        for (rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+            if (!(rules_off & (1 << rule)) && rules[rule].window <= size && rules[rule].apply(pass, window)) {
+                break;
+            }
+        }
+        if (rule < PEEPHOLE_RULE_COUNT) {
+            hits[rule]++;
+            at = previous_live(pass, at);
+        } else {
+            at++;
+        }
+    }
+}
+
+/*
+ * Optimizes the records of a recording emitter holding one function, with
+ * the rules in rules_off left out, and adds each rule's rewrites to hits.
+ */
+void peephole_optimize(struct emitter *function, int rules_off, int *hits)
+{
+    struct peephole pass = { function->insns, function->insn_count, NULL, 0 };
+    int live = 0;
+
+    index_labels(&pass);
+    peephole_slide(&pass, rules_off, hits);
+    for (int i = 0; i < pass.count; i++) {
+        if (pass.insns[i].kind != INSN_DELETED) {
+            pass.insns[live++] = pass.insns[i];
+        }
+    }
+    function->insn_count = live;
+    free(pass.labels);
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Linear-scan register allocation for -O (Poletto and Sarkar). Parameters
+ * and scalar locals whose address is never taken are candidates. One walk
+ * over the function numbers every use and definition in code order and
+ * records each candidate's live interval from its first to its last
+ * reference; a variable used inside a loop that it was live on entry to
+ * stays live to the end of the loop, since the next iteration may read it.
+ * The intervals are then scanned in order of their start, and when no
+ * register is free the one ending last is spilled: it keeps its frame slot
+ * for the whole function.
+ *
+ * Only the callee-saved registers are handed out. %eax, %ecx and %edx are
+ * the code generator's scratch registers and are clobbered by calls, by
+ * division and by shifts, so a variable kept in them would have to be saved
+ * around most expressions.
+ */
+
+static const char *const register_names[ALLOCATABLE_REGISTERS] = { "ebx", "esi", "edi" };
+
+struct live_interval {
+    struct symbol *symbol;
+    int start;
+    int end;
+    int address_taken;
+    int referenced;
+};
+
+struct loop_range {
+    int start;
+    int end;
+};
+
+struct liveness {
+    struct live_interval *intervals;
+    int interval_count;
+    int parameter_count;
+    struct loop_range *loops;
+    int loop_count;
+    int loop_capacity;
+    int position;
+};
+
+const char *register_name(int reg)
+{
+    return register_names[reg - 1];
+}
+
+/* Parameters come first, then one entry per local frame slot. */
+static struct live_interval *interval_of(struct liveness *live, struct symbol *symbol)
+{
+    int index;
+
+    if (!symbol || symbol->kind != SYMBOL_LOCAL) {
+        return NULL;
+    }
+    index = symbol->offset > 0 ? (symbol->offset - 8) / 4 : live->parameter_count - symbol->offset / 4 - 1;
+    if (index < 0 || index >= live->interval_count) {
+        return NULL;
+    }
+    return &live->intervals[index];
+}
+
+static void reference(struct liveness *live, struct symbol *symbol)
+{
+    struct live_interval *interval = interval_of(live, symbol);
+
+    if (!interval) {
+        return;
+    }
+    if (!interval->symbol) {
+        interval->symbol = symbol;
+        interval->start = live->position;
+    }
+    interval->end = live->position;
+    interval->referenced = 1;
+    live->position++;
+}
+
+static void add_loop(struct liveness *live, int start)
+{
+    if (live->loop_count == live->loop_capacity) {
+        live->loop_capacity = live->loop_capacity ? live->loop_capacity * 2 : 16;
+        live->loops = realloc(live->loops, (size_t)live->loop_capacity * sizeof(*live->loops));
+        if (!live->loops) {
+            perror("Error allocating register allocator tables");
+            exit(EXIT_FAILURE);
+        }
+    }
+    live->loops[live->loop_count].start = start;
+    live->loops[live->loop_count].end = live->position++;
+    live->loop_count++;
+}
+
+static void walk(struct liveness *live, struct ast_node *node)
+{
+    struct live_interval *interval;
+    int loop_start;
+
+    if (!node) {
+        return;
+    }
+
+    switch (node->type) {
+        case AST_IDENTIFIER:
+            reference(live, node->symbol);
+            return;
+        case AST_ADDRESS_OF:
+            if (node->left->type == AST_IDENTIFIER && (interval = interval_of(live, node->left->symbol))) {
+                interval->address_taken = 1;
+            }
+            walk(live, node->left);
+            return;
+        case AST_DECL:
+            /* The initializer is evaluated before the variable is written. */
+            walk(live, node->left);
+            reference(live, node->symbol);
+            return;
+        case AST_WHILE:
+            loop_start = live->position++;
+            walk(live, node->left);
+            walk(live, node->right);
+            add_loop(live, loop_start);
+            return;
+        case AST_FOR:
+            walk(live, node->left->left);
+            loop_start = live->position++;
+            walk(live, node->left->right);
+            walk(live, node->right);
+            add_loop(live, loop_start);
+            return;
+        default:
+            for (int i = 0; i < node->child_count; i++) {
+                walk(live, node->children[i]);
+            }
+            walk(live, node->left);
+            walk(live, node->right);
+            return;
+    }
+}
+
+/*
+ * Loops are recorded innermost first, so one pass carries an extension made
+ * for an inner loop on to the loops around it.
+ */
+static void extend_over_loops(struct liveness *live)
+{
+    for (int i = 0; i < live->loop_count; i++) {
+        struct loop_range *loop = &live->loops[i];
+
+        for (int j = 0; j < live->interval_count; j++) {
+            struct live_interval *interval = &live->intervals[j];
+
+            if (interval->symbol && interval->start < loop->start &&
+                interval->end >= loop->start && interval->end < loop->end) {
+                interval->end = loop->end;
+            }
+        }
+    }
+}
+
+static int compare_starts(const void *left, const void *right)
+{
+    const struct live_interval *a = *(struct live_interval *const *)left;
+    const struct live_interval *b = *(struct live_interval *const *)right;
+
+    if (a->start != b->start) {
+        return a->start < b->start ? -1 : 1;
+    }
+    return a->symbol->offset < b->symbol->offset ? -1 : a->symbol->offset > b->symbol->offset;
+}
+
+static void linear_scan(struct live_interval **order, int count)
+{
+    struct live_interval *active[ALLOCATABLE_REGISTERS + 1] = { NULL };
+
+    for (int i = 0; i < count; i++) {
+        struct live_interval *current = order[i];
+        int furthest = 0;
+        int reg;
+
+        for (reg = 1; reg <= ALLOCATABLE_REGISTERS; reg++) {
+            if (active[reg] && active[reg]->end < current->start) {
+                active[reg] = NULL;
+            }
+        }
+        for (reg = 1; reg <= ALLOCATABLE_REGISTERS && active[reg]; reg++) {
+            if (!furthest || active[reg]->end > active[furthest]->end) {
+                furthest = reg;
+            }
+        }
+        if (reg <= ALLOCATABLE_REGISTERS) {
+            current->symbol->reg = reg;
+            active[reg] = current;
+        } else if (active[furthest]->end > current->end) {
+            active[furthest]->symbol->reg = 0;
+            current->symbol->reg = furthest;
+            active[furthest] = current;
+        }
+    }
+}
+
+/*
+ * Assigns registers to the variables of a checked function by setting their
+ * symbols' reg fields. Returns a mask with bit reg set for every register it
+ * handed out.
+ */
+int allocate_registers(struct ast_node *function)
+{
+    struct liveness live;
+    struct live_interval **order;
+    int count = 0;
+    int used = 0;
+
+    memset(&live, 0, sizeof(live));
+    live.parameter_count = function->left->child_count;
+    live.interval_count = live.parameter_count + function->symbol->frame_size / 4;
+    live.intervals = calloc(live.interval_count > 0 ? (size_t)live.interval_count : 1, sizeof(*live.intervals));
+    order = malloc((live.interval_count > 0 ? (size_t)live.interval_count : 1) * sizeof(*order));
+    if (!live.intervals || !order) {
+        perror("Error allocating register allocator tables");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Parameters are loaded into their registers on entry. */
+    for (int i = 0; i < live.parameter_count; i++) {
+        struct live_interval *interval = interval_of(&live, function->left->children[i]->symbol);
+
+        if (interval) {
+            interval->symbol = function->left->children[i]->symbol;
+            interval->start = 0;
+            interval->end = 0;
+        }
+    }
+    live.position = 1;
+    walk(&live, function->right);
+    extend_over_loops(&live);
+
+    for (int i = 0; i < live.interval_count; i++) {
+        struct live_interval *interval = &live.intervals[i];
+
+        if (interval->symbol) {
+            interval->symbol->reg = 0;
+            if (interval->referenced && !interval->address_taken && interval->symbol->array_length == 0) {
+                order[count++] = interval;
+            }
+        }
+    }
+    qsort(order, (size_t)count, sizeof(*order), compare_starts);
+    linear_scan(order, count);
+    for (int i = 0; i < count; i++) {
+        used |= 1 << order[i]->symbol->reg;
+    }
+
+    free(live.intervals);
+    free(live.loops);
+    free(order);
+    return used & ~1;
+}
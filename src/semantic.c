@@ -1,41 +1,63 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "defs.h"
 #include "decl.h"
 
-#define MAX_SYMBOLS 256
-
 struct global_symbol {
-    const char *name;
-    int is_function;
-    CType type;
-    int pointer_depth;
-    int array_length;
+    struct symbol *symbol;
     int parameter_count;
-    CType parameter_types[64];
-    int parameter_pointer_depths[64];
+    struct ast_node *parameters;
 };
 
 struct local_symbol {
-    const char *name;
-    CType type;
-    int pointer_depth;
-    int array_length;
+    struct symbol *symbol;
     int depth;
 };
 
-static struct global_symbol globals[MAX_SYMBOLS];
-static struct local_symbol locals[MAX_SYMBOLS];
-static int global_count;
-static int local_count;
-static int scope_depth;
-static int loop_depth;
-static int error_count;
-static const char *current_function;
-static CType current_return_type;
-static int current_return_pointer_depth;
-static const char *semantic_source_path;
+/*
+ * Symbols live in growable arrays in declaration order; the maps index them
+ * by interned name. Locals form a stack, so leaving a scope pops its entries
+ * and unmaps their names. One of these exists per semantic_analyze() call.
+ *
+ * After a sweep that collects every top-level signature, each function is
+ * checked in one walk that resolves names, checks loops and computes types,
+ * inserting conversion casts as it goes. Type errors are only reported for
+ * programs whose names all resolve, so they are held in type_errors until
+ * semantic_finish(). Each declaration gets a struct symbol, allocated with
+ * the AST, which the nodes that use the name point to. Functions that check
+ * cleanly are then constant folded by fold_function().
+ *
+ * Parallel compiles check functions on forks made by semantic_fork(). A fork
+ * shares its parent's globals read-only and has its own scopes, arena and
+ * diagnostics, which semantic_merge() folds back in source order.
+ */
+struct semantic {
+    struct compilation *unit;
+    struct semantic *parent;
+    struct arena *arena;
+    struct emitter *diagnostics;
+    struct emitter *type_errors;
+    struct global_symbol *globals;
+    struct local_symbol *locals;
+    struct symbol_map global_map;
+    struct symbol_map local_map;
+    int global_count;
+    int global_capacity;
+    int local_count;
+    int local_capacity;
+    int scope_depth;
+    int loop_depth;
+    int frame_slots;
+    int error_count;
+    int type_error_count;
+    int conversion_casts;
+    struct emitter held_type_errors;
+    const char *current_function;
+    CType current_return_type;
+    int current_return_pointer_depth;
+};
 
 static const char *semantic_type_name(CType type)
 {
@@ -97,159 +119,187 @@ static CType semantic_type_from_name(const char *name)
     return TYPE_INT;
 }
 
-static void semantic_error_at(struct ast_node *node, const char *format, ...)
+static void report_at(struct semantic *sema, struct emitter *out, const char *function,
+    struct ast_node *node, const char *format, va_list args)
 {
-    va_list args;
-
-    fprintf(stderr, "Semantic error");
+    emit_text(out, "Semantic error");
     if (node && node->location.line > 0) {
-        fprintf(stderr, " at %s:%d:%d", semantic_source_path,
+        emit_format(out, " at %s:%d:%d", sema->unit->source_path,
             node->location.line, node->location.column);
     }
-    if (current_function) {
-        fprintf(stderr, " in function '%s'", current_function);
+    if (function) {
+        emit_format(out, " in function '%s'", function);
     }
-    fprintf(stderr, ": ");
+    emit_text(out, ": ");
+    emit_vformat(out, format, args);
+    emit_text(out, "\n");
+}
+
+static void semantic_error_at(struct semantic *sema, struct ast_node *node, const char *format, ...)
+{
+    va_list args;
 
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    report_at(sema, sema->diagnostics, sema->current_function, node, format, args);
     va_end(args);
-    fprintf(stderr, "\n");
-    error_count++;
+    sema->error_count++;
 }
 
-static int count_list(struct ast_node *node, ASTNodeType list_type)
+/* Type errors have never named the enclosing function; see struct semantic. */
+static void type_error_at(struct semantic *sema, struct ast_node *node, const char *format, ...)
 {
-    int count = 0;
+    va_list args;
 
-    while (node) {
-        if (node->type != list_type) {
-            return count + 1;
-        }
-        count++;
-        node = node->right;
-    }
-    return count;
+    va_start(args, format);
+    report_at(sema, sema->type_errors, NULL, node, format, args);
+    va_end(args);
+    sema->type_error_count++;
 }
 
-static struct ast_node *initializer_items(struct ast_node *node)
+static int find_global(struct semantic *sema, const char *name)
 {
-    if (!node || node->type != AST_INITIALIZER_LIST) {
-        return NULL;
-    }
-    if (!node->left || node->left->type == AST_INITIALIZER_LIST) {
-        return node->left;
-    }
-    return node;
+    return symbol_map_get(&sema->global_map, name);
 }
 
-static int find_global(const char *name)
+static int find_local(struct semantic *sema, const char *name)
 {
-    int i;
+    return symbol_map_get(&sema->local_map, name);
+}
 
-    for (i = 0; i < global_count; i++) {
-        if (strcmp(globals[i].name, name) == 0) {
-            return i;
-        }
+static void *grow_symbols(void *symbols, int *capacity, size_t symbol_size)
+{
+    int grown = *capacity ? *capacity * 2 : 64;
+
+    symbols = realloc(symbols, (size_t)grown * symbol_size);
+    if (!symbols) {
+        perror("Error allocating symbol table");
+        exit(EXIT_FAILURE);
     }
-    return -1;
+    *capacity = grown;
+    return symbols;
 }
 
-static int find_local(const char *name)
+static struct symbol *new_symbol(struct semantic *sema, SymbolKind kind, struct ast_node *node)
 {
-    int i;
+    struct symbol *symbol = arena_alloc(sema->arena, sizeof(*symbol));
 
-    for (i = local_count - 1; i >= 0; i--) {
-        if (strcmp(locals[i].name, name) == 0) {
-            return i;
-        }
-    }
-    return -1;
+    symbol->kind = kind;
+    symbol->name = node->value;
+    symbol->type = node->data_type;
+    symbol->pointer_depth = node->pointer_depth;
+    symbol->array_length = node->array_length;
+    symbol->offset = 0;
+    symbol->frame_size = 0;
+    symbol->reg = 0;
+    node->symbol = symbol;
+    return symbol;
 }
 
-static void add_global(struct ast_node *node)
+static void add_global(struct semantic *sema, struct ast_node *node)
 {
     const char *name = node->value;
     int is_function = node->type == AST_FUNCTION;
-    int existing = find_global(name);
-    struct ast_node *param;
+    int existing = find_global(sema, name);
+    struct global_symbol *global;
 
     if (existing >= 0) {
-        semantic_error_at(node, "duplicate top-level declaration of '%s'", name);
+        semantic_error_at(sema, node, "duplicate top-level declaration of '%s'", name);
         return;
     }
-    if (global_count >= MAX_SYMBOLS) {
-        semantic_error_at(node, "too many top-level declarations");
-        return;
+    if (sema->global_count == sema->global_capacity) {
+        sema->globals = grow_symbols(sema->globals, &sema->global_capacity, sizeof(struct global_symbol));
     }
 
-    globals[global_count].name = name;
-    globals[global_count].is_function = is_function;
-    globals[global_count].type = node->data_type;
-    globals[global_count].pointer_depth = node->pointer_depth;
-    globals[global_count].array_length = node->array_length;
-    globals[global_count].parameter_count = 0;
-    if (is_function) {
-        for (param = node->left; param; param = param->right) {
-            if (globals[global_count].parameter_count >= 64) {
-                semantic_error_at(node, "function '%s' has too many parameters", name);
-                break;
-            }
-            globals[global_count].parameter_types[globals[global_count].parameter_count++] =
-                param->left->data_type;
-            globals[global_count].parameter_pointer_depths[globals[global_count].parameter_count - 1] =
-                param->left->pointer_depth;
-        }
-    }
-    global_count++;
+    global = &sema->globals[sema->global_count];
+    global->symbol = new_symbol(sema, is_function ? SYMBOL_FUNCTION : SYMBOL_GLOBAL, node);
+    global->parameter_count = is_function ? node->left->child_count : 0;
+    global->parameters = is_function ? node->left : NULL;
+    symbol_map_put(&sema->global_map, name, sema->global_count);
+    sema->global_count++;
 }
 
-static void add_local(struct ast_node *node, CType type)
+/* offset is the variable's place in the frame, relative to %ebp. */
+static void add_local(struct semantic *sema, struct ast_node *node, int offset)
 {
     const char *name = node->value;
-    int existing = find_local(name);
+    int existing = find_local(sema, name);
+    struct local_symbol *local;
 
     if (existing >= 0) {
-        if (locals[existing].depth == scope_depth) {
-            semantic_error_at(node, "duplicate declaration of '%s'", name);
+        if (sema->locals[existing].depth == sema->scope_depth) {
+            semantic_error_at(sema, node, "duplicate declaration of '%s'", name);
         } else {
-            semantic_error_at(node, "variable shadowing is not supported for '%s'", name);
+            semantic_error_at(sema, node, "variable shadowing is not supported for '%s'", name);
         }
         return;
     }
-    if (local_count >= MAX_SYMBOLS) {
-        semantic_error_at(node, "too many local declarations");
-        return;
+    if (sema->local_count == sema->local_capacity) {
+        sema->locals = grow_symbols(sema->locals, &sema->local_capacity, sizeof(struct local_symbol));
     }
 
-    locals[local_count].name = name;
-    locals[local_count].type = type;
-    locals[local_count].pointer_depth = node->pointer_depth;
-    locals[local_count].array_length = node->array_length;
-    locals[local_count].depth = scope_depth;
-    local_count++;
+    local = &sema->locals[sema->local_count];
+    local->symbol = new_symbol(sema, SYMBOL_LOCAL, node);
+    local->symbol->offset = offset;
+    local->depth = sema->scope_depth;
+    symbol_map_put(&sema->local_map, name, sema->local_count);
+    sema->local_count++;
 }
 
-static void enter_scope(void)
+static void pop_local(struct semantic *sema)
 {
-    scope_depth++;
+    sema->local_count--;
+    symbol_map_remove(&sema->local_map, sema->locals[sema->local_count].symbol->name);
 }
 
-static void leave_scope(void)
+static void clear_locals(struct semantic *sema)
 {
-    while (local_count > 0 && locals[local_count - 1].depth == scope_depth) {
-        local_count--;
+    while (sema->local_count > 0) {
+        pop_local(sema);
     }
-    scope_depth--;
 }
 
-static void analyze_expression(struct ast_node *node);
-static void analyze_statement(struct ast_node *node);
+static void enter_scope(struct semantic *sema)
+{
+    sema->scope_depth++;
+}
 
-static void analyze_expression(struct ast_node *node)
+static void leave_scope(struct semantic *sema)
+{
+    while (sema->local_count > 0 && sema->locals[sema->local_count - 1].depth == sema->scope_depth) {
+        pop_local(sema);
+    }
+    sema->scope_depth--;
+}
+
+/*
+ * Reports calls to anything but a declared function, and argument count
+ * mismatches. Returns the callee's global index, or -1 if it is not a function.
+ */
+static int resolve_call(struct semantic *sema, struct ast_node *node)
+{
+    int symbol = find_global(sema, node->value);
+    int actual_count = node->left->child_count;
+
+    if (find_local(sema, node->value) >= 0) {
+        semantic_error_at(sema, node, "called object '%s' is not a function", node->value);
+    } else if (symbol < 0) {
+        semantic_error_at(sema, node, "call to undeclared function '%s'", node->value);
+    } else if (sema->globals[symbol].symbol->kind != SYMBOL_FUNCTION) {
+        semantic_error_at(sema, node, "called object '%s' is not a function", node->value);
+    } else if (actual_count != sema->globals[symbol].parameter_count) {
+        semantic_error_at(sema, node, "function '%s' expects %d argument(s), but %d provided",
+            node->value, sema->globals[symbol].parameter_count, actual_count);
+    }
+    return symbol >= 0 && sema->globals[symbol].symbol->kind == SYMBOL_FUNCTION ? symbol : -1;
+}
+
+/*
+ * Name resolution alone, for the few subtrees that the type checks reject
+ * without looking inside; their names are still reported.
+ */
+static void resolve_names(struct semantic *sema, struct ast_node *node)
 {
     int symbol;
-    int actual_count;
 
     if (!node) {
         return;
@@ -260,37 +310,21 @@ static void analyze_expression(struct ast_node *node)
         case AST_SIZEOF:
             return;
         case AST_INITIALIZER_LIST:
-            for (struct ast_node *item = initializer_items(node); item; item = item->right) {
-                analyze_expression(item->left);
+            for (int i = 0; i < node->child_count; i++) {
+                resolve_names(sema, node->children[i]);
             }
             return;
         case AST_IDENTIFIER:
-            symbol = find_global(node->value);
-            if (find_local(node->value) < 0 &&
-                (symbol < 0 || globals[symbol].is_function)) {
-                semantic_error_at(node, "use of undeclared variable '%s'", node->value);
+            symbol = find_global(sema, node->value);
+            if (find_local(sema, node->value) < 0 &&
+                (symbol < 0 || sema->globals[symbol].symbol->kind == SYMBOL_FUNCTION)) {
+                semantic_error_at(sema, node, "use of undeclared variable '%s'", node->value);
             }
             return;
         case AST_CALL:
-            symbol = find_global(node->value);
-            if (find_local(node->value) >= 0) {
-                semantic_error_at(node, "called object '%s' is not a function", node->value);
-            } else if (symbol < 0) {
-                semantic_error_at(node, "call to undeclared function '%s'", node->value);
-            } else if (!globals[symbol].is_function) {
-                semantic_error_at(node, "called object '%s' is not a function", node->value);
-            } else {
-                actual_count = count_list(node->left, AST_ARG_LIST);
-                if (actual_count != globals[symbol].parameter_count) {
-                    semantic_error_at(node, "function '%s' expects %d argument(s), but %d provided",
-                        node->value, globals[symbol].parameter_count, actual_count);
-                }
-            }
-            for (struct ast_node *arg = node->left; arg; arg = arg->right) {
-                analyze_expression(arg->type == AST_ARG_LIST ? arg->left : arg);
-                if (arg->type != AST_ARG_LIST) {
-                    break;
-                }
+            resolve_call(sema, node);
+            for (int i = 0; i < node->left->child_count; i++) {
+                resolve_names(sema, node->left->children[i]);
             }
             return;
         case AST_CAST:
@@ -301,115 +335,35 @@ static void analyze_expression(struct ast_node *node)
         case AST_PRE_DECREMENT:
         case AST_POST_INCREMENT:
         case AST_POST_DECREMENT:
-            analyze_expression(node->left);
+            resolve_names(sema, node->left);
             return;
         case AST_CONDITIONAL:
-            analyze_expression(node->left);
-            analyze_expression(node->right->left);
-            analyze_expression(node->right->right);
+            resolve_names(sema, node->left);
+            resolve_names(sema, node->right->left);
+            resolve_names(sema, node->right->right);
             return;
         default:
-            analyze_expression(node->left);
-            analyze_expression(node->right);
+            resolve_names(sema, node->left);
+            resolve_names(sema, node->right);
             return;
     }
 }
 
-static void analyze_block(struct ast_node *node, int creates_scope)
-{
-    if (creates_scope) {
-        enter_scope();
-    }
-    if (node) {
-        analyze_statement(node->left);
-    }
-    if (creates_scope) {
-        leave_scope();
-    }
-}
-
-static void analyze_statement(struct ast_node *node)
-{
-    struct ast_node *parts;
-    struct ast_node *condition_and_post;
-
-    if (!node) {
-        return;
-    }
-
-    switch (node->type) {
-        case AST_BLOCK:
-            analyze_block(node, 1);
-            break;
-        case AST_STATEMENT_LIST:
-            analyze_statement(node->left);
-            analyze_statement(node->right);
-            break;
-        case AST_DECL:
-            add_local(node, node->data_type);
-            analyze_expression(node->left);
-            break;
-        case AST_EXPR_STMT:
-        case AST_RETURN:
-            analyze_expression(node->left);
-            break;
-        case AST_IF:
-            analyze_expression(node->left);
-            analyze_statement(node->right->left);
-            analyze_statement(node->right->right);
-            break;
-        case AST_WHILE:
-            analyze_expression(node->left);
-            loop_depth++;
-            analyze_statement(node->right);
-            loop_depth--;
-            break;
-        case AST_FOR:
-            enter_scope();
-            parts = node->left;
-            condition_and_post = parts->right;
-            if (parts->left && parts->left->type == AST_DECL) {
-                analyze_statement(parts->left);
-            } else {
-                analyze_expression(parts->left);
-            }
-            analyze_expression(condition_and_post->left);
-            analyze_expression(condition_and_post->right);
-            loop_depth++;
-            analyze_statement(node->right);
-            loop_depth--;
-            leave_scope();
-            break;
-        case AST_BREAK:
-            if (loop_depth == 0) {
-                semantic_error_at(node, "'break' statement is not inside a loop");
-            }
-            break;
-        case AST_CONTINUE:
-            if (loop_depth == 0) {
-                semantic_error_at(node, "'continue' statement is not inside a loop");
-            }
-            break;
-        default:
-            analyze_expression(node);
-            break;
-    }
-}
-
-static void collect_top_level(struct ast_node *node)
+static void collect_top_level(struct semantic *sema, struct ast_node *node)
 {
     if (!node) {
         return;
     }
     if (node->type == AST_PROGRAM) {
-        collect_top_level(node->left);
+        collect_top_level(sema, node->left);
     } else if (node->type == AST_FUNCTION_LIST) {
-        collect_top_level(node->left);
-        collect_top_level(node->right);
+        for (int i = 0; i < node->child_count; i++) {
+            collect_top_level(sema, node->children[i]);
+        }
     } else if (node->type == AST_FUNCTION) {
-        add_global(node);
+        add_global(sema, node);
     } else if (node->type == AST_GLOBAL_DECL) {
-        add_global(node);
+        add_global(sema, node);
     }
 }
 
@@ -424,8 +378,8 @@ static int is_constant_expression(struct ast_node *node)
         case AST_SIZEOF:
             return 1;
         case AST_INITIALIZER_LIST:
-            for (struct ast_node *item = initializer_items(node); item; item = item->right) {
-                if (!is_constant_expression(item->left)) {
+            for (int i = 0; i < node->child_count; i++) {
+                if (!is_constant_expression(node->children[i])) {
                     return 0;
                 }
             }
@@ -464,38 +418,6 @@ static int is_constant_expression(struct ast_node *node)
     }
 }
 
-static void analyze_top_level(struct ast_node *node)
-{
-    struct ast_node *param;
-
-    if (!node) {
-        return;
-    }
-    if (node->type == AST_PROGRAM) {
-        analyze_top_level(node->left);
-    } else if (node->type == AST_FUNCTION_LIST) {
-        analyze_top_level(node->left);
-        analyze_top_level(node->right);
-    } else if (node->type == AST_GLOBAL_DECL) {
-        if (!is_constant_expression(node->left)) {
-            semantic_error_at(node, "initializer for global '%s' is not a constant expression", node->value);
-        }
-    } else if (node->type == AST_FUNCTION) {
-        current_function = node->value;
-        local_count = 0;
-        scope_depth = 1;
-        loop_depth = 0;
-
-        for (param = node->left; param; param = param->right) {
-            if (param->type == AST_PARAM_LIST) {
-                add_local(param->left, param->left->data_type);
-            }
-        }
-        analyze_block(node->right, 0);
-        current_function = NULL;
-    }
-}
-
 static CType integer_promotion(CType type)
 {
     if (type == TYPE_CHAR || type == TYPE_UCHAR ||
@@ -518,25 +440,26 @@ static CType usual_arithmetic_type(CType left, CType right)
     return TYPE_INT;
 }
 
-static void insert_conversion(struct ast_node **slot, CType target)
+static void insert_conversion(struct semantic *sema, struct ast_node **slot, CType target)
 {
     struct ast_node *cast;
 
     if (!slot || !*slot || target == TYPE_INVALID || (*slot)->data_type == target) {
         return;
     }
-    cast = create_ast_node(AST_CAST, (char *)semantic_type_name(target), *slot, NULL);
+    cast = arena_ast_node(sema->arena, AST_CAST, semantic_type_name(target), *slot, NULL, (*slot)->location);
     cast->data_type = target;
     *slot = cast;
+    sema->conversion_casts++;
 }
 
-static CType check_expression_type(struct ast_node **slot);
-static void check_initializer_list_types(struct ast_node *declaration);
+static CType check_expression_type(struct semantic *sema, struct ast_node **slot);
+static void check_initializer_list_types(struct semantic *sema, struct ast_node *declaration);
 
-static CType check_binary_type(struct ast_node *node)
+static CType check_binary_type(struct semantic *sema, struct ast_node *node)
 {
-    CType left = check_expression_type(&node->left);
-    CType right = check_expression_type(&node->right);
+    CType left = check_expression_type(sema, &node->left);
+    CType right = check_expression_type(sema, &node->right);
     CType common;
     int left_pointer_depth = semantic_effective_pointer_depth(node->left);
     int right_pointer_depth = semantic_effective_pointer_depth(node->right);
@@ -566,7 +489,7 @@ static CType check_binary_type(struct ast_node *node)
             node->array_length = 0;
             return node->data_type = left;
         }
-        semantic_error_at(node, "invalid operands to pointer arithmetic");
+        type_error_at(sema, node, "invalid operands to pointer arithmetic");
         return node->data_type = TYPE_INVALID;
     }
     if (node->type == AST_LOGICAL_AND || node->type == AST_LOGICAL_OR) {
@@ -575,14 +498,14 @@ static CType check_binary_type(struct ast_node *node)
     if (node->type == AST_SHIFT_LEFT || node->type == AST_SHIFT_RIGHT) {
         left = integer_promotion(left);
         right = integer_promotion(right);
-        insert_conversion(&node->left, left);
-        insert_conversion(&node->right, right);
+        insert_conversion(sema, &node->left, left);
+        insert_conversion(sema, &node->right, right);
         return node->data_type = left;
     }
 
     common = usual_arithmetic_type(left, right);
-    insert_conversion(&node->left, common);
-    insert_conversion(&node->right, common);
+    insert_conversion(sema, &node->left, common);
+    insert_conversion(sema, &node->right, common);
     if (node->type == AST_EQUAL || node->type == AST_NOT_EQUAL ||
         node->type == AST_LESS || node->type == AST_LESS_EQUAL ||
         node->type == AST_GREATER || node->type == AST_GREATER_EQUAL) {
@@ -591,13 +514,12 @@ static CType check_binary_type(struct ast_node *node)
     return node->data_type = common;
 }
 
-static CType check_expression_type(struct ast_node **slot)
+static CType check_expression_type(struct semantic *sema, struct ast_node **slot)
 {
     struct ast_node *node;
-    struct ast_node *argument;
+    struct ast_node *parameters;
     int local;
     int global;
-    int argument_index;
     CType left;
     CType right;
     CType common;
@@ -613,57 +535,58 @@ static CType check_expression_type(struct ast_node **slot)
         case AST_SIZEOF:
             return node->data_type = TYPE_UINT;
         case AST_INITIALIZER_LIST:
-            semantic_error_at(node, "initializer list is not valid in this expression");
+            type_error_at(sema, node, "initializer list is not valid in this expression");
+            resolve_names(sema, node);
             return node->data_type = TYPE_INVALID;
         case AST_IDENTIFIER:
-            local = find_local(node->value);
-            global = find_global(node->value);
+            local = find_local(sema, node->value);
+            global = local < 0 ? find_global(sema, node->value) : -1;
             if (local >= 0) {
-                node->data_type = locals[local].type;
-                node->pointer_depth = locals[local].pointer_depth;
-                node->array_length = locals[local].array_length;
-                return node->data_type;
+                node->symbol = sema->locals[local].symbol;
+            } else if (global >= 0 && sema->globals[global].symbol->kind == SYMBOL_GLOBAL) {
+                node->symbol = sema->globals[global].symbol;
             }
-            if (global >= 0 && !globals[global].is_function) {
-                node->pointer_depth = globals[global].pointer_depth;
-                node->array_length = globals[global].array_length;
-                return node->data_type = globals[global].type;
+            if (node->symbol) {
+                node->pointer_depth = node->symbol->pointer_depth;
+                node->array_length = node->symbol->array_length;
+                return node->data_type = node->symbol->type;
             }
+            semantic_error_at(sema, node, "use of undeclared variable '%s'", node->value);
             return node->data_type = TYPE_INVALID;
         case AST_CALL:
-            global = find_global(node->value);
-            argument_index = 0;
-            for (argument = node->left; argument; argument = argument->right) {
-                check_expression_type(&argument->left);
-                if (global >= 0 && globals[global].is_function &&
-                    argument_index < globals[global].parameter_count) {
-                    if (semantic_effective_pointer_depth(argument->left) !=
-                        globals[global].parameter_pointer_depths[argument_index]) {
-                        semantic_format_type(globals[global].parameter_types[argument_index],
-                            globals[global].parameter_pointer_depths[argument_index], 0,
+            global = resolve_call(sema, node);
+            parameters = global >= 0 ? sema->globals[global].parameters : NULL;
+            node->symbol = global >= 0 ? sema->globals[global].symbol : NULL;
+            for (int i = 0; i < node->left->child_count; i++) {
+                struct ast_node **argument = &node->left->children[i];
+
+                check_expression_type(sema, argument);
+                if (parameters && i < parameters->child_count) {
+                    struct ast_node *parameter = parameters->children[i];
+
+                    if (semantic_effective_pointer_depth(*argument) != parameter->pointer_depth) {
+                        semantic_format_type(parameter->data_type, parameter->pointer_depth, 0,
                             left_name, sizeof(left_name));
-                        semantic_format_type(argument->left->data_type,
-                            semantic_effective_pointer_depth(argument->left), 0,
+                        semantic_format_type((*argument)->data_type,
+                            semantic_effective_pointer_depth(*argument), 0,
                             right_name, sizeof(right_name));
-                        semantic_error_at(argument->left, "cannot pass %s as %s", right_name, left_name);
-                    } else if (semantic_effective_pointer_depth(argument->left) == 0) {
-                        insert_conversion(&argument->left,
-                            globals[global].parameter_types[argument_index]);
+                        type_error_at(sema, *argument, "cannot pass %s as %s", right_name, left_name);
+                    } else if (semantic_effective_pointer_depth(*argument) == 0) {
+                        insert_conversion(sema, argument, parameter->data_type);
                     }
                 }
-                argument_index++;
             }
-            if (global >= 0 && globals[global].is_function) {
-                node->pointer_depth = globals[global].pointer_depth;
-                return node->data_type = globals[global].type;
+            if (node->symbol) {
+                node->pointer_depth = node->symbol->pointer_depth;
+                return node->data_type = node->symbol->type;
             }
             return node->data_type = TYPE_INVALID;
         case AST_ADDRESS_OF:
-            check_expression_type(&node->left);
+            check_expression_type(sema, &node->left);
             if (node->left->type != AST_IDENTIFIER &&
                 node->left->type != AST_DEREFERENCE &&
                 node->left->type != AST_ARRAY_SUBSCRIPT) {
-                semantic_error_at(node, "operand of '&' must be an lvalue");
+                type_error_at(sema, node, "operand of '&' must be an lvalue");
                 return node->data_type = TYPE_INVALID;
             }
             node->data_type = node->left->data_type;
@@ -671,9 +594,9 @@ static CType check_expression_type(struct ast_node **slot)
             node->array_length = 0;
             return node->data_type;
         case AST_DEREFERENCE:
-            check_expression_type(&node->left);
+            check_expression_type(sema, &node->left);
             if (node->left->pointer_depth <= 0) {
-                semantic_error_at(node, "cannot dereference non-pointer expression");
+                type_error_at(sema, node, "cannot dereference non-pointer expression");
                 return node->data_type = TYPE_INVALID;
             }
             node->data_type = node->left->data_type;
@@ -681,14 +604,14 @@ static CType check_expression_type(struct ast_node **slot)
             node->array_length = 0;
             return node->data_type;
         case AST_ARRAY_SUBSCRIPT:
-            check_expression_type(&node->left);
-            check_expression_type(&node->right);
+            check_expression_type(sema, &node->left);
+            check_expression_type(sema, &node->right);
             if (!semantic_is_integer(node->right->data_type, node->right->pointer_depth,
                     node->right->array_length)) {
-                semantic_error_at(node->right, "array subscript must be an integer");
+                type_error_at(sema, node->right, "array subscript must be an integer");
             }
             if (node->left->array_length <= 0 && node->left->pointer_depth <= 0) {
-                semantic_error_at(node, "subscripted expression is not an array or pointer");
+                type_error_at(sema, node, "subscripted expression is not an array or pointer");
                 return node->data_type = TYPE_INVALID;
             }
             node->data_type = node->left->data_type;
@@ -697,30 +620,30 @@ static CType check_expression_type(struct ast_node **slot)
             node->array_length = 0;
             return node->data_type;
         case AST_CAST:
-            check_expression_type(&node->left);
+            check_expression_type(sema, &node->left);
             if (node->data_type == TYPE_INVALID)
                 node->data_type = semantic_type_from_name(node->value);
             return node->data_type;
         case AST_NEGATION:
         case AST_BITWISE_COMPLEMENT:
-            left = integer_promotion(check_expression_type(&node->left));
-            insert_conversion(&node->left, left);
+            left = integer_promotion(check_expression_type(sema, &node->left));
+            insert_conversion(sema, &node->left, left);
             return node->data_type = left;
         case AST_LOGICAL_NEGATION:
-            check_expression_type(&node->left);
+            check_expression_type(sema, &node->left);
             return node->data_type = TYPE_INT;
         case AST_PRE_INCREMENT:
         case AST_PRE_DECREMENT:
         case AST_POST_INCREMENT:
         case AST_POST_DECREMENT:
-            node->data_type = check_expression_type(&node->left);
+            node->data_type = check_expression_type(sema, &node->left);
             node->pointer_depth = semantic_effective_pointer_depth(node->left);
             return node->data_type;
         case AST_ASSIGN:
-            left = check_expression_type(&node->left);
-            check_expression_type(&node->right);
+            left = check_expression_type(sema, &node->left);
+            check_expression_type(sema, &node->right);
             if (node->left->array_length > 0) {
-                semantic_error_at(node->left, "cannot assign to array '%s'", node->left->value);
+                type_error_at(sema, node->left, "cannot assign to array '%s'", node->left->value);
             } else if (!semantic_type_matches(left, semantic_effective_pointer_depth(node->left),
                     node->right->data_type, semantic_effective_pointer_depth(node->right))) {
                 if (semantic_effective_pointer_depth(node->left) > 0 ||
@@ -730,192 +653,397 @@ static CType check_expression_type(struct ast_node **slot)
                     semantic_format_type(node->right->data_type,
                         semantic_effective_pointer_depth(node->right), 0,
                         right_name, sizeof(right_name));
-                    semantic_error_at(node, "cannot assign %s to %s", right_name, left_name);
+                    type_error_at(sema, node, "cannot assign %s to %s", right_name, left_name);
                 } else {
-                    insert_conversion(&node->right, left);
+                    insert_conversion(sema, &node->right, left);
                 }
             }
             node->pointer_depth = semantic_effective_pointer_depth(node->left);
             return node->data_type = left;
         case AST_CONDITIONAL:
-            check_expression_type(&node->left);
-            left = check_expression_type(&node->right->left);
-            right = check_expression_type(&node->right->right);
+            check_expression_type(sema, &node->left);
+            left = check_expression_type(sema, &node->right->left);
+            right = check_expression_type(sema, &node->right->right);
             common = usual_arithmetic_type(left, right);
-            insert_conversion(&node->right->left, common);
-            insert_conversion(&node->right->right, common);
+            insert_conversion(sema, &node->right->left, common);
+            insert_conversion(sema, &node->right->right, common);
             return node->data_type = common;
         case AST_COMMA:
-            check_expression_type(&node->left);
-            return node->data_type = check_expression_type(&node->right);
+            check_expression_type(sema, &node->left);
+            return node->data_type = check_expression_type(sema, &node->right);
         default:
-            return check_binary_type(node);
+            return check_binary_type(sema, node);
     }
 }
 
-static void check_initializer_list_types(struct ast_node *declaration)
+static void check_initializer_list_types(struct semantic *sema, struct ast_node *declaration)
 {
-    int index = 0;
-    struct ast_node *item;
+    struct ast_node *list = declaration->left;
 
     if (!declaration->left) {
         return;
     }
     if (declaration->left->type != AST_INITIALIZER_LIST) {
-        semantic_error_at(declaration->left, "array initializer must be brace-enclosed");
+        type_error_at(sema, declaration->left, "array initializer must be brace-enclosed");
+        resolve_names(sema, declaration->left);
         return;
     }
 
-    for (item = initializer_items(declaration->left); item; item = item->right) {
-        if (index >= declaration->array_length) {
-            semantic_error_at(item->left ? item->left : item,
-                "too many initializers for array '%s'", declaration->value);
+    for (int i = 0; i < list->child_count; i++) {
+        if (i >= declaration->array_length) {
+            type_error_at(sema, list->children[i], "too many initializers for array '%s'", declaration->value);
+            while (i < list->child_count) {
+                resolve_names(sema, list->children[i++]);
+            }
             return;
         }
-        check_expression_type(&item->left);
-        if (item->left) {
-            insert_conversion(&item->left, declaration->data_type);
-        }
-        index++;
+        check_expression_type(sema, &list->children[i]);
+        insert_conversion(sema, &list->children[i], declaration->data_type);
+    }
+}
+
+static void check_declaration(struct semantic *sema, struct ast_node *node)
+{
+    char left_name[64];
+    char right_name[64];
+
+    sema->frame_slots += node->array_length > 0 ? node->array_length : 1;
+    add_local(sema, node, -4 * sema->frame_slots);
+    if (!node->left) {
+        return;
+    }
+    if (node->array_length > 0) {
+        check_initializer_list_types(sema, node);
+        return;
+    }
+    if (node->left->type == AST_INITIALIZER_LIST) {
+        type_error_at(sema, node->left, "initializer list is only valid for arrays");
+        resolve_names(sema, node->left);
+        return;
+    }
+
+    check_expression_type(sema, &node->left);
+    if (node->pointer_depth == 0 && semantic_effective_pointer_depth(node->left) == 0) {
+        insert_conversion(sema, &node->left, node->data_type);
+    } else if (!semantic_type_matches(node->data_type, node->pointer_depth,
+            node->left->data_type, semantic_effective_pointer_depth(node->left))) {
+        semantic_format_type(node->data_type, node->pointer_depth, 0,
+            left_name, sizeof(left_name));
+        semantic_format_type(node->left->data_type,
+            semantic_effective_pointer_depth(node->left), 0,
+            right_name, sizeof(right_name));
+        type_error_at(sema, node, "cannot initialize %s with %s", left_name, right_name);
+    }
+}
+
+static void check_return(struct semantic *sema, struct ast_node *node)
+{
+    char left_name[64];
+    char right_name[64];
+
+    check_expression_type(sema, &node->left);
+    if (sema->current_return_pointer_depth == 0 && semantic_effective_pointer_depth(node->left) == 0) {
+        insert_conversion(sema, &node->left, sema->current_return_type);
+    } else if (!semantic_type_matches(sema->current_return_type, sema->current_return_pointer_depth,
+            node->left->data_type, semantic_effective_pointer_depth(node->left))) {
+        semantic_format_type(sema->current_return_type, sema->current_return_pointer_depth, 0,
+            left_name, sizeof(left_name));
+        semantic_format_type(node->left->data_type,
+            semantic_effective_pointer_depth(node->left), 0,
+            right_name, sizeof(right_name));
+        type_error_at(sema, node, "cannot return %s from function returning %s",
+            right_name, left_name);
     }
 }
 
-static void check_statement_types(struct ast_node *node)
+static void check_statement(struct semantic *sema, struct ast_node *node)
 {
     struct ast_node *parts;
     struct ast_node *condition_and_post;
 
-    if (!node) return;
+    if (!node) {
+        return;
+    }
+
     switch (node->type) {
         case AST_BLOCK:
-            enter_scope();
-            check_statement_types(node->left);
-            leave_scope();
+            enter_scope(sema);
+            check_statement(sema, node->left);
+            leave_scope(sema);
             break;
         case AST_STATEMENT_LIST:
-            check_statement_types(node->left);
-            check_statement_types(node->right);
+            for (int i = 0; i < node->child_count; i++) {
+                check_statement(sema, node->children[i]);
+            }
             break;
         case AST_DECL:
-            add_local(node, node->data_type);
-            if (node->left) {
-                if (node->array_length > 0) {
-                    check_initializer_list_types(node);
-                } else if (node->left->type == AST_INITIALIZER_LIST) {
-                    semantic_error_at(node->left, "initializer list is only valid for arrays");
-                } else {
-                    check_expression_type(&node->left);
-                    if (node->pointer_depth > 0 || semantic_effective_pointer_depth(node->left) > 0) {
-                    if (!semantic_type_matches(node->data_type, node->pointer_depth,
-                            node->left->data_type, semantic_effective_pointer_depth(node->left))) {
-                        char left_name[64];
-                        char right_name[64];
-                        semantic_format_type(node->data_type, node->pointer_depth, 0,
-                            left_name, sizeof(left_name));
-                        semantic_format_type(node->left->data_type,
-                            semantic_effective_pointer_depth(node->left), 0,
-                            right_name, sizeof(right_name));
-                        semantic_error_at(node, "cannot initialize %s with %s", left_name, right_name);
-                    }
-                    } else {
-                        insert_conversion(&node->left, node->data_type);
-                    }
-                }
-            }
+            check_declaration(sema, node);
             break;
         case AST_EXPR_STMT:
-            check_expression_type(&node->left);
+            check_expression_type(sema, &node->left);
             break;
         case AST_RETURN:
-            check_expression_type(&node->left);
-            if (current_return_pointer_depth > 0 || semantic_effective_pointer_depth(node->left) > 0) {
-                if (!semantic_type_matches(current_return_type, current_return_pointer_depth,
-                        node->left->data_type, semantic_effective_pointer_depth(node->left))) {
-                    char left_name[64];
-                    char right_name[64];
-                    semantic_format_type(current_return_type, current_return_pointer_depth, 0,
-                        left_name, sizeof(left_name));
-                    semantic_format_type(node->left->data_type,
-                        semantic_effective_pointer_depth(node->left), 0,
-                        right_name, sizeof(right_name));
-                    semantic_error_at(node, "cannot return %s from function returning %s",
-                        right_name, left_name);
-                }
-            } else {
-                insert_conversion(&node->left, current_return_type);
-            }
+            check_return(sema, node);
             break;
         case AST_IF:
-            check_expression_type(&node->left);
-            check_statement_types(node->right->left);
-            check_statement_types(node->right->right);
+            check_expression_type(sema, &node->left);
+            check_statement(sema, node->right->left);
+            check_statement(sema, node->right->right);
             break;
         case AST_WHILE:
-            check_expression_type(&node->left);
-            check_statement_types(node->right);
+            check_expression_type(sema, &node->left);
+            sema->loop_depth++;
+            check_statement(sema, node->right);
+            sema->loop_depth--;
             break;
         case AST_FOR:
-            enter_scope();
+            enter_scope(sema);
             parts = node->left;
             condition_and_post = parts->right;
-            if (parts->left && parts->left->type == AST_DECL)
-                check_statement_types(parts->left);
-            else
-                check_expression_type(&parts->left);
-            check_expression_type(&condition_and_post->left);
-            check_expression_type(&condition_and_post->right);
-            check_statement_types(node->right);
-            leave_scope();
+            if (parts->left && parts->left->type == AST_DECL) {
+                check_statement(sema, parts->left);
+            } else {
+                check_expression_type(sema, &parts->left);
+            }
+            check_expression_type(sema, &condition_and_post->left);
+            check_expression_type(sema, &condition_and_post->right);
+            sema->loop_depth++;
+            check_statement(sema, node->right);
+            sema->loop_depth--;
+            leave_scope(sema);
+            break;
+        case AST_BREAK:
+            if (sema->loop_depth == 0) {
+                semantic_error_at(sema, node, "'break' statement is not inside a loop");
+            }
+            break;
+        case AST_CONTINUE:
+            if (sema->loop_depth == 0) {
+                semantic_error_at(sema, node, "'continue' statement is not inside a loop");
+            }
             break;
         default:
+            resolve_names(sema, node);
             break;
     }
 }
 
-static void check_top_level_types(struct ast_node *node)
+/* Reports an initializer value that codegen could only compute by trapping. */
+static void check_global_value(struct semantic *sema, struct ast_node *global, struct ast_node *node)
 {
-    struct ast_node *param;
+    int value;
 
-    if (!node) return;
+    if (!evaluate_constant(node, &value)) {
+        semantic_error_at(sema, node, "initializer for global '%s' divides by zero or overflows",
+            global->value);
+    }
+}
+
+/* Global initializers are constant, so they have no names to resolve. */
+static void check_global(struct semantic *sema, struct ast_node *node)
+{
+    int type_error_count = sema->type_error_count;
+
+    if (!is_constant_expression(node->left)) {
+        semantic_error_at(sema, node, "initializer for global '%s' is not a constant expression", node->value);
+    } else if (node->left) {
+        if (node->array_length > 0) {
+            check_initializer_list_types(sema, node);
+            if (sema->type_error_count == type_error_count) {
+                for (int i = 0; i < node->left->child_count; i++) {
+                    check_global_value(sema, node, node->left->children[i]);
+                }
+            }
+        } else if (node->left->type == AST_INITIALIZER_LIST) {
+            type_error_at(sema, node->left, "initializer list is only valid for arrays");
+        } else {
+            check_expression_type(sema, &node->left);
+            insert_conversion(sema, &node->left, node->data_type);
+            if (sema->type_error_count == type_error_count) {
+                check_global_value(sema, node, node->left);
+            }
+        }
+    }
+}
+
+/*
+ * Locals get frame slots in declaration order and keep them after their
+ * scope ends; parameters sit above the saved %ebp and return address.
+ */
+static void check_function(struct semantic *sema, struct ast_node *node)
+{
+    int error_count = sema->error_count + sema->type_error_count;
+
+    sema->current_function = node->value;
+    sema->current_return_type = node->data_type;
+    sema->current_return_pointer_depth = node->pointer_depth;
+    sema->scope_depth = 1;
+    sema->loop_depth = 0;
+    sema->frame_slots = 0;
+
+    for (int i = 0; i < node->left->child_count; i++) {
+        add_local(sema, node->left->children[i], 8 + 4 * i);
+    }
+    if (node->right) {
+        check_statement(sema, node->right->left);
+    }
+    /*
+     * The definition gets a record of its own for the frame size, so that
+     * functions checked on different forks never write to a shared one.
+     */
+    new_symbol(sema, SYMBOL_FUNCTION, node)->frame_size = 4 * sema->frame_slots;
+    if (node->right && sema->error_count + sema->type_error_count == error_count) {
+        fold_function(node, sema->arena);
+    }
+    /* Streaming compiles release the locals' records along with the function. */
+    clear_locals(sema);
+    sema->current_function = NULL;
+}
+
+static void check_top_level(struct semantic *sema, struct ast_node *node)
+{
+    if (!node) {
+        return;
+    }
     if (node->type == AST_PROGRAM) {
-        check_top_level_types(node->left);
+        check_top_level(sema, node->left);
     } else if (node->type == AST_FUNCTION_LIST) {
-        check_top_level_types(node->left);
-        check_top_level_types(node->right);
-    } else if (node->type == AST_GLOBAL_DECL) {
-        if (node->left) {
-            if (node->array_length > 0) {
-                check_initializer_list_types(node);
-            } else if (node->left->type == AST_INITIALIZER_LIST) {
-                semantic_error_at(node->left, "initializer list is only valid for arrays");
-            } else {
-                check_expression_type(&node->left);
-                insert_conversion(&node->left, node->data_type);
-            }
+        for (int i = 0; i < node->child_count; i++) {
+            check_top_level(sema, node->children[i]);
         }
+    } else if (node->type == AST_GLOBAL_DECL) {
+        check_global(sema, node);
     } else if (node->type == AST_FUNCTION) {
-        current_return_type = node->data_type;
-        current_return_pointer_depth = node->pointer_depth;
-        local_count = 0;
-        scope_depth = 1;
-        for (param = node->left; param; param = param->right)
-            add_local(param->left, param->left->data_type);
-        if (node->right) check_statement_types(node->right->left);
-    }
-}
-
-int semantic_analyze(struct ast_node *ast, const char *source_path)
-{
-    semantic_source_path = source_path;
-    global_count = 0;
-    local_count = 0;
-    scope_depth = 0;
-    loop_depth = 0;
-    error_count = 0;
-    current_function = NULL;
-
-    collect_top_level(ast);
-    analyze_top_level(ast);
-    if (error_count == 0) check_top_level_types(ast);
-    return error_count == 0;
+        check_function(sema, node);
+    }
+}
+
+struct semantic *semantic_create(struct compilation *unit)
+{
+    struct semantic *sema = calloc(1, sizeof(*sema));
+
+    if (!sema) {
+        perror("Error allocating semantic state");
+        exit(EXIT_FAILURE);
+    }
+    sema->unit = unit;
+    sema->arena = &unit->ast_arena;
+    sema->diagnostics = &unit->diagnostics;
+    emitter_init(&sema->held_type_errors, NULL);
+    sema->type_errors = &sema->held_type_errors;
+    return sema;
+}
+
+void semantic_destroy(struct semantic *sema)
+{
+    free(sema->locals);
+    symbol_map_free(&sema->local_map);
+    if (sema->parent) {
+        sema->parent->conversion_casts += sema->conversion_casts;
+    } else {
+        /* Conversion casts are the only nodes semantic analysis creates. */
+        sema->unit->stats.conversion_casts += sema->conversion_casts;
+        sema->unit->stats.ast_nodes += sema->conversion_casts;
+        free(sema->globals);
+        symbol_map_free(&sema->global_map);
+        emitter_release(&sema->held_type_errors);
+    }
+    free(sema);
+}
+
+/*
+ * Makes a context that checks declarations against sema's globals, which
+ * must all be declared already and are only read from then on. The fork
+ * allocates symbols and casts in arena and reports through
+ * semantic_check_into(), so forks can run on separate threads.
+ */
+struct semantic *semantic_fork(struct semantic *sema, struct arena *arena)
+{
+    struct semantic *fork = calloc(1, sizeof(*fork));
+
+    if (!fork) {
+        perror("Error allocating semantic state");
+        exit(EXIT_FAILURE);
+    }
+    fork->unit = sema->unit;
+    fork->parent = sema;
+    fork->arena = arena;
+    fork->globals = sema->globals;
+    fork->global_map = sema->global_map;
+    fork->global_count = sema->global_count;
+    return fork;
+}
+
+/* Checks one top-level declaration on a fork, keeping its diagnostics in result. */
+void semantic_check_into(struct semantic *fork, struct ast_node *declaration,
+    struct check_result *result)
+{
+    emitter_init(&result->errors, NULL);
+    emitter_init(&result->type_errors, NULL);
+    fork->diagnostics = &result->errors;
+    fork->type_errors = &result->type_errors;
+    fork->error_count = 0;
+    fork->type_error_count = 0;
+    check_top_level(fork, declaration);
+    result->error_count = fork->error_count;
+    result->type_error_count = fork->type_error_count;
+    fork->diagnostics = NULL;
+    fork->type_errors = NULL;
+}
+
+/*
+ * Folds a fork's result into sema as if sema had checked the declaration
+ * itself. Merging results in source order reproduces a serial check.
+ */
+void semantic_merge(struct semantic *sema, struct check_result *result)
+{
+    emitter_append(sema->diagnostics, &result->errors);
+    emitter_append(sema->type_errors, &result->type_errors);
+    sema->error_count += result->error_count;
+    sema->type_error_count += result->type_error_count;
+    emitter_release(&result->errors);
+    emitter_release(&result->type_errors);
+}
+
+/*
+ * Streaming compiles check one top-level declaration at a time. Each is
+ * declared in a first pass, so calls to functions defined later resolve as
+ * usual, and then checked in order; semantic_finish() reports the held-back
+ * type errors at the end.
+ */
+void semantic_declare(struct semantic *sema, struct ast_node *declaration)
+{
+    stats_phase_begin(sema->unit);
+    collect_top_level(sema, declaration);
+    stats_phase_end(sema->unit, PHASE_SEMANTIC_COLLECT);
+}
+
+/* Returns 1 while no semantic error of either kind has been found. */
+int semantic_check(struct semantic *sema, struct ast_node *declaration)
+{
+    stats_phase_begin(sema->unit);
+    check_top_level(sema, declaration);
+    stats_phase_end(sema->unit, PHASE_SEMANTIC_CHECK);
+    return sema->error_count == 0 && sema->type_error_count == 0;
+}
+
+/* Reports the type errors if every name resolved and returns 1 if there were no errors. */
+int semantic_finish(struct semantic *sema)
+{
+    if (sema->error_count == 0 && sema->type_error_count > 0) {
+        compilation_diagnostic(sema->unit, "%s", emitter_text(sema->type_errors));
+    }
+    return sema->error_count == 0 && sema->type_error_count == 0;
+}
+
+int semantic_analyze(struct compilation *unit, struct ast_node *ast)
+{
+    struct semantic *sema = semantic_create(unit);
+    int ok;
+
+    semantic_declare(sema, ast);
+    semantic_check(sema, ast);
+    ok = semantic_finish(sema);
+    semantic_destroy(sema);
+    return ok;
 }
@@ -0,0 +1,434 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+#include "donkey.h"
+
+/*
+ * Compile server. `donkey --serve PATH` listens on a Unix domain socket and
+ * compiles requests with libdonkey contexts that are kept in a pool, so the
+ * token buffers, string tables and arenas of earlier requests are reused.
+ * `donkey --client PATH input [output]` is a drop-in replacement for the
+ * plain `donkey input [output]` invocation that sends the work there.
+ *
+ * Every message is a sequence of fields, each a 32-bit big-endian length
+ * followed by that many bytes. A request is (name, options, source) and a
+ * response is (status, diagnostics, assembly), where status is the decimal
+ * donkey_status. The options are the client's code generation flags, such
+ * as -O, separated by spaces. A connection may carry any number of requests.
+ */
+
+#ifndef _WIN32
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Caps what a peer can make the server allocate; responses are not limited. */
+#define MAX_REQUEST_FIELD_LENGTH (256u * 1024 * 1024)
+
+struct field {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+struct context_pool {
+    struct donkey_context **idle;
+    int idle_count;
+    int idle_capacity;
+    pthread_mutex_t lock;
+};
+
+static struct context_pool pool = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+static volatile sig_atomic_t stop_requested;
+
+static int read_exact(int fd, void *buffer, size_t length)
+{
+    char *cursor = buffer;
+
+    while (length > 0) {
+        ssize_t count = read(fd, cursor, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return 0;
+        }
+        cursor += count;
+        length -= (size_t)count;
+    }
+    return 1;
+}
+
+static int write_exact(int fd, const void *buffer, size_t length)
+{
+    const char *cursor = buffer;
+
+    while (length > 0) {
+        ssize_t count = write(fd, cursor, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return 0;
+        }
+        cursor += count;
+        length -= (size_t)count;
+    }
+    return 1;
+}
+
+/* Reads one field into a reused buffer and NUL-terminates it. */
+static int read_field(int fd, struct field *field, size_t max_length)
+{
+    uint32_t header;
+    size_t length;
+
+    if (!read_exact(fd, &header, sizeof(header))) {
+        return 0;
+    }
+    length = ntohl(header);
+    /* With a 32-bit size_t, length + 1 below would wrap for 0xFFFFFFFF. */
+    if (length > max_length || length == SIZE_MAX) {
+        return 0;
+    }
+    if (field->capacity < length + 1) {
+        char *resized = realloc(field->data, length + 1);
+
+        if (!resized) {
+            perror("Error allocating request buffer");
+            exit(EXIT_FAILURE);
+        }
+        field->data = resized;
+        field->capacity = length + 1;
+    }
+    if (!read_exact(fd, field->data, length)) {
+        return 0;
+    }
+    field->data[length] = '\0';
+    field->length = length;
+    return 1;
+}
+
+static int write_field(int fd, const char *data, size_t length)
+{
+    uint32_t header = htonl((uint32_t)length);
+
+    if (length > UINT32_MAX) {
+        return 0;
+    }
+    return write_exact(fd, &header, sizeof(header)) && write_exact(fd, data, length);
+}
+
+static struct donkey_context *acquire_context(void)
+{
+    struct donkey_context *context = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.idle_count > 0) {
+        context = pool.idle[--pool.idle_count];
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    if (!context) {
+        context = donkey_create();
+        if (!context) {
+            perror("Error allocating compiler context");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return context;
+}
+
+static void release_context(struct donkey_context *context)
+{
+    pthread_mutex_lock(&pool.lock);
+    if (pool.idle_count == pool.idle_capacity) {
+        int capacity = pool.idle_capacity ? pool.idle_capacity * 2 : 8;
+        struct donkey_context **idle = realloc(pool.idle, (size_t)capacity * sizeof(*idle));
+
+        if (!idle) {
+            perror("Error allocating context pool");
+            exit(EXIT_FAILURE);
+        }
+        pool.idle = idle;
+        pool.idle_capacity = capacity;
+    }
+    pool.idle[pool.idle_count++] = context;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Reads the options field into settings; returns 0 if any option is not a code generation one. */
+static int check_options(struct field *options, struct donkey_options *settings)
+{
+    struct compile_options parsed;
+    char *cursor = options->data;
+
+    if (strlen(options->data) != options->length) {
+        return 0;
+    }
+    memset(&parsed, 0, sizeof(parsed));
+    while (*cursor) {
+        char *end = strchr(cursor, ' ');
+
+        if (end) {
+            *end = '\0';
+        }
+        if (*cursor && parse_codegen_option(&parsed, cursor) != 1) {
+            return 0;
+        }
+        if (!end) {
+            break;
+        }
+        cursor = end + 1;
+    }
+    settings->optimize = parsed.optimize;
+    settings->peephole_off = parsed.peephole_off;
+    return 1;
+}
+
+static void *serve_connection(void *argument)
+{
+    int fd = (int)(intptr_t)argument;
+    struct field name = { NULL, 0, 0 };
+    struct field options = { NULL, 0, 0 };
+    struct field source = { NULL, 0, 0 };
+
+    while (read_field(fd, &name, MAX_REQUEST_FIELD_LENGTH) && read_field(fd, &options, MAX_REQUEST_FIELD_LENGTH) &&
+        read_field(fd, &source, MAX_REQUEST_FIELD_LENGTH)) {
+        struct donkey_context *context = acquire_context();
+        struct donkey_options settings;
+        const char *assembly = "";
+        size_t assembly_length = 0;
+        const char *diagnostics;
+        donkey_status status;
+        char status_text[16];
+        int sent;
+
+        if (check_options(&options, &settings)) {
+            status = donkey_compile_with_options(context, name.data, source.data, source.length, &settings,
+                &assembly, &assembly_length);
+            diagnostics = donkey_diagnostics(context);
+        } else {
+            status = DONKEY_ERROR_ARGUMENT;
+            diagnostics = "Unsupported compile options\n";
+        }
+
+        snprintf(status_text, sizeof(status_text), "%d", (int)status);
+        sent = write_field(fd, status_text, strlen(status_text)) &&
+            write_field(fd, diagnostics, strlen(diagnostics)) &&
+            write_field(fd, assembly, assembly_length);
+        release_context(context);
+        if (!sent) {
+            break;
+        }
+    }
+
+    free(name.data);
+    free(options.data);
+    free(source.data);
+    close(fd);
+    return NULL;
+}
+
+static void request_stop(int signal_number)
+{
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static int open_socket(const char *socket_path, struct sockaddr_un *address)
+{
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+        return -1;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+    }
+    return fd;
+}
+
+int serve(const char *socket_path)
+{
+    struct sockaddr_un address;
+    struct sigaction action;
+    struct stat info;
+    sigset_t stop_signals;
+    sigset_t previous_mask;
+    int listener = open_socket(socket_path, &address);
+
+    if (listener < 0) {
+        return 0;
+    }
+
+    /* Replace a socket left behind by an earlier server, but never a regular file. */
+    if (lstat(socket_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(socket_path);
+    }
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "Error listening on %s: %s\n", socket_path, strerror(errno));
+        close(listener);
+        return 0;
+    }
+
+    /* No SA_RESTART, so a signal interrupts accept() and the loop can exit. */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+
+    printf("Serving on %s\n", socket_path);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        pthread_t thread;
+        int connection = accept(listener, NULL, NULL);
+        int started;
+
+        if (connection < 0) {
+            if (errno != EINTR) {
+                perror("Error accepting connection");
+            }
+            continue;
+        }
+
+        /* Connection threads start with the stop signals blocked so they always reach accept(). */
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &previous_mask);
+        started = pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)connection) == 0;
+        pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+        if (started) {
+            pthread_detach(thread);
+        } else {
+            serve_connection((void *)(intptr_t)connection);
+        }
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 1;
+}
+
+static int write_assembly(const char *output_file, const struct field *assembly)
+{
+    FILE *out_file = fopen(output_file, "w");
+    int ok;
+
+    if (!out_file) {
+        fprintf(stderr, "Failed to open %s for writing: %s\n", output_file, strerror(errno));
+        return 0;
+    }
+    ok = fwrite(assembly->data, 1, assembly->length, out_file) == assembly->length;
+    if (fclose(out_file) != 0 || !ok) {
+        fprintf(stderr, "Error writing assembly output: %s\n", strerror(errno));
+        remove(output_file);
+        return 0;
+    }
+    return 1;
+}
+
+/* Sends one request and waits for its response. Returns 0 if the server could not be reached. */
+static int request_compile(const char *socket_path, const char *input, const struct source_file *source,
+    const struct compile_options *options, struct field *status, struct field *diagnostics,
+    struct field *assembly)
+{
+    struct sockaddr_un address;
+    struct emitter flags;
+    int fd = open_socket(socket_path, &address);
+    int ok;
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error connecting to %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    emitter_init(&flags, NULL);
+    format_codegen_options(&flags, options);
+    ok = write_field(fd, input, strlen(input)) && write_field(fd, emitter_text(&flags), flags.length) &&
+        write_field(fd, source->data, source->length) &&
+        read_field(fd, status, UINT32_MAX) && read_field(fd, diagnostics, UINT32_MAX) &&
+        read_field(fd, assembly, UINT32_MAX);
+    if (!ok) {
+        fprintf(stderr, "Error talking to compile server at %s\n", socket_path);
+    }
+    emitter_release(&flags);
+    close(fd);
+    return ok;
+}
+
+int compile_remote(const char *socket_path, const char *input, const char *output_file,
+    const struct compile_options *options)
+{
+    struct source_file source;
+    struct field status = { NULL, 0, 0 };
+    struct field diagnostics = { NULL, 0, 0 };
+    struct field assembly = { NULL, 0, 0 };
+    int ok;
+
+    if (!load_source_file(input, &source)) {
+        fprintf(stderr, "Error opening file %s: %s\n", input, strerror(errno));
+        return 0;
+    }
+
+    ok = request_compile(socket_path, input, &source, options, &status, &diagnostics, &assembly);
+    if (ok) {
+        fwrite(diagnostics.data, 1, diagnostics.length, stderr);
+        ok = atoi(status.data) == DONKEY_OK && write_assembly(output_file, &assembly);
+    }
+    if (ok) {
+        printf("Compiled %s -> %s\n", input, output_file);
+    }
+
+    release_source_file(&source);
+    free(status.data);
+    free(diagnostics.data);
+    free(assembly.data);
+    return ok;
+}
+
+#else
+
+int serve(const char *socket_path)
+{
+    (void)socket_path;
+    fprintf(stderr, "--serve needs Unix domain sockets, which this build does not support\n");
+    return 0;
+}
+
+int compile_remote(const char *socket_path, const char *input, const char *output_file,
+    const struct compile_options *options)
+{
+    (void)socket_path;
+    (void)input;
+    (void)output_file;
+    (void)options;
+    fprintf(stderr, "--client needs Unix domain sockets, which this build does not support\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int read_source_stream(const char *path, struct source_file *source)
+{
+    FILE *infile = fopen(path, "r");
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *data;
+
+    if (!infile) {
+        return 0;
+    }
+
+    data = malloc(capacity);
+    if (!data) {
+        perror("Error allocating source buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        size_t count;
+
+        if (capacity - length < 2) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+            if (!data) {
+                perror("Error allocating source buffer");
+                exit(EXIT_FAILURE);
+            }
+        }
+        count = fread(data + length, 1, capacity - length - 1, infile);
+        if (count == 0) {
+            break;
+        }
+        length += count;
+    }
+
+    fclose(infile);
+    data[length] = '\0';
+    source->data = data;
+    source->length = length;
+    source->mapped = 0;
+    return 1;
+}
+
+#ifndef _WIN32
+/*
+ * Regular files are mapped read-only. The lexer relies on a NUL sentinel after
+ * the last byte, which the kernel provides for free as long as the file does
+ * not end exactly on a page boundary; otherwise we fall back to reading.
+ */
+static int map_source_file(const char *path, struct source_file *source)
+{
+    struct stat info;
+    long page_size = sysconf(_SC_PAGESIZE);
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0 ||
+        page_size <= 0 || info.st_size % page_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    source->data = data;
+    source->length = (size_t)info.st_size;
+    source->mapped = 1;
+    return 1;
+}
+#endif
+
+int load_source_file(const char *path, struct source_file *source)
+{
+    source->data = NULL;
+    source->length = 0;
+    source->mapped = 0;
+
+#ifndef _WIN32
+    if (map_source_file(path, source)) {
+        return 1;
+    }
+#endif
+    return read_source_stream(path, source);
+}
+
+void release_source_file(struct source_file *source)
+{
+#ifndef _WIN32
+    if (source->mapped) {
+        munmap(source->data, source->length);
+        source->data = NULL;
+        return;
+    }
+#endif
+    free(source->data);
+    source->data = NULL;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+/*
+ * Per-phase statistics behind -ftime-report, -fmem-report and --stats-json,
+ * and the peephole rule counts behind -fpeephole-report.
+ * Every compile records them; it costs two clock reads and one getrusage()
+ * call per phase. Allocation figures cover the AST and string arenas, which
+ * hold everything that scales with the size of the input; codegen writes
+ * into growable emitter buffers instead, so its arena figures stay at zero
+ * and the emitted byte count stands for it.
+ */
+
+static const char *const phase_names[PHASE_COUNT] = {
+    [PHASE_LEX] = "lex",
+    [PHASE_PARSE] = "parse",
+    [PHASE_SEMANTIC_COLLECT] = "semantic collect",
+    [PHASE_SEMANTIC_CHECK] = "semantic check",
+    [PHASE_CODEGEN] = "codegen",
+};
+
+static const char *const phase_keys[PHASE_COUNT] = {
+    [PHASE_LEX] = "lex",
+    [PHASE_PARSE] = "parse",
+    [PHASE_SEMANTIC_COLLECT] = "semantic_collect",
+    [PHASE_SEMANTIC_CHECK] = "semantic_check",
+    [PHASE_CODEGEN] = "codegen",
+};
+
+static double now_seconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+/* Peak resident set size of the whole process in KiB, or -1 where unknown. */
+static long peak_rss_kb(void)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static size_t arena_allocations(const struct compilation *unit)
+{
+    return unit->ast_arena.allocation_count + unit->strings.arena.allocation_count;
+}
+
+static size_t arena_bytes(const struct compilation *unit)
+{
+    return unit->ast_arena.allocated_bytes + unit->strings.arena.allocated_bytes;
+}
+
+void stats_phase_begin(struct compilation *unit)
+{
+    unit->stats.phase_start = now_seconds();
+    unit->stats.allocations_start = arena_allocations(unit);
+    unit->stats.bytes_start = arena_bytes(unit);
+}
+
+void stats_phase_end(struct compilation *unit, CompilePhase phase)
+{
+    struct phase_stats *stats = &unit->stats.phases[phase];
+
+    stats->seconds += now_seconds() - unit->stats.phase_start;
+    stats->allocations += arena_allocations(unit) - unit->stats.allocations_start;
+    stats->arena_bytes += arena_bytes(unit) - unit->stats.bytes_start;
+    stats->peak_rss_kb = peak_rss_kb();
+    stats->ran = 1;
+}
+
+static double total_seconds(const struct compile_stats *stats)
+{
+    double total = 0;
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        total += stats->phases[i].seconds;
+    }
+    return total;
+}
+
+void stats_time_report(struct emitter *out, const char *input, const struct compile_stats *stats)
+{
+    double total = total_seconds(stats);
+
+    emit_format(out, "Time report for %s:\n", input);
+    emit_format(out, "  %-18s %12s %8s\n", "phase", "seconds", "share");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const struct phase_stats *phase = &stats->phases[i];
+
+        if (!phase->ran) {
+            continue;
+        }
+        emit_format(out, "  %-18s %12.6f %7.1f%%\n", phase_names[i], phase->seconds,
+            total > 0 ? 100.0 * phase->seconds / total : 0.0);
+    }
+    emit_format(out, "  %-18s %12.6f\n", "total", total);
+}
+
+void stats_mem_report(struct emitter *out, const char *input, const struct compile_stats *stats)
+{
+    emit_format(out, "Memory report for %s:\n", input);
+    emit_format(out, "  %-18s %12s %14s %14s\n", "phase", "arena allocs", "arena bytes", "peak RSS KiB");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const struct phase_stats *phase = &stats->phases[i];
+
+        if (!phase->ran) {
+            continue;
+        }
+        emit_format(out, "  %-18s %12lu %14lu ", phase_names[i], (unsigned long)phase->allocations,
+            (unsigned long)phase->arena_bytes);
+        if (phase->peak_rss_kb >= 0) {
+            emit_format(out, "%14ld\n", phase->peak_rss_kb);
+        } else {
+            emit_format(out, "%14s\n", "n/a");
+        }
+    }
+    emit_format(out, "  tokens %d, AST nodes %lu, conversion casts %d, bytes emitted %lu\n",
+        stats->token_count, (unsigned long)stats->ast_nodes, stats->conversion_casts,
+        (unsigned long)stats->bytes_emitted);
+}
+
+/* Functions reused from the cache count the hits stored with them when they were generated. */
+void stats_peephole_report(struct emitter *out, const char *input, const struct compile_stats *stats)
+{
+    int total = 0;
+
+    emit_format(out, "Peephole report for %s:\n", input);
+    emit_format(out, "  %-18s %12s\n", "rule", "hits");
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++) {
+        emit_format(out, "  %-18s %12d\n", peephole_rule_name(rule), stats->peephole_hits[rule]);
+        total += stats->peephole_hits[rule];
+    }
+    emit_format(out, "  %-18s %12d\n", "total", total);
+}
+
+static void write_json_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* Writes one JSON array with an object per input, in command-line order. */
+int stats_write_json(const char *path, const char **inputs, const int *ok,
+    const struct compile_stats *stats, int count)
+{
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+    if (!out) {
+        perror("Error opening stats file");
+        return 0;
+    }
+
+    fputs("[\n", out);
+    for (int i = 0; i < count; i++) {
+        fputs("  {\"file\": ", out);
+        write_json_string(out, inputs[i]);
+        fprintf(out, ", \"ok\": %s, \"tokens\": %d, \"ast_nodes\": %lu, \"conversion_casts\": %d, "
+            "\"bytes_emitted\": %lu, \"seconds\": %.6f, \"phases\": {",
+            ok[i] ? "true" : "false", stats[i].token_count, (unsigned long)stats[i].ast_nodes,
+            stats[i].conversion_casts, (unsigned long)stats[i].bytes_emitted, total_seconds(&stats[i]));
+        for (int phase = 0, written = 0; phase < PHASE_COUNT; phase++) {
+            const struct phase_stats *entry = &stats[i].phases[phase];
+
+            if (!entry->ran) {
+                continue;
+            }
+            fprintf(out, "%s\"%s\": {\"seconds\": %.6f, \"allocations\": %lu, \"arena_bytes\": %lu, ",
+                written++ ? ", " : "", phase_keys[phase], entry->seconds, (unsigned long)entry->allocations,
+                (unsigned long)entry->arena_bytes);
+            if (entry->peak_rss_kb >= 0) {
+                fprintf(out, "\"peak_rss_kb\": %ld}", entry->peak_rss_kb);
+            } else {
+                fputs("\"peak_rss_kb\": null}", out);
+            }
+        }
+        fprintf(out, "}}%s\n", i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+
+    if (out == stdout) {
+        fflush(stdout);
+        return 1;
+    }
+    return fclose(out) == 0;
+}
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Streaming compiles (--stream) hold the tokens and AST of one top-level
+ * declaration at a time, so peak memory follows the largest function rather
+ * than the whole file. The first pass lexes the source a declaration at a
+ * time and keeps only what other declarations can refer to: function
+ * signatures, and global variables, whose data is emitted as soon as the
+ * pass ends. The second pass lexes the source again and parses, checks and
+ * emits each function in turn, releasing its AST before the next one.
+ *
+ * The output matches a whole-file compile. Diagnostics can differ when there
+ * are several errors: a syntax error in a function body stops the compile
+ * only once the functions before it have been checked.
+ */
+
+struct stream {
+    struct compilation *unit;
+    struct semantic *sema;
+    struct codegen *gen;
+    struct emitter output;
+    struct lex_cursor position;
+    int ok;
+};
+
+/* Lexes the next declaration into the unit. Returns 0 at the end of the source. */
+static int next_declaration(struct stream *stream)
+{
+    struct compilation *unit = stream->unit;
+
+    stats_phase_begin(unit);
+    lex_declaration(unit, unit->source.data, unit->source.length, &stream->position);
+    stats_phase_end(unit, PHASE_LEX);
+    return unit->tokens[0].type != T_EOF;
+}
+
+static struct ast_node *parse_next(struct stream *stream, int signatures)
+{
+    struct ast_node *declaration;
+
+    stats_phase_begin(stream->unit);
+    declaration = parse_top_level(stream->unit, signatures);
+    stats_phase_end(stream->unit, PHASE_PARSE);
+    return declaration;
+}
+
+static void restart(struct stream *stream)
+{
+    stream->position.offset = 0;
+    stream->position.line_start = 0;
+    stream->position.line = 1;
+}
+
+static void declare_all(struct stream *stream)
+{
+    struct compilation *unit = stream->unit;
+
+    restart(stream);
+    while (next_declaration(stream)) {
+        struct ast_node *declaration = parse_next(stream, 1);
+
+        unit->stats.token_count += unit->token_count - 1;
+        semantic_declare(stream->sema, declaration);
+        if (declaration->type == AST_GLOBAL_DECL) {
+            stream->ok = semantic_check(stream->sema, declaration) && stream->ok;
+            if (stream->ok) {
+                codegen_add_global(stream->gen, declaration);
+            }
+        }
+    }
+    unit->stats.token_count++;
+
+    if (stream->ok) {
+        stats_phase_begin(unit);
+        codegen_emit_globals(stream->gen);
+        stats_phase_end(unit, PHASE_CODEGEN);
+    }
+}
+
+static void emit_functions(struct stream *stream)
+{
+    struct compilation *unit = stream->unit;
+
+    restart(stream);
+    while (next_declaration(stream)) {
+        struct arena_mark mark = arena_mark(&unit->ast_arena);
+        struct ast_node *function = parse_next(stream, 0);
+
+        if (function) {
+            stream->ok = semantic_check(stream->sema, function) && stream->ok;
+            if (stream->ok) {
+                stats_phase_begin(unit);
+                codegen_emit_function(stream->gen, function);
+                stats_phase_end(unit, PHASE_CODEGEN);
+            }
+        }
+        arena_release(&unit->ast_arena, mark);
+    }
+}
+
+/*
+ * Compiles the unit's loaded source to output_path. Fatal errors are caught
+ * here so the output file and the passes' state are cleaned up before
+ * returning to the caller.
+ */
+int compile_stream(struct compilation *unit, const char *output_path)
+{
+    FILE *file = fopen(output_path, "w");
+    struct stream *stream;
+    jmp_buf caller;
+    int ok;
+
+    if (!file) {
+        compilation_diagnostic(unit, "Failed to open %s for writing: %s\n", output_path, strerror(errno));
+        return 0;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        perror("Error allocating stream state");
+        exit(EXIT_FAILURE);
+    }
+    stream->unit = unit;
+    stream->ok = 1;
+    emitter_init(&stream->output, file);
+    stream->sema = semantic_create(unit);
+    stream->gen = codegen_create(unit, &stream->output);
+
+    memcpy(caller, unit->fatal, sizeof(jmp_buf));
+    if (setjmp(unit->fatal) == 0) {
+        declare_all(stream);
+        emit_functions(stream);
+        stream->ok = semantic_finish(stream->sema) && stream->ok;
+    } else {
+        stream->ok = 0;
+    }
+    memcpy(unit->fatal, caller, sizeof(jmp_buf));
+
+    ok = codegen_destroy(stream->gen, stream->ok) && stream->ok;
+    semantic_destroy(stream->sema);
+    emitter_flush(&stream->output);
+    unit->stats.bytes_emitted = stream->output.flushed;
+    emitter_release(&stream->output);
+    free(stream);
+    fclose(file);
+    if (!ok) {
+        remove(output_path);
+    }
+    return ok;
+}
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "defs.h"
+#include "decl.h"
+
+/*
+ * Open-addressing map from interned names to symbol indices. Because names
+ * are interned, keys are compared and hashed by pointer. Deletion uses
+ * backward shifting so that lookups never have to skip tombstones, which
+ * keeps scope exit cheap for the block-structured symbol tables built on it.
+ */
+
+static size_t symbol_map_slot(const struct symbol_map *map, const char *name)
+{
+    uintptr_t key = (uintptr_t)name;
+
+    key ^= key >> 17;
+    key *= (uintptr_t)0x9E3779B97F4A7C15ull;
+    return (size_t)(key >> 7) & (map->capacity - 1);
+}
+
+static void symbol_map_grow(struct symbol_map *map)
+{
+    struct symbol_map grown;
+
+    grown.capacity = map->capacity ? map->capacity * 2 : 64;
+    grown.count = 0;
+    grown.keys = calloc(grown.capacity, sizeof(*grown.keys));
+    grown.values = malloc(grown.capacity * sizeof(*grown.values));
+    if (!grown.keys || !grown.values) {
+        perror("Error allocating symbol table");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i]) {
+            symbol_map_put(&grown, map->keys[i], map->values[i]);
+        }
+    }
+
+    free(map->keys);
+    free(map->values);
+    *map = grown;
+}
+
+int symbol_map_get(const struct symbol_map *map, const char *name)
+{
+    size_t slot;
+
+    if (map->count == 0) {
+        return -1;
+    }
+
+    slot = symbol_map_slot(map, name);
+    while (map->keys[slot]) {
+        if (map->keys[slot] == name) {
+            return map->values[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return -1;
+}
+
+void symbol_map_put(struct symbol_map *map, const char *name, int value)
+{
+    size_t slot;
+
+    if ((map->count + 1) * 2 > map->capacity) {
+        symbol_map_grow(map);
+    }
+
+    slot = symbol_map_slot(map, name);
+    while (map->keys[slot] && map->keys[slot] != name) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    if (!map->keys[slot]) {
+        map->keys[slot] = name;
+        map->count++;
+    }
+    map->values[slot] = value;
+}
+
+void symbol_map_remove(struct symbol_map *map, const char *name)
+{
+    size_t mask = map->capacity - 1;
+    size_t slot;
+    size_t next;
+
+    if (map->count == 0) {
+        return;
+    }
+
+    slot = symbol_map_slot(map, name);
+    while (map->keys[slot] != name) {
+        if (!map->keys[slot]) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    next = slot;
+    while (1) {
+        size_t home;
+
+        next = (next + 1) & mask;
+        if (!map->keys[next]) {
+            break;
+        }
+        home = symbol_map_slot(map, map->keys[next]);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            map->keys[slot] = map->keys[next];
+            map->values[slot] = map->values[next];
+            slot = next;
+        }
+    }
+
+    map->keys[slot] = NULL;
+    map->count--;
+}
+
+void symbol_map_free(struct symbol_map *map)
+{
+    free(map->keys);
+    free(map->values);
+    map->keys = NULL;
+    map->values = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
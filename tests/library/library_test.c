@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "donkey.h"
+
+/*
+ * Drives one libdonkey context through a mix of good and bad inputs and
+ * checks that errors come back as statuses and leave the context usable.
+ * Usage: library_test <source.c> <expected.asm> [<expected_O.asm>]
+ * The optional file is the command-line output with -O -fno-peephole=dead-move.
+ */
+
+static int failures;
+
+static char *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    char *data;
+    long size;
+
+    if (!file || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    data = malloc((size_t)size + 1);
+    if (!data || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    data[size] = '\0';
+    *length = (size_t)size;
+    return data;
+}
+
+static void expect_status(struct donkey_context *context, const char *source, donkey_status expected,
+    const char *diagnostic)
+{
+    donkey_status status = donkey_compile(context, "input.c", source, strlen(source), NULL, NULL);
+
+    if (status != expected) {
+        fprintf(stderr, "Expected %s, got %s for:\n%s\n", donkey_status_string(expected),
+            donkey_status_string(status), source);
+        failures++;
+    } else if (!strstr(donkey_diagnostics(context), diagnostic)) {
+        fprintf(stderr, "Expected diagnostic '%s', got:\n%s", diagnostic, donkey_diagnostics(context));
+        failures++;
+    }
+}
+
+static void expect_assembly(struct donkey_context *context, const char *source, size_t length,
+    const struct donkey_options *options, const char *expected, size_t expected_length)
+{
+    const char *assembly = NULL;
+    size_t assembly_length = 0;
+    donkey_status status = options ?
+        donkey_compile_with_options(context, "input.c", source, length, options, &assembly, &assembly_length) :
+        donkey_compile(context, "input.c", source, length, &assembly, &assembly_length);
+
+    if (status != DONKEY_OK) {
+        fprintf(stderr, "Expected success, got %s:\n%s", donkey_status_string(status),
+            donkey_diagnostics(context));
+        failures++;
+    } else if (assembly_length != expected_length || memcmp(assembly, expected, expected_length) != 0 ||
+        assembly[assembly_length] != '\0') {
+        fprintf(stderr, "Library output differs from the command-line compiler\n");
+        failures++;
+    } else if (donkey_diagnostics(context)[0] != '\0') {
+        fprintf(stderr, "Unexpected diagnostics after success:\n%s", donkey_diagnostics(context));
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct donkey_context *context;
+    size_t source_length;
+    size_t expected_length;
+    char *source;
+    char *expected;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <source.c> <expected.asm> [<expected_O.asm>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    source = read_file(argv[1], &source_length);
+    expected = read_file(argv[2], &expected_length);
+
+    context = donkey_create();
+    if (!context) {
+        fprintf(stderr, "donkey_create failed\n");
+        return EXIT_FAILURE;
+    }
+
+    expect_assembly(context, source, source_length, NULL, expected, expected_length);
+    expect_status(context, "int main()\n{\n    return 1\n}\n", DONKEY_ERROR_SYNTAX,
+        "Parse error at input.c:4:1: expected ';', found '}'");
+    expect_status(context, "int main() { return 1 @ 2; }\n", DONKEY_ERROR_SYNTAX, "Lex error at input.c:1:23");
+    expect_assembly(context, source, source_length, NULL, expected, expected_length);
+    expect_status(context, "int main()\n{\n    return missing;\n}\n", DONKEY_ERROR_SEMANTIC,
+        "use of undeclared variable 'missing'");
+    expect_status(context, "int g = 10 / 0;\nint main() { return g; }\n", DONKEY_ERROR_SEMANTIC,
+        "initializer for global 'g' divides by zero or overflows");
+    expect_assembly(context, source, source_length, NULL, expected, expected_length);
+    if (argc == 4) {
+        struct donkey_options options = { 1, 0 };
+        size_t optimized_length;
+        char *optimized = read_file(argv[3], &optimized_length);
+
+        options.peephole_off = 1 << donkey_peephole_rule("dead-move");
+        expect_assembly(context, source, source_length, &options, optimized, optimized_length);
+        expect_assembly(context, source, source_length, NULL, expected, expected_length);
+        free(optimized);
+    }
+    if (donkey_compile(NULL, "input.c", "", 0, NULL, NULL) != DONKEY_ERROR_ARGUMENT) {
+        fprintf(stderr, "Expected a NULL context to be rejected\n");
+        failures++;
+    }
+
+    donkey_destroy(context);
+    free(source);
+    free(expected);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+int ratio = 10 / 0;
+int table[2] = {1, (-2147483647 - 1) % -1};
+
+int main()
+{
+    return ratio + table[1];
+}